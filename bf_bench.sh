@@ -0,0 +1,4 @@
+#!/bin/bash
+# Usage: ./bf_bench.sh [-n runs] [-w warmup] [-e engines] [-o json] [file.b ...]
+riscv32-unknown-elf-g++ -O2 xkon_bf_bench.cpp -fno-operator-names -std=c++14 -Wall -march=rv32g -o bench.out
+spike --isa=rv32gc pk bench.out "$@"
@@ -40,7 +40,14 @@ class St
     end
     def mkredirect(info)
        as= info[:args].map{|a| a.sub(/\s*=.*/,'').split(/\s+/)[-1]}
-       "  constexpr inline void #{info[:name][-1]}(#{info[:args].join(", ")}) const { parent->#{info[:insn]}(#{as.join(', ')}); }"
+       # DotAccessors は CodeGenerator より前に定義するので、丸めモードは RoundingModes のものを使う
+       args= info[:args].map{|a| a.gsub(/\bRoundingMode\b/,'RoundingModes::RoundingMode')}
+       "  constexpr inline void #{info[:name][-1]}(#{args.join(", ")}) const { parent()->#{info[:insn]}(#{as.join(', ')}); }"
+    end
+
+    def mkunion(indent,name_of)
+        return "" if @children.empty?
+        "#{indent}union {\n"+@children.map{|k,e| "#{indent}  #{e.cls_name} #{name_of.call(e)};\n"}.join()+"#{indent}};\n"
     end
 
     def digest
@@ -63,25 +70,24 @@ class St
     def gen
         if @name.empty?
             s=<<~"EOS"
-            private:
+            // アクセサはすべてメンバーを持たない空のクラスで、共用体で DotAccessors の先頭に重ねて配置する。
+            // そのためアクセサのアドレスは DotAccessors のアドレスと一致し、そこから self_t を求められる。
+            template <class self_t>
+            class DotAccessors {
+              static self_t *parentOf(const void *p) { return static_cast<self_t *>(static_cast<DotAccessors *>(const_cast<void *>(p))); }
             #{@children.map{|k,e| e.gen}.join()}
             public:
-            #{@children.map{|k,e| "  #{e.cls_name} #{e.name};\n"}.join()}
-            CodeGenerator(std::size_t size = 4096) :
-                #{(["Registers()","st(size)"]+@children.keys.map{|e| "#{e}(this)"}).join(", ")}{}
+            #{mkunion("  ",lambda{|e| e.name})}};
             EOS
             return s
         end
         s=<<~"EOS"
         #{@children.map{|k,e| e.gen}.join()}
         class #{cls_name} {
-          friend self_t;
-          self_t *parent;
+          self_t *parent() const { return parentOf(this); }
         public:
-        #{@children.map{|k,e| "  #{e.cls_name} #{e.name.sub(/^.*_/,'')};\n"}.join()}
+        #{mkunion("  ",lambda{|e| e.name.sub(/^.*_/,'')})}
         #{@methods.map{|m| mkredirect(m)}.join("\n")}
-          #{cls_name}(self_t *p) : 
-            #{(["parent(p)"]+@children.keys.map{|e| "#{e}(p)"}).join(", ")}{}
         };
         EOS
         return s
@@ -1,3 +1,4 @@
+#pragma once
 
 #define _CRT_SECURE_NO_WARNINGS
 
@@ -8,6 +9,8 @@
  *   おそらくアドレスの定義が定まってないため。
  *   ホストとRV32のアドレスがごっちゃになって破綻してる。
  *   明確に型を定義して使用するように修正が必要。
+ *   -> ホストのアドレスは la()/callSymbol() で外部シンボルとして参照すれば、
+ *      リロケーション情報として残して relocate() で解決できる。
  * * 後方のラベルを参照する命令で、かつ圧縮命令が存在する場合
  *   1パス目で相対アドレスの範囲が圧縮命令の範囲外でも圧縮命令を生成すると仮定してしまい、
  *   1パス目で通常命令を生成してラベルのアドレスが変化してしまうケースがある。
@@ -34,19 +37,62 @@
  * * unsupportedの呼び出しがちゃんと入っているか？
  *   ->確認して入ってないところに入れた
  * * ニーモニック生成処理を遅延評価で極力動作させないようにする
- *   ->準備だけはした。ニーモニック出力のON/OFF機能は未実装
+ *   ->XKON_DESC が0(DEBUG でない場合の既定)ならニーモニック生成処理自体をコンパイルしない。
+ *     リストが必要な場合は生成後のコードを Disassembler で逆アセンブルする(CodeGenerator::listing())
  */
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <exception>
 #include <functional>
 #include <list>
 #include <map>
+#include <memory>
+#include <new>
+#include <set>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include "bitbuilder.hpp"
 
+// 生成したコードのプロファイラ(Linux perf)への通知
+// 1 でも環境変数 XKON_PERF_MAP/XKON_JITDUMP を設定しなければ何も出力しない
+#ifndef XKON_PERF
+#if defined(__linux__)
+#define XKON_PERF 1
+#else
+#define XKON_PERF 0
+#endif
+#endif
+
+// generate() の命令のエンコードの並列化(std::thread が使える環境のみ)
+#ifndef XKON_PARALLEL
+#if defined(__linux__) || defined(__APPLE__) || defined(_WIN32)
+#define XKON_PARALLEL 1
+#else
+#define XKON_PARALLEL 0
+#endif
+#endif
+
+#if XKON_PARALLEL
+#include <thread>
+#endif
+
+#if XKON_PERF
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
 #if 0
 void dummy(const char* what) { throw std::runtime_error(what); }
 #define XKON_ASSERT(expr) \
@@ -68,8 +114,22 @@ void dummy(const char* what) { throw std::runtime_error(what); }
 #define XKON_OPERATER_NAMES_ARE_USEABLE 1
 #endif
 
+// 命令生成時のニーモニック出力(out.s とデバッグ表示)
+// 0 の場合はニーモニックの文字列生成処理をコンパイルしない
+#ifndef XKON_DESC
+#if defined(DEBUG) && DEBUG
+#define XKON_DESC 1
+#else
+#define XKON_DESC 0
+#endif
+#endif
+
 #define XKON_INSN_NAME(x) x
+#if XKON_DESC
 #define XKON_LAZY(expr) [&]() -> const Format { return (expr); }
+#else
+#define XKON_LAZY(expr) nullptr
+#endif
 //#define XKON_LAZY(expr) [=]()->const Format{ return Format("x"); }
 
 // 開墾
@@ -118,6 +178,8 @@ enum Isa {
   RV32G = RV32 | EXT_G,
   RV32GC = RV32 | EXT_G | EXT_C,
   RV64I = RV64 | EXT_I,
+  RV64G = RV64 | EXT_G,
+  RV64GC = RV64 | EXT_G | EXT_C,
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -152,9 +214,8 @@ constexpr unsigned long enc(const char* s) {
   return v;
 }
 
-/// enc()でエンコードされた整数を文字列に戻す
-std::string dec(unsigned long v) {
-  char buf[5] = {0};
+/// enc()でエンコードされた整数を buf (5バイト以上)に NUL 終端の文字列として戻す
+inline void dec(char* buf, unsigned long v) {
   int i = 0;
   if (v & 0xff000000u) {
     buf[i++] = (v >> 24) & 0xff;
@@ -168,6 +229,13 @@ std::string dec(unsigned long v) {
   if (v & 0x000000ffu) {
     buf[i++] = (v >> 0) & 0xff;
   }
+  buf[i] = '\0';
+}
+
+/// enc()でエンコードされた整数を文字列に戻す
+std::string dec(unsigned long v) {
+  char buf[5];
+  dec(buf, v);
   return std::string(buf);
 }
 
@@ -177,8 +245,8 @@ std::string dec(unsigned long v) {
 struct RegBase {
   const int idx;  /**< レジスタのインデックス番号 */
   const int cidx; /**< 圧縮命令用のレジスタのインデックス番号*/
-  const std::string name;
-  RegBase(int idx, int cidx, unsigned long name) : idx(idx), cidx(cidx), name(dec(name)) {}
+  char name[5];    /**< レジスタ名(命令生成のラムダ式がキャプチャするので std::string にしない) */
+  RegBase(int idx, int cidx, unsigned long name) : idx(idx), cidx(cidx) { dec(this->name, name); }
 
   bool isC() const { return 0 <= cidx; }
   Constant Idx() const { return Constant(5, idx); }
@@ -203,7 +271,7 @@ struct IntOffsetReg : public IntReg {
 };
 
 IntOffsetReg IntReg::operator()(long offset) const {
-  IntOffsetReg res(offset, idx, cidx, enc(name.c_str()));
+  IntOffsetReg res(offset, idx, cidx, enc(name));
   return res;
 }
 
@@ -244,6 +312,1246 @@ struct FReg {
   }
 };
 
+/// レジスタのインデックス番号から整数レジスタを得る
+/// 退避するレジスタの一覧など、実行時に決まるレジスタを命令の引数に指定する場合に使う
+inline IntReg intReg(int idx) {
+  static const char* const names[32] = {
+      "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",  //
+      "a6",   "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+  };
+  XKON_ASSERT(0 <= idx && idx < 32);
+  return IntReg(idx, (8 <= idx && idx <= 15) ? idx - 8 : -1, enc(names[idx]));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 命令デコード
+
+/**
+ * 命令 insn が書き込む整数レジスタのビットマップを返す(x0 は含まない)
+ * 圧縮命令は RV32C として解釈する
+ */
+inline uint32 insnIntDefs(uint32 insn) {
+  uint32 rd = 0;  // 書込み先の整数レジスタ番号(0は書込み無し)
+
+  if ((insn & 3) == 3) {
+    switch (insn & 0x7f) {
+      case 0x37:  // LUI
+      case 0x17:  // AUIPC
+      case 0x6f:  // JAL
+      case 0x67:  // JALR
+      case 0x03:  // LOAD
+      case 0x13:  // OP-IMM
+      case 0x33:  // OP
+      case 0x1b:  // OP-IMM-32
+      case 0x3b:  // OP-32
+      case 0x2f:  // AMO
+      case 0x73:  // SYSTEM
+        rd = (insn >> 7) & 0x1f;
+        break;
+      case 0x53:  // OP-FP のうち、結果を整数レジスタに書き込む命令
+        switch (insn >> 27) {
+          case 0x14:  // FEQ/FLT/FLE
+          case 0x18:  // FCVT.W[U].[SD]
+          case 0x1c:  // FMV.X.W/FCLASS
+            rd = (insn >> 7) & 0x1f;
+            break;
+        }
+        break;
+    }
+  } else {
+    const uint32 funct3 = (insn >> 13) & 7;
+    const uint32 r = (insn >> 7) & 0x1f;  // rd/rs1 フィールド
+    switch (insn & 3) {
+      case 0:
+        if (funct3 == 0 || funct3 == 2) {  // C.ADDI4SPN / C.LW
+          rd = 8 + ((insn >> 2) & 7);
+        }
+        break;
+      case 1:
+        if (funct3 == 0 || funct3 == 2 || funct3 == 3) {  // C.ADDI / C.LI / C.LUI / C.ADDI16SP
+          rd = r;
+        } else if (funct3 == 1) {  // C.JAL
+          rd = 1;
+        } else if (funct3 == 4) {  // C.SRLI / C.SRAI / C.ANDI / C.SUB ...
+          rd = 8 + (r & 7);
+        }
+        break;
+      case 2:
+        if (funct3 == 0 || funct3 == 2) {  // C.SLLI / C.LWSP
+          rd = r;
+        } else if (funct3 == 4) {
+          const uint32 rs2 = (insn >> 2) & 0x1f;
+          if (rs2 != 0) {  // C.MV / C.ADD
+            rd = r;
+          } else if ((insn & 0x1000) && r != 0) {  // C.JALR
+            rd = 1;
+          }
+        }
+        break;
+    }
+  }
+  return (rd != 0) ? (1u << rd) : 0;
+}
+
+/**
+ * 命令 insn が読み出す整数レジスタのビットマップを返す(x0 は含まない)
+ * 圧縮命令は RV32C として解釈する
+ * ECALL は引数レジスタ a0-a7 を読み出すものとして扱う
+ */
+inline uint32 insnIntUses(uint32 insn) {
+  uint32 res = 0;
+
+  if ((insn & 3) == 3) {
+    const uint32 rs1 = 1u << ((insn >> 15) & 0x1f);
+    const uint32 rs2 = 1u << ((insn >> 20) & 0x1f);
+    switch (insn & 0x7f) {
+      case 0x67:  // JALR
+      case 0x03:  // LOAD
+      case 0x07:  // LOAD-FP
+      case 0x13:  // OP-IMM
+      case 0x1b:  // OP-IMM-32
+      case 0x27:  // STORE-FP
+        res = rs1;
+        break;
+      case 0x23:  // STORE
+      case 0x63:  // BRANCH
+      case 0x33:  // OP
+      case 0x3b:  // OP-32
+      case 0x2f:  // AMO
+        res = rs1 | rs2;
+        break;
+      case 0x53:  // OP-FP のうち、整数レジスタを読み出す命令
+        switch (insn >> 27) {
+          case 0x1a:  // FCVT.[SD].W[U]
+          case 0x1e:  // FMV.W.X
+            res = rs1;
+            break;
+        }
+        break;
+      case 0x73:  // SYSTEM
+        if (((insn >> 12) & 7) == 0) {
+          if (insn == 0x00000073) {  // ECALL
+            res = 0x3fc00;
+          }
+        } else if (((insn >> 12) & 4) == 0) {  // CSRRW/CSRRS/CSRRC
+          res = rs1;
+        }
+        break;
+    }
+  } else {
+    const uint32 funct3 = (insn >> 13) & 7;
+    const uint32 r = (insn >> 7) & 0x1f;       // rd/rs1 フィールド
+    const uint32 rs2 = (insn >> 2) & 0x1f;     // rs2 フィールド
+    const uint32 rs1c = 1u << (8 + (r & 7));    // rs1'/rd' フィールド
+    const uint32 rs2c = 1u << (8 + (rs2 & 7));  // rs2' フィールド
+    const uint32 sp = 1u << 2;
+    switch (insn & 3) {
+      case 0:
+        if (funct3 == 0) {  // C.ADDI4SPN
+          res = sp;
+        } else if (funct3 == 6) {  // C.SW
+          res = rs1c | rs2c;
+        } else if (funct3 != 4) {  // C.FLD / C.LW / C.FLW / C.FSD / C.FSW
+          res = rs1c;
+        }
+        break;
+      case 1:
+        if (funct3 == 0) {  // C.ADDI
+          res = 1u << r;
+        } else if (funct3 == 3 && r == 2) {  // C.ADDI16SP
+          res = sp;
+        } else if (funct3 == 4) {  // C.SRLI / C.SRAI / C.ANDI / C.SUB ...
+          res = rs1c | ((((insn >> 10) & 3) == 3) ? rs2c : 0);
+        } else if (funct3 == 6 || funct3 == 7) {  // C.BEQZ / C.BNEZ
+          res = rs1c;
+        }
+        break;
+      case 2:
+        if (funct3 == 0) {  // C.SLLI
+          res = 1u << r;
+        } else if (funct3 == 4) {
+          if (rs2 == 0) {  // C.JR / C.JALR
+            res = 1u << r;
+          } else if (insn & 0x1000) {  // C.ADD
+            res = (1u << r) | (1u << rs2);
+          } else {  // C.MV
+            res = 1u << rs2;
+          }
+        } else if (funct3 == 6) {  // C.SWSP
+          res = sp | (1u << rs2);
+        } else {  // C.FLDSP / C.LWSP / C.FLWSP / C.FSDSP / C.FSWSP
+          res = sp;
+        }
+        break;
+    }
+  }
+  return res & ~1u;
+}
+
+/// 命令による制御の流れの種類
+enum InsnFlow {
+  FlowNext,          ///< 次の命令へ進む
+  FlowBranch,        ///< 条件分岐(分岐しなければ次の命令へ進む)
+  FlowJump,          ///< 無条件分岐
+  FlowCall,          ///< 関数呼び出し(戻ってきて次の命令へ進む)
+  FlowIndirectJump,  ///< 分岐先がレジスタで決まる無条件分岐
+  FlowIndirectCall,  ///< 呼出し先がレジスタで決まる関数呼び出し
+  FlowReturn,        ///< 関数からの復帰
+};
+
+/**
+ * 命令 insn による制御の流れの種類を返す
+ * 分岐先が命令の即値で決まる場合は、命令のアドレスからの相対アドレスを offset に格納する
+ * 圧縮命令は RV32C として解釈する
+ */
+inline InsnFlow insnFlow(uint32 insn, addrdiff_t& offset) {
+  // 即値フィールドの並べ替え(ビット src から width ビットを dst に移す)
+  const auto bits = [insn](int src, int width, int dst) -> uint32 { return ((insn >> src) & ((1u << width) - 1)) << dst; };
+  // 即値の符号拡張
+  const auto sext = [](uint32 v, int width) -> addrdiff_t { return static_cast<int32_t>(v << (32 - width)) >> (32 - width); };
+
+  offset = 0;
+  if ((insn & 3) == 3) {
+    const uint32 rd = (insn >> 7) & 0x1f;
+    const uint32 rs1 = (insn >> 15) & 0x1f;
+    switch (insn & 0x7f) {
+      case 0x63:  // BRANCH
+        offset = sext(bits(31, 1, 12) | bits(25, 6, 5) | bits(8, 4, 1) | bits(7, 1, 11), 13);
+        return FlowBranch;
+      case 0x6f:  // JAL
+        offset = sext(bits(31, 1, 20) | bits(21, 10, 1) | bits(20, 1, 11) | bits(12, 8, 12), 21);
+        return (rd == 0) ? FlowJump : FlowCall;
+      case 0x67:  // JALR
+        if (rd != 0) {
+          return FlowIndirectCall;
+        }
+        return (rs1 == 1 && (insn >> 20) == 0) ? FlowReturn : FlowIndirectJump;
+    }
+  } else {
+    const uint32 funct3 = (insn >> 13) & 7;
+    const uint32 r = (insn >> 7) & 0x1f;
+    switch (insn & 3) {
+      case 1:
+        if (funct3 == 1 || funct3 == 5) {  // C.JAL / C.J
+          offset = sext(bits(12, 1, 11) | bits(11, 1, 4) | bits(9, 2, 8) | bits(8, 1, 10) | bits(7, 1, 6) | bits(6, 1, 7) | bits(3, 3, 1) | bits(2, 1, 5), 12);
+          return (funct3 == 1) ? FlowCall : FlowJump;
+        } else if (funct3 == 6 || funct3 == 7) {  // C.BEQZ / C.BNEZ
+          offset = sext(bits(12, 1, 8) | bits(10, 2, 3) | bits(5, 2, 6) | bits(3, 2, 1) | bits(2, 1, 5), 9);
+          return FlowBranch;
+        }
+        break;
+      case 2:
+        if (funct3 == 4 && ((insn >> 2) & 0x1f) == 0 && r != 0) {
+          if (insn & 0x1000) {  // C.JALR
+            return FlowIndirectCall;
+          }
+          return (r == 1) ? FlowReturn : FlowIndirectJump;  // C.JR
+        }
+        break;
+    }
+  }
+  return FlowNext;
+}
+
+/**
+ * 圧縮命令 insn を対応する32ビット命令に展開して返す(不正な命令なら0)
+ * xlen は 32 または 64(C.JAL/C.ADDIW などの解釈が異なる)
+ */
+inline uint32 insnExpand(uint32 insn, int xlen) {
+  const uint32 c = insn & 0xffff;
+  const auto bits = [c](int src, int width, int dst) -> uint32 { return ((c >> src) & ((1u << width) - 1)) << dst; };
+  const auto sext = [](uint32 v, int width) -> int32 { return static_cast<int32>(v << (32 - width)) >> (32 - width); };
+  const auto encI = [](uint32 opc, uint32 f3, uint32 rd, uint32 rs1, int32 imm) -> uint32 {
+    return (static_cast<uint32>(imm) << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | opc;
+  };
+  const auto encS = [](uint32 opc, uint32 f3, uint32 rs1, uint32 rs2, int32 imm) -> uint32 {
+    const uint32 u = static_cast<uint32>(imm);
+    return (((u >> 5) & 0x7f) << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | ((u & 0x1f) << 7) | opc;
+  };
+  const auto encR = [](uint32 opc, uint32 f3, uint32 f7, uint32 rd, uint32 rs1, uint32 rs2) -> uint32 {
+    return (f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | opc;
+  };
+  const auto encB = [](uint32 f3, uint32 rs1, uint32 rs2, addrdiff_t off) -> uint32 {
+    const uint32 u = static_cast<uint32>(off);
+    return (((u >> 12) & 1) << 31) | (((u >> 5) & 0x3f) << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (((u >> 1) & 0xf) << 8) |
+           (((u >> 11) & 1) << 7) | 0x63;
+  };
+  const auto encJ = [](uint32 rd, addrdiff_t off) -> uint32 {
+    const uint32 u = static_cast<uint32>(off);
+    return (((u >> 20) & 1) << 31) | (((u >> 1) & 0x3ff) << 21) | (((u >> 11) & 1) << 20) | (((u >> 12) & 0xff) << 12) | (rd << 7) | 0x6f;
+  };
+
+  const uint32 funct3 = (c >> 13) & 7;
+  const uint32 r = (c >> 7) & 0x1f;         // rd/rs1
+  const uint32 rs2 = (c >> 2) & 0x1f;       // rs2
+  const uint32 rc = 8 + ((c >> 7) & 7);     // rs1'/rd'
+  const uint32 rs2c = 8 + ((c >> 2) & 7);   // rs2'/rd'
+  const int32 imm6 = sext(bits(12, 1, 5) | bits(2, 5, 0), 6);
+  // C.LW/C.FLW/C.SW/C.FSW と C.LD/C.FLD/C.SD/C.FSD のオフセット
+  const int32 offW = static_cast<int32>(bits(10, 3, 3) | bits(6, 1, 2) | bits(5, 1, 6));
+  const int32 offD = static_cast<int32>(bits(10, 3, 3) | bits(5, 2, 6));
+  // C.LWSP/C.FLWSP と C.LDSP/C.FLDSP のオフセット
+  const int32 spW = static_cast<int32>(bits(12, 1, 5) | bits(4, 3, 2) | bits(2, 2, 6));
+  const int32 spD = static_cast<int32>(bits(12, 1, 5) | bits(5, 2, 3) | bits(2, 3, 6));
+  // C.SWSP/C.FSWSP と C.SDSP/C.FSDSP のオフセット
+  const int32 sspW = static_cast<int32>(bits(9, 4, 2) | bits(7, 2, 6));
+  const int32 sspD = static_cast<int32>(bits(10, 3, 3) | bits(7, 3, 6));
+  const bool rv32 = xlen == 32;
+  addrdiff_t off = 0;
+
+  switch (c & 3) {
+    case 0:
+      switch (funct3) {
+        case 0: {  // C.ADDI4SPN
+          const int32 imm = static_cast<int32>(bits(11, 2, 4) | bits(7, 4, 6) | bits(6, 1, 2) | bits(5, 1, 3));
+          return (imm == 0) ? 0 : encI(0x13, 0, rs2c, 2, imm);
+        }
+        case 1: return encI(0x07, 3, rs2c, rc, offD);                                             // C.FLD
+        case 2: return encI(0x03, 2, rs2c, rc, offW);                                             // C.LW
+        case 3: return rv32 ? encI(0x07, 2, rs2c, rc, offW) : encI(0x03, 3, rs2c, rc, offD);      // C.FLW / C.LD
+        case 5: return encS(0x27, 3, rc, rs2c, offD);                                             // C.FSD
+        case 6: return encS(0x23, 2, rc, rs2c, offW);                                             // C.SW
+        case 7: return rv32 ? encS(0x27, 2, rc, rs2c, offW) : encS(0x23, 3, rc, rs2c, offD);      // C.FSW / C.SD
+      }
+      break;
+    case 1:
+      switch (funct3) {
+        case 0: return encI(0x13, 0, r, r, imm6);  // C.ADDI
+        case 1:
+          if (rv32) {  // C.JAL
+            insnFlow(c, off);
+            return encJ(1, off);
+          }
+          return (r == 0) ? 0 : encI(0x1b, 0, r, r, imm6);  // C.ADDIW
+        case 2: return encI(0x13, 0, r, 0, imm6);  // C.LI
+        case 3:
+          if (r == 2) {  // C.ADDI16SP
+            const int32 imm = sext(bits(12, 1, 9) | bits(6, 1, 4) | bits(5, 1, 6) | bits(3, 2, 7) | bits(2, 1, 5), 10);
+            return (imm == 0) ? 0 : encI(0x13, 0, 2, 2, imm);
+          }
+          return (imm6 == 0) ? 0 : ((static_cast<uint32>(imm6) << 12) | (r << 7) | 0x37);  // C.LUI
+        case 4:
+          switch ((c >> 10) & 3) {
+            case 0: return encI(0x13, 5, rc, rc, static_cast<int32>(bits(12, 1, 5) | bits(2, 5, 0)));          // C.SRLI
+            case 1: return encI(0x13, 5, rc, rc, static_cast<int32>(0x400 | bits(12, 1, 5) | bits(2, 5, 0)));  // C.SRAI
+            case 2: return encI(0x13, 7, rc, rc, imm6);                                                    // C.ANDI
+            default: {
+              static const uint32 f3s[] = {0, 4, 6, 7};
+              const uint32 k = (c >> 5) & 3;
+              if (c & 0x1000) {
+                if (rv32 || 2 <= k) {
+                  return 0;
+                }
+                return encR(0x3b, 0, (k == 0) ? 0x20 : 0, rc, rc, rs2c);  // C.SUBW / C.ADDW
+              }
+              return encR(0x33, f3s[k], (k == 0) ? 0x20 : 0, rc, rc, rs2c);  // C.SUB / C.XOR / C.OR / C.AND
+            }
+          }
+        case 5:  // C.J
+          insnFlow(c, off);
+          return encJ(0, off);
+        case 6:  // C.BEQZ
+        case 7:  // C.BNEZ
+          insnFlow(c, off);
+          return encB(funct3 - 6, rc, 0, off);
+      }
+      break;
+    case 2:
+      switch (funct3) {
+        case 0: return encI(0x13, 1, r, r, static_cast<int32>(bits(12, 1, 5) | bits(2, 5, 0)));  // C.SLLI
+        case 1: return encI(0x07, 3, r, 2, spD);                                                  // C.FLDSP
+        case 2: return (r == 0) ? 0 : encI(0x03, 2, r, 2, spW);                                   // C.LWSP
+        case 3:
+          if (rv32) {
+            return encI(0x07, 2, r, 2, spW);  // C.FLWSP
+          }
+          return (r == 0) ? 0 : encI(0x03, 3, r, 2, spD);  // C.LDSP
+        case 4:
+          if ((c & 0x1000) == 0) {
+            if (rs2 == 0) {
+              return (r == 0) ? 0 : encI(0x67, 0, 0, r, 0);  // C.JR
+            }
+            return encR(0x33, 0, 0, r, 0, rs2);  // C.MV
+          }
+          if (rs2 == 0) {
+            return (r == 0) ? 0x00100073 : encI(0x67, 0, 1, r, 0);  // C.EBREAK / C.JALR
+          }
+          return encR(0x33, 0, 0, r, r, rs2);  // C.ADD
+        case 5: return encS(0x27, 3, 2, rs2, sspD);                                                  // C.FSDSP
+        case 6: return encS(0x23, 2, 2, rs2, sspW);                                                  // C.SWSP
+        case 7: return rv32 ? encS(0x27, 2, 2, rs2, sspW) : encS(0x23, 3, 2, rs2, sspD);           // C.FSWSP / C.SDSP
+      }
+      break;
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 逆アセンブラ
+
+/**
+ * 生成済みのコードを命令表に従って逆アセンブルする
+ *
+ * 命令表を先頭から検索し、(insn & mask) == match となる最初の項目として表示する。
+ * 別名(li/mv/ret など)は元の命令より前に置く。圧縮命令は対応する32ビット命令に展開して表示する。
+ * コード生成とは独立しているので、generate() の後の任意の時点・任意の範囲(書き換えたコードを含む)を表示できる。
+ *
+ * オペランドの書式
+ *   d/s/t : rd/rs1/rs2(整数)          D/S/T/R : rd/rs1/rs2/rs3(浮動小数点)
+ *   j : I形式の即値                     o/q : I形式/S形式のオフセット付き rs1
+ *   A : (rs1)                           p/a : 分岐先/ジャンプ先
+ *   u : U形式の即値                     > / < : シフト量(XLEN/32ビット)
+ *   E : CSR                             Z : CSR 命令の即値
+ *   m : 丸めモード(dyn 以外の場合のみ ",rm" を表示)
+ */
+class Disassembler {
+  struct Entry {
+    uint32 mask;
+    uint32 match;
+    const char* name;
+    const char* args;
+    int xlen;     ///< 0 なら RV32/RV64 共通
+    bool sameRs;  ///< rs1 == rs2 の場合のみ一致(fmv.s などの別名)
+  };
+
+  static const Entry* table() {
+    static const Entry entries[] = {
+        // RV32I/RV64I
+        {0xffffffff, 0x00000013, "nop", "", 0, false},
+        {0x000ff07f, 0x00000013, "li", "d,j", 0, false},
+        {0xfff0707f, 0x00000013, "mv", "d,s", 0, false},
+        {0x0000707f, 0x00000013, "addi", "d,s,j", 0, false},
+        {0x0000707f, 0x00002013, "slti", "d,s,j", 0, false},
+        {0xfff0707f, 0x00103013, "seqz", "d,s", 0, false},
+        {0x0000707f, 0x00003013, "sltiu", "d,s,j", 0, false},
+        {0xfff0707f, 0xfff04013, "not", "d,s", 0, false},
+        {0x0000707f, 0x00004013, "xori", "d,s,j", 0, false},
+        {0x0000707f, 0x00006013, "ori", "d,s,j", 0, false},
+        {0x0000707f, 0x00007013, "andi", "d,s,j", 0, false},
+        {0xfc00707f, 0x00001013, "slli", "d,s,>", 0, false},
+        {0xfc00707f, 0x00005013, "srli", "d,s,>", 0, false},
+        {0xfc00707f, 0x40005013, "srai", "d,s,>", 0, false},
+        {0xfe0ff07f, 0x00000033, "mv", "d,t", 0, false},
+        {0xfe00707f, 0x00000033, "add", "d,s,t", 0, false},
+        {0xfe0ff07f, 0x40000033, "neg", "d,t", 0, false},
+        {0xfe00707f, 0x40000033, "sub", "d,s,t", 0, false},
+        {0xfe00707f, 0x00001033, "sll", "d,s,t", 0, false},
+        {0xfe00707f, 0x00002033, "slt", "d,s,t", 0, false},
+        {0xfe0ff07f, 0x00003033, "snez", "d,t", 0, false},
+        {0xfe00707f, 0x00003033, "sltu", "d,s,t", 0, false},
+        {0xfe00707f, 0x00004033, "xor", "d,s,t", 0, false},
+        {0xfe00707f, 0x00005033, "srl", "d,s,t", 0, false},
+        {0xfe00707f, 0x40005033, "sra", "d,s,t", 0, false},
+        {0xfe00707f, 0x00006033, "or", "d,s,t", 0, false},
+        {0xfe00707f, 0x00007033, "and", "d,s,t", 0, false},
+        {0x0000007f, 0x00000037, "lui", "d,u", 0, false},
+        {0x0000007f, 0x00000017, "auipc", "d,u", 0, false},
+        {0x00000fff, 0x0000006f, "j", "a", 0, false},
+        {0x00000fff, 0x000000ef, "jal", "a", 0, false},
+        {0x0000007f, 0x0000006f, "jal", "d,a", 0, false},
+        {0xffffffff, 0x00008067, "ret", "", 0, false},
+        {0xfff07fff, 0x00000067, "jr", "s", 0, false},
+        {0xfff07fff, 0x000000e7, "jalr", "s", 0, false},
+        {0x0000707f, 0x00000067, "jalr", "d,o", 0, false},
+        {0x01f0707f, 0x00000063, "beqz", "s,p", 0, false},
+        {0x0000707f, 0x00000063, "beq", "s,t,p", 0, false},
+        {0x01f0707f, 0x00001063, "bnez", "s,p", 0, false},
+        {0x0000707f, 0x00001063, "bne", "s,t,p", 0, false},
+        {0x01f0707f, 0x00004063, "bltz", "s,p", 0, false},
+        {0x000ff07f, 0x00004063, "bgtz", "t,p", 0, false},
+        {0x0000707f, 0x00004063, "blt", "s,t,p", 0, false},
+        {0x000ff07f, 0x00005063, "blez", "t,p", 0, false},
+        {0x01f0707f, 0x00005063, "bgez", "s,p", 0, false},
+        {0x0000707f, 0x00005063, "bge", "s,t,p", 0, false},
+        {0x0000707f, 0x00006063, "bltu", "s,t,p", 0, false},
+        {0x0000707f, 0x00007063, "bgeu", "s,t,p", 0, false},
+        {0x0000707f, 0x00000003, "lb", "d,o", 0, false},
+        {0x0000707f, 0x00001003, "lh", "d,o", 0, false},
+        {0x0000707f, 0x00002003, "lw", "d,o", 0, false},
+        {0x0000707f, 0x00003003, "ld", "d,o", 64, false},
+        {0x0000707f, 0x00004003, "lbu", "d,o", 0, false},
+        {0x0000707f, 0x00005003, "lhu", "d,o", 0, false},
+        {0x0000707f, 0x00006003, "lwu", "d,o", 64, false},
+        {0x0000707f, 0x00000023, "sb", "t,q", 0, false},
+        {0x0000707f, 0x00001023, "sh", "t,q", 0, false},
+        {0x0000707f, 0x00002023, "sw", "t,q", 0, false},
+        {0x0000707f, 0x00003023, "sd", "t,q", 64, false},
+        {0x0000707f, 0x0000000f, "fence", "", 0, false},
+        {0x0000707f, 0x0000100f, "fence.i", "", 0, false},
+        {0xffffffff, 0x00000073, "ecall", "", 0, false},
+        {0xffffffff, 0x00100073, "ebreak", "", 0, false},
+        {0xfff0707f, 0x0000001b, "sext.w", "d,s", 64, false},
+        {0x0000707f, 0x0000001b, "addiw", "d,s,j", 64, false},
+        {0xfe00707f, 0x0000101b, "slliw", "d,s,<", 64, false},
+        {0xfe00707f, 0x0000501b, "srliw", "d,s,<", 64, false},
+        {0xfe00707f, 0x4000501b, "sraiw", "d,s,<", 64, false},
+        {0xfe00707f, 0x0000003b, "addw", "d,s,t", 64, false},
+        {0xfe00707f, 0x4000003b, "subw", "d,s,t", 64, false},
+        {0xfe00707f, 0x0000103b, "sllw", "d,s,t", 64, false},
+        {0xfe00707f, 0x0000503b, "srlw", "d,s,t", 64, false},
+        {0xfe00707f, 0x4000503b, "sraw", "d,s,t", 64, false},
+        // Zicsr
+        {0xfffff07f, 0xc0002073, "rdcycle", "d", 0, false},
+        {0xfffff07f, 0xc0102073, "rdtime", "d", 0, false},
+        {0xfffff07f, 0xc0202073, "rdinstret", "d", 0, false},
+        {0xfffff07f, 0xc8002073, "rdcycleh", "d", 32, false},
+        {0xfffff07f, 0xc8102073, "rdtimeh", "d", 32, false},
+        {0xfffff07f, 0xc8202073, "rdinstreth", "d", 32, false},
+        {0xfffff07f, 0x00302073, "frcsr", "d", 0, false},
+        {0xfffff07f, 0x00202073, "frrm", "d", 0, false},
+        {0xfffff07f, 0x00102073, "frflags", "d", 0, false},
+        {0x000ff07f, 0x00002073, "csrr", "d,E", 0, false},
+        {0x00007fff, 0x00001073, "csrw", "E,s", 0, false},
+        {0x0000707f, 0x00001073, "csrrw", "d,E,s", 0, false},
+        {0x0000707f, 0x00002073, "csrrs", "d,E,s", 0, false},
+        {0x0000707f, 0x00003073, "csrrc", "d,E,s", 0, false},
+        {0x0000707f, 0x00005073, "csrrwi", "d,E,Z", 0, false},
+        {0x0000707f, 0x00006073, "csrrsi", "d,E,Z", 0, false},
+        {0x0000707f, 0x00007073, "csrrci", "d,E,Z", 0, false},
+        // M
+        {0xfe00707f, 0x02000033, "mul", "d,s,t", 0, false},
+        {0xfe00707f, 0x02001033, "mulh", "d,s,t", 0, false},
+        {0xfe00707f, 0x02002033, "mulhsu", "d,s,t", 0, false},
+        {0xfe00707f, 0x02003033, "mulhu", "d,s,t", 0, false},
+        {0xfe00707f, 0x02004033, "div", "d,s,t", 0, false},
+        {0xfe00707f, 0x02005033, "divu", "d,s,t", 0, false},
+        {0xfe00707f, 0x02006033, "rem", "d,s,t", 0, false},
+        {0xfe00707f, 0x02007033, "remu", "d,s,t", 0, false},
+        {0xfe00707f, 0x0200003b, "mulw", "d,s,t", 64, false},
+        {0xfe00707f, 0x0200403b, "divw", "d,s,t", 64, false},
+        {0xfe00707f, 0x0200503b, "divuw", "d,s,t", 64, false},
+        {0xfe00707f, 0x0200603b, "remw", "d,s,t", 64, false},
+        {0xfe00707f, 0x0200703b, "remuw", "d,s,t", 64, false},
+        // A
+        {0xf9f0707f, 0x1000202f, "lr.w", "d,A", 0, false},
+        {0xf800707f, 0x1800202f, "sc.w", "d,t,A", 0, false},
+        {0xf800707f, 0x0800202f, "amoswap.w", "d,t,A", 0, false},
+        {0xf800707f, 0x0000202f, "amoadd.w", "d,t,A", 0, false},
+        {0xf800707f, 0x2000202f, "amoxor.w", "d,t,A", 0, false},
+        {0xf800707f, 0x6000202f, "amoand.w", "d,t,A", 0, false},
+        {0xf800707f, 0x4000202f, "amoor.w", "d,t,A", 0, false},
+        {0xf800707f, 0x8000202f, "amomin.w", "d,t,A", 0, false},
+        {0xf800707f, 0xa000202f, "amomax.w", "d,t,A", 0, false},
+        {0xf800707f, 0xc000202f, "amominu.w", "d,t,A", 0, false},
+        {0xf800707f, 0xe000202f, "amomaxu.w", "d,t,A", 0, false},
+        {0xf9f0707f, 0x1000302f, "lr.d", "d,A", 64, false},
+        {0xf800707f, 0x1800302f, "sc.d", "d,t,A", 64, false},
+        {0xf800707f, 0x0800302f, "amoswap.d", "d,t,A", 64, false},
+        {0xf800707f, 0x0000302f, "amoadd.d", "d,t,A", 64, false},
+        {0xf800707f, 0x2000302f, "amoxor.d", "d,t,A", 64, false},
+        {0xf800707f, 0x6000302f, "amoand.d", "d,t,A", 64, false},
+        {0xf800707f, 0x4000302f, "amoor.d", "d,t,A", 64, false},
+        {0xf800707f, 0x8000302f, "amomin.d", "d,t,A", 64, false},
+        {0xf800707f, 0xa000302f, "amomax.d", "d,t,A", 64, false},
+        {0xf800707f, 0xc000302f, "amominu.d", "d,t,A", 64, false},
+        {0xf800707f, 0xe000302f, "amomaxu.d", "d,t,A", 64, false},
+        // F/D
+        {0x0000707f, 0x00002007, "flw", "D,o", 0, false},
+        {0x0000707f, 0x00003007, "fld", "D,o", 0, false},
+        {0x0000707f, 0x00002027, "fsw", "T,q", 0, false},
+        {0x0000707f, 0x00003027, "fsd", "T,q", 0, false},
+        {0x0600007f, 0x00000043, "fmadd.s", "D,S,T,Rm", 0, false},
+        {0x0600007f, 0x00000047, "fmsub.s", "D,S,T,Rm", 0, false},
+        {0x0600007f, 0x0000004b, "fnmsub.s", "D,S,T,Rm", 0, false},
+        {0x0600007f, 0x0000004f, "fnmadd.s", "D,S,T,Rm", 0, false},
+        {0x0600007f, 0x02000043, "fmadd.d", "D,S,T,Rm", 0, false},
+        {0x0600007f, 0x02000047, "fmsub.d", "D,S,T,Rm", 0, false},
+        {0x0600007f, 0x0200004b, "fnmsub.d", "D,S,T,Rm", 0, false},
+        {0x0600007f, 0x0200004f, "fnmadd.d", "D,S,T,Rm", 0, false},
+        {0xfe00007f, 0x00000053, "fadd.s", "D,S,Tm", 0, false},
+        {0xfe00007f, 0x08000053, "fsub.s", "D,S,Tm", 0, false},
+        {0xfe00007f, 0x10000053, "fmul.s", "D,S,Tm", 0, false},
+        {0xfe00007f, 0x18000053, "fdiv.s", "D,S,Tm", 0, false},
+        {0xfff0007f, 0x58000053, "fsqrt.s", "D,Sm", 0, false},
+        {0xfe00007f, 0x02000053, "fadd.d", "D,S,Tm", 0, false},
+        {0xfe00007f, 0x0a000053, "fsub.d", "D,S,Tm", 0, false},
+        {0xfe00007f, 0x12000053, "fmul.d", "D,S,Tm", 0, false},
+        {0xfe00007f, 0x1a000053, "fdiv.d", "D,S,Tm", 0, false},
+        {0xfff0007f, 0x5a000053, "fsqrt.d", "D,Sm", 0, false},
+        {0xfe00707f, 0x20000053, "fmv.s", "D,S", 0, true},
+        {0xfe00707f, 0x20001053, "fneg.s", "D,S", 0, true},
+        {0xfe00707f, 0x20002053, "fabs.s", "D,S", 0, true},
+        {0xfe00707f, 0x20000053, "fsgnj.s", "D,S,T", 0, false},
+        {0xfe00707f, 0x20001053, "fsgnjn.s", "D,S,T", 0, false},
+        {0xfe00707f, 0x20002053, "fsgnjx.s", "D,S,T", 0, false},
+        {0xfe00707f, 0x22000053, "fmv.d", "D,S", 0, true},
+        {0xfe00707f, 0x22001053, "fneg.d", "D,S", 0, true},
+        {0xfe00707f, 0x22002053, "fabs.d", "D,S", 0, true},
+        {0xfe00707f, 0x22000053, "fsgnj.d", "D,S,T", 0, false},
+        {0xfe00707f, 0x22001053, "fsgnjn.d", "D,S,T", 0, false},
+        {0xfe00707f, 0x22002053, "fsgnjx.d", "D,S,T", 0, false},
+        {0xfe00707f, 0x28000053, "fmin.s", "D,S,T", 0, false},
+        {0xfe00707f, 0x28001053, "fmax.s", "D,S,T", 0, false},
+        {0xfe00707f, 0x2a000053, "fmin.d", "D,S,T", 0, false},
+        {0xfe00707f, 0x2a001053, "fmax.d", "D,S,T", 0, false},
+        {0xfff0007f, 0x40100053, "fcvt.s.d", "D,Sm", 0, false},
+        {0xfff0007f, 0x42000053, "fcvt.d.s", "D,S", 0, false},
+        {0xfe00707f, 0xa0002053, "feq.s", "d,S,T", 0, false},
+        {0xfe00707f, 0xa0001053, "flt.s", "d,S,T", 0, false},
+        {0xfe00707f, 0xa0000053, "fle.s", "d,S,T", 0, false},
+        {0xfe00707f, 0xa2002053, "feq.d", "d,S,T", 0, false},
+        {0xfe00707f, 0xa2001053, "flt.d", "d,S,T", 0, false},
+        {0xfe00707f, 0xa2000053, "fle.d", "d,S,T", 0, false},
+        {0xfff0007f, 0xc0000053, "fcvt.w.s", "d,Sm", 0, false},
+        {0xfff0007f, 0xc0100053, "fcvt.wu.s", "d,Sm", 0, false},
+        {0xfff0007f, 0xc0200053, "fcvt.l.s", "d,Sm", 64, false},
+        {0xfff0007f, 0xc0300053, "fcvt.lu.s", "d,Sm", 64, false},
+        {0xfff0007f, 0xc2000053, "fcvt.w.d", "d,Sm", 0, false},
+        {0xfff0007f, 0xc2100053, "fcvt.wu.d", "d,Sm", 0, false},
+        {0xfff0007f, 0xc2200053, "fcvt.l.d", "d,Sm", 64, false},
+        {0xfff0007f, 0xc2300053, "fcvt.lu.d", "d,Sm", 64, false},
+        {0xfff0007f, 0xd0000053, "fcvt.s.w", "D,sm", 0, false},
+        {0xfff0007f, 0xd0100053, "fcvt.s.wu", "D,sm", 0, false},
+        {0xfff0007f, 0xd0200053, "fcvt.s.l", "D,sm", 64, false},
+        {0xfff0007f, 0xd0300053, "fcvt.s.lu", "D,sm", 64, false},
+        {0xfff0007f, 0xd2000053, "fcvt.d.w", "D,s", 0, false},
+        {0xfff0007f, 0xd2100053, "fcvt.d.wu", "D,s", 0, false},
+        {0xfff0007f, 0xd2200053, "fcvt.d.l", "D,sm", 64, false},
+        {0xfff0007f, 0xd2300053, "fcvt.d.lu", "D,sm", 64, false},
+        {0xfff0707f, 0xe0000053, "fmv.x.w", "d,S", 0, false},
+        {0xfff0707f, 0xe0001053, "fclass.s", "d,S", 0, false},
+        {0xfff0707f, 0xe2000053, "fmv.x.d", "d,S", 64, false},
+        {0xfff0707f, 0xe2001053, "fclass.d", "d,S", 0, false},
+        {0xfff0707f, 0xf0000053, "fmv.w.x", "D,s", 0, false},
+        {0xfff0707f, 0xf2000053, "fmv.d.x", "D,s", 64, false},
+        {0, 0, nullptr, nullptr, 0, false},
+    };
+    return entries;
+  }
+
+  static const char* intName(uint32 r) {
+    static const char* const names[] = {
+        "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",  //
+        "a6",   "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+    };
+    return names[r & 0x1f];
+  }
+
+  static const char* fpName(uint32 r) {
+    static const char* const names[] = {
+        "ft0", "ft1", "ft2", "ft3", "ft4", "ft5", "ft6",  "ft7",  "fs0", "fs1", "fa0", "fa1", "fa2", "fa3", "fa4", "fa5",  //
+        "fa6", "fa7", "fs2", "fs3", "fs4", "fs5", "fs6", "fs7", "fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft10", "ft11",
+    };
+    return names[r & 0x1f];
+  }
+
+  static std::string csrName(uint32 csr) {
+    switch (csr) {
+      case 0x001: return "fflags";
+      case 0x002: return "frm";
+      case 0x003: return "fcsr";
+      case 0xc00: return "cycle";
+      case 0xc01: return "time";
+      case 0xc02: return "instret";
+      case 0xc80: return "cycleh";
+      case 0xc81: return "timeh";
+      case 0xc82: return "instreth";
+    }
+    char buf[16];
+    snprintf(buf, sizeof(buf), "0x%03x", csr);
+    return buf;
+  }
+
+  int xlen;
+  std::multimap<addr_t, std::string> labels;  ///< オフセットからラベル名
+
+  /// 分岐先 target の表示("offset <label>")
+  std::string target(addr_t t) const {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llx", t);
+    std::string s = buf;
+    const auto itr = labels.find(t);
+    if (itr != labels.end()) {
+      s += " <" + itr->second + ">";
+    }
+    return s;
+  }
+
+  /// 32ビット命令 insn のテキスト表記(不明な命令なら空文字列)
+  std::string format(uint32 insn, addr_t addr) const {
+    const Entry* e = table();
+    for (; e->name != nullptr; ++e) {
+      if ((insn & e->mask) == e->match && (e->xlen == 0 || e->xlen == xlen) && (!e->sameRs || ((insn >> 15) & 0x1f) == ((insn >> 20) & 0x1f))) {
+        break;
+      }
+    }
+    if (e->name == nullptr) {
+      return "";
+    }
+
+    const uint32 rd = (insn >> 7) & 0x1f;
+    const uint32 rs1 = (insn >> 15) & 0x1f;
+    const uint32 rs2 = (insn >> 20) & 0x1f;
+    const int32 immI = static_cast<int32>(insn) >> 20;
+    const int32 immS = ((static_cast<int32>(insn) >> 25) << 5) | static_cast<int32>(rd);
+    std::string s = e->name;
+    if ((insn & 0x7f) == 0x2f) {  // AMO の aq/rl
+      static const char* const order[] = {"", ".rl", ".aq", ".aqrl"};
+      s += order[(insn >> 25) & 3];
+    }
+    if (*e->args != '\0') {
+      s += " ";
+    }
+
+    char buf[32];
+    addrdiff_t off;
+    for (const char* a = e->args; *a != '\0'; ++a) {
+      switch (*a) {
+        case ',': s += ","; break;
+        case 'd': s += intName(rd); break;
+        case 's': s += intName(rs1); break;
+        case 't': s += intName(rs2); break;
+        case 'D': s += fpName(rd); break;
+        case 'S': s += fpName(rs1); break;
+        case 'T': s += fpName(rs2); break;
+        case 'R': s += fpName(insn >> 27); break;
+        case 'j': s += std::to_string(immI); break;
+        case 'o': s += std::to_string(immI) + "(" + intName(rs1) + ")"; break;
+        case 'q': s += std::to_string(immS) + "(" + intName(rs1) + ")"; break;
+        case 'A': s += std::string("(") + intName(rs1) + ")"; break;
+        case 'p':
+        case 'a':
+          insnFlow(insn, off);
+          s += target(addr + off);
+          break;
+        case 'u':
+          snprintf(buf, sizeof(buf), "0x%x", insn >> 12);
+          s += buf;
+          break;
+        case '>': s += std::to_string(rs2 | ((xlen == 64) ? ((insn >> 20) & 0x20) : 0)); break;
+        case '<': s += std::to_string(rs2); break;
+        case 'E': s += csrName(insn >> 20); break;
+        case 'Z': s += std::to_string(rs1); break;
+        case 'm': {
+          static const char* const modes[] = {"rne", "rtz", "rdn", "rup", "rmm", "rm5", "rm6", "dyn"};
+          const uint32 rm = (insn >> 12) & 7;
+          if (rm != 7) {
+            s += std::string(",") + modes[rm];
+          }
+          break;
+        }
+      }
+    }
+    return s;
+  }
+
+ public:
+  explicit Disassembler(int xlen = 32) : xlen(xlen), labels() { XKON_ASSERT(xlen == 32 || xlen == 64); }
+
+  void addLabel(const std::string& name, addr_t offset) { labels.insert(std::make_pair(offset, name)); }
+  void addLabels(const std::map<std::string, addr_t>& m) {
+    for (const auto& e : m) {
+      addLabel(e.first, e.second);
+    }
+  }
+
+  /**
+   * code から始まる1命令(残り avail バイト)を逆アセンブルして text に格納し、命令のバイト数を返す
+   * addr は命令のオフセット(分岐先とラベルの表示に使う)
+   */
+  std::size_t disassemble(const void* code, std::size_t avail, addr_t addr, std::string& text) const {
+    const unsigned char* p = static_cast<const unsigned char*>(code);
+    char buf[32];
+    if (avail < 2) {
+      snprintf(buf, sizeof(buf), ".byte 0x%02x", p[0]);
+      text = buf;
+      return 1;
+    }
+    const uint32 lo = p[0] | (p[1] << 8);
+    if ((lo & 3) == 3 && 4 <= avail) {
+      const uint32 insn = lo | (p[2] << 16) | (static_cast<uint32>(p[3]) << 24);
+      text = format(insn, addr);
+      if (text.empty()) {
+        snprintf(buf, sizeof(buf), ".word 0x%08x", insn);
+        text = buf;
+      }
+      return 4;
+    }
+    const uint32 insn = insnExpand(lo, xlen);
+    text = (insn != 0) ? format(insn, addr) : "";
+    if (text.empty()) {
+      snprintf(buf, sizeof(buf), ".hword 0x%04x", lo);
+      text = buf;
+    }
+    return 2;
+  }
+
+  /// code から size バイトの逆アセンブルリスト。base は先頭のオフセット
+  std::string listing(const void* code, std::size_t size, addr_t base = 0) const {
+    const unsigned char* p = static_cast<const unsigned char*>(code);
+    std::string res;
+    std::string text;
+    char buf[64];
+    for (std::size_t i = 0; i < size;) {
+      const addr_t addr = base + i;
+      const auto range = labels.equal_range(addr);
+      for (auto itr = range.first; itr != range.second; ++itr) {
+        snprintf(buf, sizeof(buf), "%08llx <", addr);
+        res += buf + itr->second + ">:\n";
+      }
+      const std::size_t n = disassemble(p + i, size - i, addr, text);
+      if (n == 4) {
+        snprintf(buf, sizeof(buf), "%8llx:\t%02x%02x%02x%02x\t", addr, p[i + 3], p[i + 2], p[i + 1], p[i]);
+      } else if (n == 2) {
+        snprintf(buf, sizeof(buf), "%8llx:\t    %02x%02x\t", addr, p[i + 1], p[i]);
+      } else {
+        snprintf(buf, sizeof(buf), "%8llx:\t      %02x\t", addr, p[i]);
+      }
+      res += buf + text + "\n";
+      i += n;
+    }
+    return res;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// リロケーション
+//
+// 外部のアドレス(データやホストの関数)を命令に直接埋め込まず、リロケーション情報として残す。
+// 生成したコードを別の場所にコピーしたり、キャッシュやプロセス間で共有したりした後で、
+// relocate() で1回修正するだけで実行できるようになる。
+
+/// 外部シンボルのアドレスの参照方法(CodeGenerator::la() 等が生成する命令列)
+enum RelocMode {
+  RelocAbsolute,  ///< lui+addi で絶対アドレスを埋め込む
+  RelocPcrel,     ///< auipc+addi で PC 相対アドレスを埋め込む(コードとシンボルの距離が固定なら再配置不要)
+  RelocGot,       ///< コード末尾の GOT のスロットから auipc+lw で読み込む(修正はスロットのみでコードは書き換えない)
+};
+
+/// リロケーションの種類
+enum RelocType {
+  RelocHi20Lo12,       ///< offset の lui と直後の I 形式命令に絶対アドレスの上位20ビットと下位12ビット
+  RelocPcrelHi20Lo12,  ///< offset の auipc と直後の I 形式命令に offset からの相対アドレスの上位20ビットと下位12ビット
+  RelocGotSlot,        ///< offset の XLEN ビットのスロットに絶対アドレス
+};
+
+/// リロケーション情報
+struct Relocation {
+  RelocType type;
+  addr_t offset;       ///< 修正箇所(コードの先頭からのオフセット)
+  std::string symbol;  ///< 参照するシンボル
+  addrdiff_t addend;   ///< シンボルのアドレスに加算する値
+};
+
+/// シンボル名からアドレス
+typedef std::map<std::string, addr_t> SymbolTable;
+
+/// relocs で使うシンボルがすべて symbols で定義されているなら true を返す
+inline bool isResolvable(const std::vector<Relocation>& relocs, const SymbolTable& symbols) {
+  for (const auto& r : relocs) {
+    if (symbols.find(r.symbol) == symbols.end()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * 実行時に base に配置される code に、リロケーション relocs を symbols で解決して適用する
+ * code の内容は生成時のもの(または一度 relocate() したもの)でよい。修正箇所はすべて上書きする
+ * xlen は GOT のスロットのビット数
+ */
+inline void relocate(char* code, addr_t base, const std::vector<Relocation>& relocs, const SymbolTable& symbols, int xlen = 32) {
+  const auto read32 = [code](addr_t off) -> uint32 {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(code + off);
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32>(p[3]) << 24);
+  };
+  const auto write = [code](addr_t off, unsigned long long v, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+      code[off + i] = static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+  };
+  // 上位20ビット(下位12ビットの符号拡張分を補正)と下位12ビットの組に分けて U 形式と I 形式の命令に書き込む
+  const auto patchHiLo = [&](addr_t off, uint32 v) {
+    const uint32 hi = (v + 0x800) & 0xfffff000;
+    const uint32 lo = v - hi;
+    write(off, (read32(off) & 0x00000fff) | hi, 4);
+    write(off + 4, (read32(off + 4) & 0x000fffff) | (lo << 20), 4);
+  };
+
+  for (const auto& r : relocs) {
+    const auto itr = symbols.find(r.symbol);
+    if (itr == symbols.end()) {
+      throw UnsupportedException("Undefined symbol '" + r.symbol + "'.");
+    }
+    const addr_t value = itr->second + r.addend;
+    switch (r.type) {
+      case RelocHi20Lo12:
+        patchHiLo(r.offset, static_cast<uint32>(value));
+        break;
+      case RelocPcrelHi20Lo12:
+        patchHiLo(r.offset, static_cast<uint32>(value - (base + r.offset)));
+        break;
+      case RelocGotSlot:
+        write(r.offset, value, xlen / 8);
+        break;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ソース位置の対応表
+//
+// CodeGenerator::setSource() で以降に生成する命令に付けたソースの識別子(行番号や BF のコマンドの位置等)を、
+// 命令列のオフセットから引けるようにする。プロファイラのサンプルやクラッシュ時の PC をソースに対応付けるのに使う。
+
+/**
+ * 命令列のオフセットからソースの識別子への対応表
+ * 識別子が変わる位置ごとに、オフセットの差分と識別子の差分(符号付き)を可変長で詰めて格納する。
+ * CHECKPOINT 個ごとに復号済みの値を持ち、二分探索で近い位置から復号する。
+ */
+class SourceMap {
+ public:
+  /// 識別子が無い範囲
+  static const uint32 NO_SOURCE = 0xffffffff;
+
+ private:
+  static const std::size_t CHECKPOINT = 16;
+
+  /// 復号の開始位置
+  struct Checkpoint {
+    addr_t offset;
+    uint32 id;
+    uint32 pos;  ///< data の位置
+  };
+
+  std::vector<unsigned char> data;
+  std::vector<Checkpoint> checkpoints;
+  std::size_t count;
+  addr_t end;                                    ///< 命令列のサイズ
+  std::vector<std::pair<addr_t, uint32>> marks;  ///< 生成中に add() された要素(finish() で格納する)
+
+  void putVarint(uint32 v) {
+    while (0x80 <= v) {
+      data.push_back(static_cast<unsigned char>(v | 0x80));
+      v >>= 7;
+    }
+    data.push_back(static_cast<unsigned char>(v));
+  }
+  uint32 getVarint(std::size_t& pos) const {
+    uint32 v = 0;
+    for (int shift = 0;; shift += 7) {
+      const unsigned char b = data[pos++];
+      v |= static_cast<uint32>(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) {
+        return v;
+      }
+    }
+  }
+
+ public:
+  SourceMap() : data(), checkpoints(), count(0), end(0), marks() {}
+
+  void clear() {
+    data.clear();
+    checkpoints.clear();
+    count = 0;
+    end = 0;
+    marks.clear();
+  }
+
+  /// offset 以降の識別子を id にする
+  void add(addr_t offset, uint32 id) { marks.push_back(std::make_pair(offset, id)); }
+
+  /// other に add() した要素を、この後に add() したものとして移す
+  void append(SourceMap& other) {
+    marks.insert(marks.end(), other.marks.begin(), other.marks.end());
+    other.marks.clear();
+  }
+
+  /**
+   * add() した要素を格納する。size は命令列のサイズ(これ以降のオフセットは NO_SOURCE)
+   * 命令の並べ替えで add() の順序とオフセットの順序が異なっていてもよい。
+   * 同じオフセットの要素は後で add() したものを優先する
+   */
+  void finish(addr_t size) {
+    std::stable_sort(marks.begin(), marks.end(), [](const std::pair<addr_t, uint32>& a, const std::pair<addr_t, uint32>& b) { return a.first < b.first; });
+    addr_t lastOffset = 0;
+    uint32 lastId = NO_SOURCE;
+    for (std::size_t i = 0; i < marks.size(); ++i) {
+      const addr_t offset = marks[i].first;
+      const uint32 id = marks[i].second;
+      if ((i + 1 < marks.size() && marks[i + 1].first == offset) || (count != 0 && id == lastId)) {
+        continue;
+      }
+      if (count % CHECKPOINT == 0) {
+        checkpoints.push_back(Checkpoint{offset, id, static_cast<uint32>(data.size())});
+      } else {
+        // 識別子の差分はジグザグ符号化して、絶対値の小さい差分を短くする
+        const uint32 diff = id - lastId;
+        putVarint(static_cast<uint32>(offset - lastOffset));
+        putVarint((diff << 1) ^ (0u - (diff >> 31)));
+      }
+      ++count;
+      lastOffset = offset;
+      lastId = id;
+    }
+    end = size;
+    std::vector<std::pair<addr_t, uint32>>().swap(marks);
+  }
+
+  /// offset の命令の識別子。無ければ NO_SOURCE
+  uint32 lookup(addr_t offset) const {
+    if (checkpoints.empty() || end <= offset || offset < checkpoints.front().offset) {
+      return NO_SOURCE;
+    }
+    const auto itr =
+        std::upper_bound(checkpoints.begin(), checkpoints.end(), offset, [](addr_t o, const Checkpoint& c) { return o < c.offset; }) - 1;
+    addr_t o = itr->offset;
+    uint32 id = itr->id;
+    std::size_t pos = itr->pos;
+    const std::size_t next = (itr + 1 != checkpoints.end()) ? (itr + 1)->pos : data.size();
+    while (pos < next) {
+      const addr_t delta = getVarint(pos);
+      const uint32 z = getVarint(pos);
+      if (offset < o + delta) {
+        break;
+      }
+      o += delta;
+      id += (z >> 1) ^ (0u - (z & 1));
+    }
+    return id;
+  }
+
+  /// 要素数
+  std::size_t size() const { return count; }
+  /// 使用メモリのバイト数
+  std::size_t bytes() const { return data.size() + checkpoints.size() * sizeof(Checkpoint); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// プロファイラとの連携
+//
+// 環境変数で有効にすると、generate() で生成した関数を Linux perf に通知する。
+// * XKON_PERF_MAP=1 : /tmp/perf-<pid>.map に関数のアドレス・サイズ・名前を追記する(perf report でシンボルを解決できる)
+// * XKON_JITDUMP=<dir> : <dir>/jit-<pid>.dump に jitdump 形式で関数の命令列と行番号情報を出力する(1 なら /tmp)
+//   行番号は同じディレクトリの xkon-<pid>.s に出力する逆アセンブルリストの行。
+//   perf record -k 1 で記録し、perf inject --jit で取り込む。
+
+#if XKON_PERF
+namespace perf {
+
+/// 通知する関数
+struct Function {
+  std::string name;
+  addr_t offset;     ///< 命令列の先頭からのオフセット
+  std::size_t size;
+};
+
+/// エクスポートした関数で命令列を区切る。先頭の関数より前の部分とエクスポートが無い場合は命令列のアドレスを名前にする
+inline std::vector<Function> functions(const char* code, std::size_t size, const std::vector<std::string>& exports,
+                                       const std::map<std::string, addr_t>& labels) {
+  std::map<addr_t, std::string> starts;
+  for (const auto& name : exports) {
+    const auto itr = labels.find(name);
+    if (itr != labels.end() && itr->second < size) {
+      starts[itr->second] = name;
+    }
+  }
+  if (starts.find(0) == starts.end()) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "xkon_%llx", static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(code)));
+    starts[0] = buf;
+  }
+  std::vector<Function> res;
+  for (auto itr = starts.begin(); itr != starts.end(); ++itr) {
+    const auto next = std::next(itr);
+    const addr_t end = (next != starts.end()) ? next->first : size;
+    res.push_back(Function{itr->second, itr->first, static_cast<std::size_t>(end - itr->first)});
+  }
+  return res;
+}
+
+/**
+ * perf-<pid>.map と jitdump の出力
+ * 複数のスレッドから使えるように、出力は排他制御する
+ */
+class Log {
+  Log(const Log&);
+  void operator=(const Log&);
+
+  // jitdump のレコードの種類
+  enum { JIT_CODE_LOAD = 0, JIT_CODE_MOVE = 1, JIT_CODE_DEBUG_INFO = 2 };
+
+  std::mutex mutex;
+  FILE* map;         ///< perf-<pid>.map
+  FILE* dump;        ///< jit-<pid>.dump
+  void* marker;      ///< perf に jitdump のファイルを知らせるための mmap
+  FILE* listing;     ///< 行番号情報の参照先の逆アセンブルリスト
+  std::string listingPath;
+  int listingLines;
+  uint64_t codeIndex;
+  std::map<uint64_t, uint64_t> indices;  ///< 通知した関数の先頭アドレスから JIT_CODE_LOAD の code_index
+
+  static uint64_t timestamp() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+  }
+  static uint32 tid() { return static_cast<uint32>(syscall(SYS_gettid)); }
+
+  template <typename T>
+  void put(T v) {
+    fwrite(&v, sizeof(v), 1, dump);
+  }
+  void header(uint32 id, std::size_t size) {
+    put<uint32>(id);
+    put<uint32>(static_cast<uint32>(4 + 4 + 8 + size));
+    put<uint64_t>(timestamp());
+  }
+
+  Log() : mutex(), map(nullptr), dump(nullptr), marker(nullptr), listing(nullptr), listingPath(), listingLines(0), codeIndex(0), indices() {
+    const char* env = getenv("XKON_PERF_MAP");
+    if (env != nullptr && strcmp(env, "0") != 0) {
+      map = fopen(("/tmp/perf-" + std::to_string(getpid()) + ".map").c_str(), "a");
+    }
+    env = getenv("XKON_JITDUMP");
+    if (env != nullptr && strcmp(env, "0") != 0) {
+      const std::string dir = (strcmp(env, "1") == 0) ? "/tmp" : env;
+      const std::string path = dir + "/jit-" + std::to_string(getpid()) + ".dump";
+      const int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+      if (0 <= fd) {
+        // perf はこのファイルの実行可能な mmap を記録して jitdump を見つける
+        marker = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+        dump = fdopen(fd, "wb");
+      }
+      listingPath = dir + "/xkon-" + std::to_string(getpid()) + ".s";
+      listing = (dump != nullptr) ? fopen(listingPath.c_str(), "w") : nullptr;
+      if (dump != nullptr) {
+        put<uint32>(0x4A695444);  // "JiTD"
+        put<uint32>(1);           // バージョン
+        put<uint32>(40);          // ヘッダのバイト数
+        put<uint32>(243);         // EM_RISCV
+        put<uint32>(0);
+        put<uint32>(static_cast<uint32>(getpid()));
+        put<uint64_t>(timestamp());
+        put<uint64_t>(0);
+        fflush(dump);
+      }
+    }
+  }
+
+  // 関数 f の逆アセンブルリストを出力して、命令ごとのアドレスと行番号を返す。sources があれば命令にソースの識別子を付記する
+  std::vector<std::pair<uint64_t, int>> writeListing(const char* code, const Function& f, int xlen, const SourceMap* sources) {
+    std::vector<std::pair<uint64_t, int>> lines;
+    if (listing == nullptr) {
+      return lines;
+    }
+    const Disassembler dis(xlen);
+    std::string text;
+    fprintf(listing, "%016llx <%s>:\n", static_cast<unsigned long long>(reinterpret_cast<uintptr_t>(code + f.offset)), f.name.c_str());
+    ++listingLines;
+    for (std::size_t i = 0; i < f.size;) {
+      const uint64_t addr = reinterpret_cast<uintptr_t>(code + f.offset + i);
+      const uint32 id = (sources != nullptr) ? sources->lookup(static_cast<addr_t>(f.offset + i)) : SourceMap::NO_SOURCE;
+      i += dis.disassemble(code + f.offset + i, f.size - i, f.offset + i, text);
+      if (id != SourceMap::NO_SOURCE) {
+        fprintf(listing, "%8llx:\t%s\t# source %u\n", static_cast<unsigned long long>(addr), text.c_str(), id);
+      } else {
+        fprintf(listing, "%8llx:\t%s\n", static_cast<unsigned long long>(addr), text.c_str());
+      }
+      lines.push_back(std::make_pair(addr, ++listingLines));
+    }
+    fflush(listing);
+    return lines;
+  }
+
+ public:
+  ~Log() {
+    if (map != nullptr) {
+      fclose(map);
+    }
+    if (listing != nullptr) {
+      fclose(listing);
+    }
+    if (dump != nullptr) {
+      fclose(dump);
+    }
+    if (marker != nullptr && marker != MAP_FAILED) {
+      munmap(marker, sysconf(_SC_PAGESIZE));
+    }
+  }
+
+  static Log& instance() {
+    static Log log;
+    return log;
+  }
+
+  bool enabled() const { return map != nullptr || dump != nullptr; }
+
+  /// code に配置した命令列の関数 funcs の通知。sources は命令列のソースの識別子(逆アセンブルリストに付記する)
+  void codeLoad(const char* code, const std::vector<Function>& funcs, int xlen, const SourceMap* sources = nullptr) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& f : funcs) {
+      const uint64_t addr = reinterpret_cast<uintptr_t>(code + f.offset);
+      if (map != nullptr) {
+        fprintf(map, "%llx %zx %s\n", static_cast<unsigned long long>(addr), f.size, f.name.c_str());
+        fflush(map);
+      }
+      if (dump != nullptr) {
+        const auto lines = writeListing(code, f, xlen, sources);
+        if (!lines.empty()) {
+          std::size_t size = 8 + 8;
+          for (std::size_t i = 0; i < lines.size(); ++i) {
+            size += 8 + 4 + 4 + listingPath.size() + 1;
+          }
+          header(JIT_CODE_DEBUG_INFO, size);
+          put<uint64_t>(addr);
+          put<uint64_t>(lines.size());
+          for (const auto& l : lines) {
+            put<uint64_t>(l.first);
+            put<int32>(l.second);
+            put<int32>(0);
+            fwrite(listingPath.c_str(), listingPath.size() + 1, 1, dump);
+          }
+        }
+        header(JIT_CODE_LOAD, 4 + 4 + 8 * 4 + f.name.size() + 1 + f.size);
+        put<uint32>(static_cast<uint32>(getpid()));
+        put<uint32>(tid());
+        put<uint64_t>(addr);  // vma
+        put<uint64_t>(addr);  // code_addr
+        put<uint64_t>(f.size);
+        put<uint64_t>(codeIndex);
+        indices[addr] = codeIndex++;
+        fwrite(f.name.c_str(), f.name.size() + 1, 1, dump);
+        fwrite(code + f.offset, f.size, 1, dump);
+        fflush(dump);
+      }
+    }
+  }
+
+  /// codeLoad() で通知した関数を from から to にコピーした場合の通知
+  /// code_index は移動元の JIT_CODE_LOAD と同じものを使う(通知していない関数なら新しく割り当てる)
+  void codeMove(const char* from, const char* to, const std::vector<Function>& funcs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& f : funcs) {
+      const uint64_t addr = reinterpret_cast<uintptr_t>(to + f.offset);
+      if (map != nullptr) {
+        fprintf(map, "%llx %zx %s\n", static_cast<unsigned long long>(addr), f.size, f.name.c_str());
+        fflush(map);
+      }
+      if (dump != nullptr) {
+        const uint64_t old = reinterpret_cast<uintptr_t>(from + f.offset);
+        const auto itr = indices.find(old);
+        const uint64_t index = (itr != indices.end()) ? itr->second : codeIndex++;
+        indices[addr] = index;
+        header(JIT_CODE_MOVE, 4 + 4 + 8 * 5);
+        put<uint32>(static_cast<uint32>(getpid()));
+        put<uint32>(tid());
+        put<uint64_t>(addr);
+        put<uint64_t>(old);
+        put<uint64_t>(addr);
+        put<uint64_t>(f.size);
+        put<uint64_t>(index);
+        fflush(dump);
+      }
+    }
+  }
+};
+
+}  // namespace perf
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // コード生成クラスの定義
 
@@ -722,11 +2030,127 @@ class Format {
   operator std::string() const { return str; }
 };  // namespace xkon
 
+/**
+ * 引数 Arg& を取る戻り値の無い関数オブジェクト(std::function<void(Arg&)> の代わり)
+ * N バイト以下の関数オブジェクトは内部のバッファに置き、ヒープを確保しない
+ */
+template <class Arg, std::size_t N>
+class InlineFunction {
+  struct Ops {
+    void (*call)(const void* f, Arg& a);
+    void (*move)(void* dst, void* src);  ///< src を dst に移して src を破棄する
+    void (*copy)(void* dst, const void* src);
+    void (*destroy)(void* f);
+  };
+
+  // Inline なら F をバッファに、そうでなければ new した F へのポインタをバッファに置く
+  template <class F, bool Inline = (sizeof(F) <= N && alignof(F) <= alignof(std::max_align_t))>
+  struct Impl {
+    static void construct(void* p, F&& f) { new (p) F(std::move(f)); }
+    static void construct(void* p, const F& f) { new (p) F(f); }
+    static void call(const void* f, Arg& a) { (*static_cast<const F*>(f))(a); }
+    static void move(void* dst, void* src) {
+      new (dst) F(std::move(*static_cast<F*>(src)));
+      static_cast<F*>(src)->~F();
+    }
+    static void copy(void* dst, const void* src) { new (dst) F(*static_cast<const F*>(src)); }
+    static void destroy(void* f) { static_cast<F*>(f)->~F(); }
+    static const Ops ops;
+  };
+  template <class F>
+  struct Impl<F, false> {
+    static void construct(void* p, F&& f) { *static_cast<F**>(p) = new F(std::move(f)); }
+    static void construct(void* p, const F& f) { *static_cast<F**>(p) = new F(f); }
+    static void call(const void* f, Arg& a) { (**static_cast<F* const*>(f))(a); }
+    static void move(void* dst, void* src) { *static_cast<F**>(dst) = *static_cast<F**>(src); }
+    static void copy(void* dst, const void* src) { *static_cast<F**>(dst) = new F(**static_cast<F* const*>(src)); }
+    static void destroy(void* f) { delete *static_cast<F**>(f); }
+    static const Ops ops;
+  };
+
+  typename std::aligned_storage<N, alignof(std::max_align_t)>::type buf;
+  const Ops* ops;
+
+  void clear() {
+    if (ops != nullptr) {
+      ops->destroy(&buf);
+      ops = nullptr;
+    }
+  }
+
+ public:
+  InlineFunction() : ops(nullptr) {}
+  InlineFunction(std::nullptr_t) : ops(nullptr) {}
+  template <class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InlineFunction>::value>::type>
+  InlineFunction(F&& f) : ops(&Impl<typename std::decay<F>::type>::ops) {
+    Impl<typename std::decay<F>::type>::construct(&buf, std::forward<F>(f));
+  }
+  InlineFunction(const InlineFunction& o) : ops(o.ops) {
+    if (ops != nullptr) {
+      ops->copy(&buf, &o.buf);
+    }
+  }
+  InlineFunction(InlineFunction&& o) : ops(o.ops) {
+    if (ops != nullptr) {
+      ops->move(&buf, &o.buf);
+      o.ops = nullptr;
+    }
+  }
+  ~InlineFunction() { clear(); }
+
+  InlineFunction& operator=(const InlineFunction& o) {
+    if (this != &o) {
+      InlineFunction tmp(o);
+      *this = std::move(tmp);
+    }
+    return *this;
+  }
+  InlineFunction& operator=(InlineFunction&& o) {
+    if (this != &o) {
+      clear();
+      ops = o.ops;
+      if (ops != nullptr) {
+        ops->move(&buf, &o.buf);
+        o.ops = nullptr;
+      }
+    }
+    return *this;
+  }
+  InlineFunction& operator=(std::nullptr_t) {
+    clear();
+    return *this;
+  }
+
+  void operator()(Arg& a) const { ops->call(&buf, a); }
+  explicit operator bool() const { return ops != nullptr; }
+};
+
+template <class Arg, std::size_t N>
+template <class F, bool Inline>
+const typename InlineFunction<Arg, N>::Ops InlineFunction<Arg, N>::Impl<F, Inline>::ops = {&call, &move, &copy, &destroy};
+template <class Arg, std::size_t N>
+template <class F>
+const typename InlineFunction<Arg, N>::Ops InlineFunction<Arg, N>::Impl<F, false>::ops = {&call, &move, &copy, &destroy};
+
 class Strage {
   inline Strage(const Strage&) = delete;
 
-  typedef std::function<void(Strage&)> InsnGen_t;
+ public:
+  /// 命令生成関数。レジスタと即値をキャプチャする命令生成のラムダ式はヒープを使わずに保持するので、
+  /// reset() で再利用するリストの要素と合わせて、reset() 後のそれらの命令の追加ではメモリーを確保しない
+  /// (ラベル名をキャプチャする分岐命令などは 48 バイトに収まらないのでヒープを確保する)
+  typedef InlineFunction<Strage, 48> InsnGen_t;
+
+  /// analyze() で収集する命令生成関数1つ分の情報
+  struct Record {
+    std::list<InsnGen_t>::iterator itr;  ///< 命令生成関数
+    addr_t addr;                         ///< 先頭アドレス(確保したメモリー領域の先頭からのオフセット)
+    std::vector<uint32> code;            ///< 生成した命令
+    std::vector<std::string> labels;     ///< 定義したラベル
+    std::vector<std::string> refs;       ///< 参照したラベル
+  };
 
+ private:
   Allocator mem;
 
   // ラベル管理
@@ -736,23 +2160,375 @@ class Strage {
   addr_t p;                    ///< メモリーの書込み位置インデックス
   addr_t pc;                   ///< 現在の処理中の命令の先頭アドレス
   std::list<InsnGen_t> insns;  ///< 命令生成関数のリスト
+  std::list<InsnGen_t> spare;  ///< reset() で空にした命令生成関数のリストの要素(再利用する)
   bool inGenerate;             ///< false:insnsへの命令生成lambda式追加とラベルのアドレス決定モード true:命令生成モード
   unsigned int lastInsn;       ///< 最後に生成した命令のopコード
 
+  std::list<InsnGen_t>* capture;               ///< nullptr以外の場合、追加された命令生成関数を実行せずにこのリストに格納する
+  std::list<std::function<void()>> finalizers;  ///< generate() の開始時に一度だけ呼び出す関数のリスト
+  uint32 defs;                                  ///< 命令の追加時に書き込まれた整数レジスタのビットマップ
+  Record* record;                               ///< nullptr以外の場合、analyze() の情報の収集先
+  std::map<std::string, uint64_t> counts;       ///< ラベルから始まるブロックの実行回数(プロファイル結果やヒント)
+  unsigned int labelSeq;                        ///< newLabel() で生成したラベルの数
+  std::vector<std::string> exports;             ///< エクスポートした関数の先頭のラベル
+  bool relax;                                   ///< generate() の開始時にラベルのアドレスの再計算が必要
+
+  // リロケーション
+  RelocMode relocMode;                ///< 外部シンボルの参照方法
+  SymbolTable symbols;                ///< 定義済みの外部シンボル
+  std::vector<Relocation> relocs;     ///< generate() で生成したリロケーション情報
+  std::set<std::string> gotSlots;     ///< GOT のスロットのラベル
+
+  SourceMap sourceMap;  ///< generate() で生成した命令のソースの識別子
+
+  // エンコードの並列化
+  // 命令生成関数 ENCODE_CHUNK 個ごとに先頭の位置を記録しておき、generate() で区間ごとに別のスレッドでエンコードする
+  static const std::size_t ENCODE_CHUNK = 1024;
+  typedef std::pair<std::list<InsnGen_t>::iterator, addr_t> Chunk;
+  std::vector<Chunk> chunks;  ///< 区間の先頭の命令生成関数とアドレス
+  bool chunksValid;           ///< chunks のアドレスが最後のラベルのアドレス決定と一致している
+  int encodeThreads;          ///< エンコードのスレッド数(既定は 1、0 ならハードウェアのスレッド数)
+  const Strage* owner;        ///< 区間のエンコード用の Strage の場合は命令列全体の Strage
+
   FILE* fp;  // DEBUG
 
+  // 区間のエンコード用。owner のメモリー領域の start から書き込み、ラベルは owner のものを参照する
+  Strage(const Strage& owner, addr_t start)
+      : mem(), labelMap(), p(start), pc(start), insns(), spare(), inGenerate(true), lastInsn(), capture(nullptr), finalizers(), defs(0), record(nullptr), counts(), labelSeq(0), exports(), relax(false), relocMode(owner.relocMode), symbols(), relocs(), gotSlots(), sourceMap(), chunks(), chunksValid(false), encodeThreads(1), owner(&owner), fp(nullptr) {
+    mem.allocate(owner.mem.getSize(), owner.mem.getMemory());
+  }
+
+  // このスレッドでエンコード中の区間の Strage
+  static const Strage*& encoder() {
+    static thread_local const Strage* s = nullptr;
+    return s;
+  }
+
+  const std::map<std::string, addr_t>& labels() const { return (owner != nullptr) ? owner->labelMap : labelMap; }
+
  public:
-  Strage(std::size_t size) : mem(), labelMap(), p(0), pc(0), insns(), inGenerate(false), lastInsn(), fp(nullptr) { mem.allocate(size, nullptr); }
+  Strage(std::size_t size) : mem(), labelMap(), p(0), pc(0), insns(), spare(), inGenerate(false), lastInsn(), capture(nullptr), finalizers(), defs(0), record(nullptr), counts(), labelSeq(0), exports(), relax(false), relocMode(RelocAbsolute), symbols(), relocs(), gotSlots(), sourceMap(), chunks(), chunksValid(true), encodeThreads(1), owner(nullptr), fp(nullptr) { mem.allocate(size, nullptr); }
+
+  /// ラベルのアドレスを求める Strage(このスレッドで区間をエンコード中ならその Strage)
+  const Strage* current() const {
+    const Strage* s = encoder();
+    return (s != nullptr && s->owner == this) ? s : this;
+  }
 
   void operator<<(InsnGen_t ig) {
+    if (capture != nullptr) {
+      capture->push_back(ig);
+      return;
+    }
+    const addr_t start = p;
     ig(*this);
     pc = p;
-    insns.push_back(ig);
+    if (spare.empty()) {
+      insns.push_back(std::move(ig));
+    } else {
+      insns.splice(insns.end(), spare, spare.begin());
+      insns.back() = std::move(ig);
+    }
+    if ((insns.size() - 1) % ENCODE_CHUNK == 0) {
+      chunks.push_back(Chunk(std::prev(insns.end()), start));
+    }
   }
 
+  // 生成した命令・ラベル・書込み位置を破棄して、新しい命令列を追加できる状態に戻す
+  // メモリー領域と命令生成関数のリストの要素は解放せずに再利用する
+  // 以前に generate() で得た関数は、次の generate() で上書きされる
+  void reset() {
+    XKON_ASSERT(capture == nullptr && record == nullptr);
+    for (auto& e : insns) {
+      e = nullptr;  // lambda式がキャプチャした値を解放する
+    }
+    spare.splice(spare.end(), insns);
+    labelMap.clear();
+    finalizers.clear();
+    counts.clear();
+    p = 0;
+    pc = 0;
+    inGenerate = false;
+    lastInsn = 0;
+    defs = 0;
+    labelSeq = 0;
+    exports.clear();
+    relax = false;
+    relocs.clear();
+    gotSlots.clear();
+    sourceMap.clear();
+    chunks.clear();
+    chunksValid = true;
+  }
+
+  // 命令生成関数の一時的な格納先の切替え
+  // 命令列の内容が後から決まる箇所(プロローグ等)の命令を、既存の命令生成関数を使って組み立てるために使う
+  void beginCapture(std::list<InsnGen_t>* dst) {
+    XKON_ASSERT(capture == nullptr);
+    capture = dst;
+  }
+  void endCapture() { capture = nullptr; }
+
+  // 複数の命令生成関数を1つの命令生成関数としてまとめる
+  // 中身は generate() までに確定していればよい
+  static InsnGen_t group(std::shared_ptr<std::list<InsnGen_t>> body) {
+    return [=](Strage& s) {
+      for (auto& e : *body) {
+        e(s);
+        s.updatePC();
+      }
+    };
+  }
+
+  // generate() の開始時に呼び出す関数の登録
+  // 登録された関数がある場合、呼び出し後にラベルのアドレスを再計算する
+  void addFinalizer(std::function<void()> f) { finalizers.push_back(f); }
+
+  // 命令の追加時に書き込まれた整数レジスタのビットマップ
+  uint32 getDefs() const { return defs; }
+  void clearDefs() { defs = 0; }
+
+  // ラベルのアドレスの再計算
+  // 命令の追加後に命令列のサイズが変化した場合に使う。
+  // 前方のラベルは前回の計算結果のアドレスを使って命令を選択するので、ラベルのアドレスが変化しなくなるまで繰り返す。
+  void layout() {
+    const int MAX_PASS = 8;
+    for (int i = 0; i < MAX_PASS; ++i) {
+      const std::map<std::string, addr_t> prev = labelMap;
+      p = 0;
+      pc = 0;
+      chunks.clear();
+      std::size_t n = 0;
+      for (auto itr = insns.begin(); itr != insns.end(); ++itr, ++n) {
+        if (n % ENCODE_CHUNK == 0) {
+          chunks.push_back(Chunk(itr, p));
+        }
+        (*itr)(*this);
+        pc = p;
+      }
+      chunksValid = true;
+      if (prev == labelMap) {
+        return;
+      }
+    }
+    XKON_ASSERT(!"Label addresses do not converge.");
+  }
+
+  // 登録された generate() 開始時の関数の呼び出しと、ラベルのアドレスの再計算
+  void finalize() {
+    if (!finalizers.empty() || relax) {
+      for (auto& f : finalizers) {
+        f();
+      }
+      finalizers.clear();
+      relax = false;
+      layout();
+    }
+  }
+
+  // 前方のラベルを参照していて、命令の選択がラベルのアドレスに依存する命令を追加したことの通知
+  // generate() の開始時にラベルのアドレスを再計算して、命令を選び直す
+  void requestLayout() { relax = true; }
+
+  // 命令生成関数ごとの生成命令・ラベルの定義と参照の収集
+  // 命令列を確定させた上で、ラベルのアドレス決定と同じ処理をもう一度行って収集する
+  std::vector<Record> analyze() {
+    finalize();
+    std::vector<Record> res;
+    p = 0;
+    pc = 0;
+    for (auto itr = insns.begin(); itr != insns.end(); ++itr) {
+      res.push_back(Record{itr, p, {}, {}, {}});
+      record = &res.back();
+      (*itr)(*this);
+      record = nullptr;
+      pc = p;
+    }
+    return res;
+  }
+
+  // 命令生成関数の削除
+  // analyze() の結果を使って削除した後、ラベルのアドレスを再計算する
+  void erase(const std::vector<std::list<InsnGen_t>::iterator>& itrs) {
+    for (auto itr : itrs) {
+      insns.erase(itr);
+    }
+    layout();
+  }
+
+  // 命令生成関数の挿入と移動
+  // analyze() の結果を使って命令列を組み替える。組み替えた後は layout() を呼ぶこと
+  std::list<InsnGen_t>::iterator insert(std::list<InsnGen_t>::iterator pos, InsnGen_t ig) {
+    chunksValid = false;
+    return insns.insert(pos, ig);
+  }
+  void moveToEnd(std::list<InsnGen_t>::iterator first, std::list<InsnGen_t>::iterator last) {
+    chunksValid = false;
+    insns.splice(insns.end(), insns, first, last);
+  }
+
+  // ブロックの実行回数
+  void setCount(const char* label, uint64_t n) { counts[std::string(label)] = n; }
+  const std::map<std::string, uint64_t>& getCounts() const { return counts; }
+
+  // 他と重複しないラベル名の生成
+  std::string newLabel(const char* prefix) { return std::string(prefix) + std::to_string(labelSeq++); }
+
+  // 関数のエクスポート
+  // 関数の先頭のラベルを登録して、登録順の番号(ハンドル)を返す
+  std::size_t exportLabel(const char* label) {
+    exports.push_back(label);
+    return exports.size() - 1;
+  }
+  const std::vector<std::string>& getExports() const { return exports; }
+
+  // リロケーション
+  void setRelocMode(RelocMode mode) { relocMode = mode; }
+  RelocMode getRelocMode() const { return relocMode; }
+  void defineSymbol(const std::string& name, addr_t addr) { symbols[name] = addr; }
+  const SymbolTable& getSymbols() const { return symbols; }
+  const std::vector<Relocation>& getRelocations() const { return relocs; }
+
+  // 現在の書込み位置の命令に対するリロケーション情報の追加(命令の出力前に呼ぶこと)
+  void addRelocation(RelocType type, const std::string& symbol, addrdiff_t addend) {
+    if (inGenerate) {
+      relocs.push_back(Relocation{type, p, symbol, addend});
+    }
+  }
+
+  // 現在の書込み位置以降に生成する命令のソースの識別子の設定
+  void markSource(uint32 id) {
+    if (inGenerate) {
+      sourceMap.add(p, id);
+    }
+  }
+  const SourceMap& getSourceMap() const { return sourceMap; }
+
+  // symbol + addend の GOT のスロットのラベル
+  // 初めて使うスロットは generate() の開始時に命令列の末尾に追加する
+  std::string gotSlot(const std::string& symbol, addrdiff_t addend, int bytes) {
+    const std::string label = ".got." + symbol + (addend != 0 ? "+" + std::to_string(addend) : "");
+    if (gotSlots.insert(label).second) {
+      addFinalizer([=]() {
+        (*this) << [=](Strage& s) {
+          while (s.p % bytes != 0) {
+            s.hword(0);
+          }
+          // ラベルは pc の位置に付くので、詰め物の後に進めておく
+          s.updatePC();
+          s.markSource(SourceMap::NO_SOURCE);
+          s.addLabel(label.c_str());
+          s.addRelocation(RelocGotSlot, symbol, addend);
+          for (int i = 0; i < bytes; i += 4) {
+            s.word(0);
+          }
+        };
+      });
+    }
+    return label;
+  }
+
+  /// generate() で並列にエンコードする命令列の最小のバイト数
+  static const std::size_t PARALLEL_MIN_SIZE = 256 * 1024;
+
+  /// generate() のエンコードのスレッド数(既定は 1 で並列化しない、0 ならハードウェアのスレッド数)
+  void setEncodeThreads(int n) { encodeThreads = n; }
+
+ private:
+  /**
+   * 命令列を区間に分けて、先頭のアドレスを決めた状態で区間ごとに別のスレッドでエンコードする
+   * ラベルのアドレスは確定しているので、各命令の出力は区間の先頭のアドレスだけで決まり、逐次の場合と同じになる。
+   * 並列化しない(命令列が小さい・区間のアドレスが不明)場合と、区間の末尾が次の区間の先頭と一致しない場合は false を返す
+   * (書込み位置は初期状態に戻すので、逐次でエンコードし直す)
+   */
+  bool encodeParallel(addr_t size) {
+#if XKON_PARALLEL && !XKON_DESC
+    int threads = (encodeThreads != 0) ? encodeThreads : static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::min(threads, static_cast<int>(chunks.size()));
+    if (threads <= 1 || size < PARALLEL_MIN_SIZE || !chunksValid || capture != nullptr || record != nullptr) {
+      return false;
+    }
+
+    // サイズが均等になるように区間の境界を選ぶ
+    std::vector<Chunk> ranges(1, chunks.front());
+    for (int i = 1; i < threads; ++i) {
+      const addr_t target = size * i / threads;
+      const auto itr = std::lower_bound(chunks.begin(), chunks.end(), target, [](const Chunk& c, addr_t a) { return c.second < a; });
+      if (itr != chunks.end() && ranges.back().second < itr->second) {
+        ranges.push_back(*itr);
+      }
+    }
+    if (ranges.size() < 2) {
+      return false;
+    }
+
+    std::vector<std::unique_ptr<Strage>> parts;
+    std::vector<std::exception_ptr> errors(ranges.size());
+    const auto encode = [&](std::size_t i, Strage& s) {
+      const auto last = (i + 1 < ranges.size()) ? ranges[i + 1].first : insns.end();
+      try {
+        for (auto itr = ranges[i].first; itr != last; ++itr) {
+          (*itr)(s);
+          s.pc = s.p;
+        }
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    };
+    for (std::size_t i = 1; i < ranges.size(); ++i) {
+      parts.emplace_back(new Strage(*this, ranges[i].second));
+    }
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < ranges.size(); ++i) {
+      workers.emplace_back([&, i]() {
+        Strage& s = *parts[i - 1];
+        encoder() = &s;
+        encode(i, s);
+        encoder() = nullptr;
+      });
+    }
+    encode(0, *this);
+    for (auto& t : workers) {
+      t.join();
+    }
+    for (const auto& e : errors) {
+      if (e) {
+        std::rethrow_exception(e);
+      }
+    }
+
+    // 区間の末尾と次の区間の先頭が一致することを確かめてから、区間の結果をつなげる
+    bool ok = (p == ranges[1].second);
+    for (std::size_t i = 1; ok && i + 1 < ranges.size(); ++i) {
+      ok = (parts[i - 1]->p == ranges[i + 1].second);
+    }
+    if (!ok) {
+      p = 0;
+      pc = 0;
+      relocs.clear();
+      sourceMap.clear();
+      return false;
+    }
+    for (auto& part : parts) {
+      relocs.insert(relocs.end(), part->relocs.begin(), part->relocs.end());
+      sourceMap.append(part->sourceMap);
+    }
+    p = parts.back()->p;
+    pc = p;
+    lastInsn = parts.back()->lastInsn;
+    return true;
+#else
+    (void)size;
+    return false;
+#endif
+  }
+
+ public:
   // コード生成
   char* generate() {
-    // DEBUG
+    finalize();
+
+#if XKON_DESC
     fp = fopen("out.s", "w");
     fprintf(fp, "%s",
             "\t.file   \"out.s\"\n"
@@ -762,37 +2538,45 @@ class Strage {
             "\t.globl  f\n"
             "\t.type   f, @function\n"
             "f:\n");
+#endif
 
     // 変数の初期化
+    const addr_t size = p;  // ラベルのアドレス決定で求めた命令列のサイズ
     p = 0;
     pc = 0;
+    relocs.clear();
+    sourceMap.clear();
     inGenerate = true;
     int count = 0;  ///< デバッグメッセージ用の文字列出力タイミング制御カウンタ
 
     // 命令生成メインループ
-    for (auto e : insns) {
-      // デバッグメッセージ用の文字列出力
-      if (count++ == 0) {
-#if DEBUG
-        printf("%s", "Address OPcode  ------- Instruction --------------------------------------------\n");
+    // 大きな命令列は区間ごとに複数のスレッドでエンコードする
+    if (!encodeParallel(size)) {
+      for (auto& e : insns) {
+        // デバッグメッセージ用の文字列出力
+        if (count++ == 0) {
+#if DEBUG && XKON_DESC
+          printf("%s", "Address OPcode  ------- Instruction --------------------------------------------\n");
 #endif
-      } else if (16 <= count) {
-        count = 0;
-      }
+        } else if (16 <= count) {
+          count = 0;
+        }
 
-      // 命令生成用のlambda式の実行
-      e(*this);
+        // 命令生成用のlambda式の実行
+        e(*this);
 
-      // PCを更新
-      pc = p;
+        // PCを更新
+        pc = p;
+      }
     }
     inGenerate = false;
+    sourceMap.finish(p);
 
 #if DEBUG
     printf("%llu bytes generated.\n", p);
 #endif
 
-    // DEBUG
+#if XKON_DESC
     fprintf(fp, "%s",
             ""  //
                 // "\tnop\n"
@@ -807,6 +2591,8 @@ class Strage {
                 //
     );
     fclose(fp);
+    fp = nullptr;
+#endif
     return mem.getMemory();
   }
 
@@ -820,6 +2606,10 @@ class Strage {
       pMem[p++] = ui16 & 0xff;
       pMem[p++] = (ui16 >> 8) & 0xff;
     } else {
+      defs |= insnIntDefs(ui16);
+      if (record != nullptr) {
+        record->code.push_back(ui16);
+      }
       p += 2;
     }
   }
@@ -834,6 +2624,10 @@ class Strage {
       pMem[p++] = (ui32 >> 16) & 0xff;
       pMem[p++] = (ui32 >> 24) & 0xff;
     } else {
+      defs |= insnIntDefs(ui32);
+      if (record != nullptr) {
+        record->code.push_back(ui32);
+      }
       p += 4;
     }
   }
@@ -842,6 +2636,7 @@ class Strage {
 
   Format format(const char* format) const { return Format(format); }
 
+#if XKON_DESC
   typedef std::function<const Format(void)> lazy_expr_t;
   // ニーモニック出力を無効に出来るようにした際に余計な処理を実行しないようにするためラムダ式を使った遅延評価を行う構造にした
   void desc(lazy_expr_t fs) {
@@ -867,6 +2662,10 @@ class Strage {
       }
     }
   }
+#else
+  // XKON_LAZY() は nullptr になるので何もしない
+  void desc(std::nullptr_t) {}
+#endif
 
   // 1つの命令の処理中で複数の命令を出力する場合に、PCを強制的に更新するために使う
   void updatePC() { pc = p; }
@@ -874,7 +2673,7 @@ class Strage {
   // ラベル管理
   void addLabel(const char* label) {
     if (inGenerate) {
-#if DEBUG
+#if DEBUG && XKON_DESC
       printf("\x1b[36m%08llx <%s>\x1b[0m:\n", labelMap[std::string(label)], label);
 #endif
       if (fp != nullptr) {  // DEBUG
@@ -885,71 +2684,438 @@ class Strage {
       printf("+0x%llx = <%s>\n", pc, label);
 #endif
       labelMap[std::string(label)] = pc;
+      if (record != nullptr) {
+        record->labels.push_back(label);
+      }
+    }
+  }
+
+  addrdiff_t getLabelOffset(const char* label) const {
+    if (record != nullptr) {
+      record->refs.push_back(label);
+    }
+    const auto itr = labels().find(std::string(label));
+    if (itr == labels().end()) {
+      if (inGenerate) {
+        throw UnsupportedException("Unknown label.");
+      } else {
+        return 0;
+      }
+    } else {
+      if (itr->second > pc) {
+        return itr->second - pc;
+      } else {
+        return -(pc - itr->second);
+      }
+    }
+  }
+
+  addr_t getLabelValue(const char* label) const {
+    if (record != nullptr) {
+      record->refs.push_back(label);
+    }
+    const auto itr = labels().find(std::string(label));
+    if (itr == labels().end()) {
+      if (inGenerate) {
+        throw UnsupportedException("Unknown label.");
+      } else {
+        return 0;
+      }
+    } else {
+      return itr->second;
+    }
+  }
+  addrdiff_t getLabelOffset(const std::string& label) const { return getLabelOffset(label.c_str()); }
+  addr_t getLabelValue(const std::string& label) const { return getLabelValue(label.c_str()); }
+  addr_t getPC() const { return pc + (intptr_t)mem.getMemory(); }
+
+  /// 生成済みの命令列のバイト数
+  std::size_t getCodeSize() const { return p; }
+  /// 命令列の先頭
+  const char* getCode() const { return mem.getMemory(); }
+  /// ラベル名からオフセット
+  const std::map<std::string, addr_t>& getLabels() const { return labelMap; }
+};
+
+addrdiff_t Label::relAddr() const {
+  const Strage* s = pS->current();
+  if (name.empty()) {
+    if (address > s->getPC()) {
+      return address - s->getPC();
+    } else {
+      return -(s->getPC() - address);
+    }
+  } else {
+    return s->getLabelOffset(name);
+  }
+}
+
+addr_t Label::absAddr() const {
+  const Strage* s = pS->current();
+  if (name.empty()) {
+    return address;
+  } else {
+    return s->getLabelOffset(name) + s->getPC();
+  }
+}
+
+addr_t Label::value() const { return pS->current()->getLabelValue(name); }
+
+/*******************************************************************************
+ * 制御フローグラフ
+ ******************************************************************************/
+
+/**
+ * 記録済みの命令列の制御フローグラフと整数レジスタの生存解析
+ *
+ * Strage::analyze() の結果から命令を解読して基本ブロックと分岐先を求める。
+ * 関数呼出し(rd が x0 以外の jal/jalr)は次の命令に戻ってくるものとし、
+ * 呼出し規約に従って a0-a7 を読み出し、caller-saved なレジスタを書き込むものとみなす。
+ * 関数の出口では戻り値(a0,a1)と sp,gp,tp,s0-s11 が生存しているものとみなす。
+ */
+class Cfg {
+ public:
+  /// 命令
+  struct Insn {
+    addr_t addr;         ///< アドレス(確保したメモリー領域の先頭からのオフセット)
+    uint32 code;         ///< 命令コード
+    std::size_t record;  ///< 命令を生成した命令生成関数の番号
+    uint32 defs;         ///< 書き込む整数レジスタ(関数呼出しの場合は呼出し規約による書込みを含む)
+    uint32 uses;         ///< 読み出す整数レジスタ(関数呼出しの場合は呼出し規約による読出しを含む)
+    InsnFlow flow;       ///< 制御の流れの種類
+    addrdiff_t offset;   ///< 分岐先の相対アドレス
+
+    addr_t size() const { return ((code & 3) == 3) ? 4 : 2; }
+  };
+
+  /// 基本ブロック
+  struct Block {
+    addr_t begin;                     ///< 先頭アドレス
+    addr_t end;                       ///< 最後の命令の次のアドレス
+    std::size_t first;                ///< 先頭の命令の番号
+    std::size_t last;                 ///< 最後の命令の次の番号
+    std::vector<std::string> labels;  ///< 先頭に定義されたラベル
+    std::vector<int> succs;           ///< 後続ブロック
+    std::vector<int> preds;           ///< 先行ブロック
+    bool exit;                        ///< 関数の出口(後続ブロックに加えて関数の外へ抜ける経路がある)
+    bool reachable;                   ///< 入口から到達可能
+    uint32 liveIn;                    ///< 入口で生存している整数レジスタ
+    uint32 liveOut;                   ///< 出口で生存している整数レジスタ
+  };
+
+  static constexpr uint32 CALL_USES = 0xffu << 10;                                               ///< a0-a7
+  static constexpr uint32 CALL_DEFS = (1u << 1) | (7u << 5) | (0xffu << 10) | (0xfu << 28);      ///< ra,t0-t6,a0-a7
+  static constexpr uint32 EXIT_LIVE = (3u << 10) | (7u << 2) | (3u << 8) | (0x3ffu << 18);       ///< a0,a1,sp,gp,tp,s0-s11
+  static constexpr uint32 ALL_REGS = ~1u;
+
+ private:
+  std::vector<Strage::Record> records;
+  std::vector<Insn> insns;
+  std::vector<Block> blocks;
+  std::vector<std::string> roots;  ///< エクスポートした関数の先頭のラベル
+  bool indirect;  ///< 分岐先がレジスタで決まる分岐を含む
+
+  /// アドレス addr から始まるブロックの番号(無ければ -1)
+  /// blocks は先頭アドレスの順に並んでいるので二分探索する
+  int blockAt(addr_t addr) const {
+    const auto itr = std::lower_bound(blocks.begin(), blocks.end(), addr, [](const Block& b, addr_t a) { return b.begin < a; });
+    return (itr != blocks.end() && itr->begin == addr) ? static_cast<int>(itr - blocks.begin()) : -1;
+  }
+
+  /// 命令 insn の分岐先アドレス(メモリー領域の外なら -1)
+  addrdiff_t target(const Insn& insn) const {
+    const addrdiff_t dst = static_cast<addrdiff_t>(insn.addr) + insn.offset;
+    const addrdiff_t end = insns.empty() ? 0 : static_cast<addrdiff_t>(insns.back().addr + insns.back().size());
+    return (0 <= dst && dst < end) ? dst : -1;
+  }
+
+  void buildInsns() {
+    for (std::size_t i = 0; i < records.size(); ++i) {
+      addr_t addr = records[i].addr;
+      for (uint32 code : records[i].code) {
+        Insn insn = {addr, code, i, insnIntDefs(code), insnIntUses(code), FlowNext, 0};
+        insn.flow = insnFlow(code, insn.offset);
+        if (insn.flow == FlowCall || insn.flow == FlowIndirectCall) {
+          insn.defs |= CALL_DEFS;
+          insn.uses |= CALL_USES;
+        }
+        insns.push_back(insn);
+        addr += insn.size();
+      }
+    }
+  }
+
+  void buildBlocks() {
+    // ブロックの先頭アドレスの収集
+    std::set<addr_t> leaders;
+    std::map<addr_t, std::vector<std::string>> labels;
+    for (const auto& r : records) {
+      if (!r.labels.empty()) {
+        leaders.insert(r.addr);
+        labels[r.addr].insert(labels[r.addr].end(), r.labels.begin(), r.labels.end());
+      }
+    }
+    for (const auto& insn : insns) {
+      if (insn.flow == FlowBranch || insn.flow == FlowJump || insn.flow == FlowCall) {
+        if (target(insn) >= 0) {
+          leaders.insert(target(insn));
+        }
+      }
+      if (insn.flow == FlowBranch || insn.flow == FlowJump || insn.flow == FlowIndirectJump || insn.flow == FlowReturn) {
+        leaders.insert(insn.addr + insn.size());
+      }
+      indirect |= insn.flow == FlowIndirectJump;
+    }
+
+    // 命令列をブロックに分割
+    for (std::size_t i = 0; i < insns.size(); ++i) {
+      if (blocks.empty() || leaders.count(insns[i].addr) != 0) {
+        blocks.push_back(Block{insns[i].addr, insns[i].addr, i, i, labels[insns[i].addr], {}, {}, false, false, 0, 0});
+      }
+      blocks.back().end = insns[i].addr + insns[i].size();
+      blocks.back().last = i + 1;
+    }
+
+    // 後続ブロックの決定
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+      Block& b = blocks[i];
+      const Insn& last = insns[b.last - 1];
+      const int next = (i + 1 < blocks.size()) ? static_cast<int>(i + 1) : -1;
+      const auto link = [&](int dst) {
+        if (dst < 0) {
+          b.exit = true;
+        } else if (std::find(b.succs.begin(), b.succs.end(), dst) == b.succs.end()) {
+          b.succs.push_back(dst);
+          blocks[dst].preds.push_back(static_cast<int>(i));
+        }
+      };
+      switch (last.flow) {
+        case FlowBranch:
+          link((target(last) >= 0) ? blockAt(target(last)) : -1);
+          link(next);
+          break;
+        case FlowJump:
+          link((target(last) >= 0) ? blockAt(target(last)) : -1);
+          break;
+        case FlowIndirectJump:
+        case FlowReturn:
+          b.exit = true;
+          break;
+        default:
+          link(next);
+          break;
+      }
+    }
+  }
+
+  void markReachable() {
+    if (blocks.empty()) {
+      return;
+    }
+
+    // 入口・エクスポートした関数・関数呼出し先・分岐以外の命令で参照されるラベルを起点とする
+    std::vector<int> work;
+    work.push_back(0);
+    for (const auto& insn : insns) {
+      if (insn.flow == FlowCall && target(insn) >= 0) {
+        work.push_back(blockAt(target(insn)));
+      }
+    }
+    std::map<std::string, addr_t> labelAddr;
+    for (const auto& r : records) {
+      for (const auto& l : r.labels) {
+        labelAddr[l] = r.addr;
+      }
+    }
+    for (const auto& l : roots) {
+      const auto itr = labelAddr.find(l);
+      if (itr != labelAddr.end()) {
+        work.push_back(blockAt(itr->second));
+      }
+    }
+    for (std::size_t i = 0; i < records.size(); ++i) {
+      bool isBranch = false;
+      for (uint32 code : records[i].code) {
+        addrdiff_t offset;
+        const InsnFlow flow = insnFlow(code, offset);
+        isBranch |= flow == FlowBranch || flow == FlowJump || flow == FlowCall;
+      }
+      for (const auto& l : records[i].refs) {
+        const auto itr = labelAddr.find(l);
+        if ((indirect || !isBranch) && itr != labelAddr.end()) {
+          work.push_back(blockAt(itr->second));
+        }
+      }
+    }
+
+    while (!work.empty()) {
+      const int b = work.back();
+      work.pop_back();
+      if (b < 0 || blocks[b].reachable) {
+        continue;
+      }
+      blocks[b].reachable = true;
+      work.insert(work.end(), blocks[b].succs.begin(), blocks[b].succs.end());
     }
   }
 
-  addrdiff_t getLabelOffset(const char* label) const {
-    const auto itr = labelMap.find(std::string(label));
-    if (itr == labelMap.end()) {
-      if (inGenerate) {
-        throw UnsupportedException("Unknown label.");
-      } else {
-        return 0;
+  /// 出口で生存しているレジスタの初期値
+  uint32 exitLive(const Block& b) const {
+    if (!b.exit) {
+      return 0;
+    }
+    return (insns[b.last - 1].flow == FlowIndirectJump) ? ALL_REGS : EXIT_LIVE;
+  }
+
+  void computeLiveness() {
+    // ブロックごとの読出し(書込み前)と書込み
+    std::vector<uint32> gen(blocks.size(), 0);
+    std::vector<uint32> kill(blocks.size(), 0);
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+      for (std::size_t j = blocks[i].first; j < blocks[i].last; ++j) {
+        gen[i] |= insns[j].uses & ~kill[i];
+        kill[i] |= insns[j].defs;
       }
-    } else {
-      if (itr->second > pc) {
-        return itr->second - pc;
-      } else {
-        return -(pc - itr->second);
+    }
+
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (std::size_t i = blocks.size(); i-- > 0;) {
+        Block& b = blocks[i];
+        uint32 out = exitLive(b);
+        for (int s : b.succs) {
+          out |= blocks[s].liveIn;
+        }
+        const uint32 in = gen[i] | (out & ~kill[i]);
+        changed |= in != b.liveIn || out != b.liveOut;
+        b.liveIn = in;
+        b.liveOut = out;
       }
     }
   }
 
-  addr_t getLabelValue(const char* label) const {
-    const auto itr = labelMap.find(std::string(label));
-    if (itr == labelMap.end()) {
-      if (inGenerate) {
-        throw UnsupportedException("Unknown label.");
-      } else {
-        return 0;
+ public:
+  explicit Cfg(const std::vector<Strage::Record>& records, const std::vector<std::string>& roots = std::vector<std::string>())
+      : records(records), insns(), blocks(), roots(roots), indirect(false) {
+    buildInsns();
+    buildBlocks();
+    markReachable();
+    computeLiveness();
+  }
+
+  const std::vector<Strage::Record>& getRecords() const { return records; }
+  const std::vector<Insn>& getInsns() const { return insns; }
+  const std::vector<Block>& getBlocks() const { return blocks; }
+
+  /// 到達可能なブロックにある、結果が使われない書込みを行う命令の番号
+  /// 関数呼出し・メモリーへの書込み・CSR操作など副作用のある命令は含まない
+  std::vector<std::size_t> deadWrites() const {
+    std::vector<std::size_t> res;
+    for (const auto& b : blocks) {
+      if (!b.reachable) {
+        continue;
+      }
+      uint32 live = b.liveOut;
+      for (std::size_t j = b.last; j-- > b.first;) {
+        const Insn& insn = insns[j];
+        const bool pure = insn.flow == FlowNext && (insn.code & 0x7f) != 0x73 && (insn.code & 0x7f) != 0x2f;
+        if (pure && insn.defs != 0 && (insn.defs & live) == 0) {
+          res.push_back(j);
+        }
+        live = (live & ~insn.defs) | insn.uses;
       }
-    } else {
-      return itr->second;
     }
+    std::sort(res.begin(), res.end());
+    return res;
   }
-  addrdiff_t getLabelOffset(const std::string& label) const { return getLabelOffset(label.c_str()); }
-  addr_t getLabelValue(const std::string& label) const { return getLabelValue(label.c_str()); }
-  addr_t getPC() const { return pc + (intptr_t)mem.getMemory(); }
-};
 
-addrdiff_t Label::relAddr() const {
-  if (name.empty()) {
-    if (address > pS->getPC()) {
-      return address - pS->getPC();
-    } else {
-      return -(pS->getPC() - address);
+  /// 到達不能なブロックにだけ命令を生成する、またはラベルを定義する命令生成関数の番号
+  std::vector<std::size_t> unreachableRecords() const {
+    std::vector<bool> reachable(records.size(), false);
+    std::vector<bool> unreachable(records.size(), false);
+    for (const auto& b : blocks) {
+      for (std::size_t j = b.first; j < b.last; ++j) {
+        (b.reachable ? reachable : unreachable)[insns[j].record] = true;
+      }
     }
-  } else {
-    return pS->getLabelOffset(name);
+    std::vector<std::size_t> res;
+    for (std::size_t i = 0; i < records.size(); ++i) {
+      const Strage::Record& r = records[i];
+      if (r.code.empty()) {
+        const int b = r.labels.empty() ? -1 : blockAt(r.addr);
+        if (b >= 0 && !blocks[b].reachable) {
+          res.push_back(i);
+        }
+      } else if (unreachable[i] && !reachable[i]) {
+        res.push_back(i);
+      }
+    }
+    return res;
   }
-}
 
-addr_t Label::absAddr() const {
-  if (name.empty()) {
-    return address;
-  } else {
-    return pS->getLabelOffset(name) + pS->getPC();
+  /// ブロックの境界・後続ブロック・生存レジスタの一覧
+  /// プロファイラやレイアウトツールに渡すための、1行1ブロックのテキスト形式
+  std::string dump() const {
+    const auto regs = [](uint32 set) {
+      std::string s;
+      for (int i = 1; i < 32; ++i) {
+        if (set & (1u << i)) {
+          s += (s.empty() ? "" : ",") + std::string(intReg(i).name);
+        }
+      }
+      return s;
+    };
+    std::string res;
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+      const Block& b = blocks[i];
+      char buf[64];
+      snprintf(buf, sizeof(buf) - 1, "B%zu 0x%llx-0x%llx", i, b.begin, b.end);
+      res += buf;
+      for (const auto& l : b.labels) {
+        res += " <" + l + ">";
+      }
+      res += " ->";
+      for (int s : b.succs) {
+        res += " B" + std::to_string(s);
+      }
+      if (b.exit) {
+        res += " exit";
+      }
+      res += b.reachable ? "" : " unreachable";
+      res += " in:" + regs(b.liveIn) + " out:" + regs(b.liveOut) + "\n";
+    }
+    return res;
   }
-}
-
-addr_t Label::value() const { return pS->getLabelValue(name); }
+};
 
 /*******************************************************************************
  * コード生成クラス
  ******************************************************************************/
 
+/// 丸めモードの定義
+/// DotAccessors からも参照するため CodeGenerator の外で定義して、CodeGenerator の基底クラスにする
+struct RoundingModes {
+  /// 丸めモード
+  enum RoundingMode {
+    rne = 0,                     ///<最近の偶数へ丸める
+    rtz = 1,                     ///<ゼロに向かって丸める
+    rdn = 2,                     ///<切り下げ(-∞方向)
+    rup = 3,                     ///<切り上げ(+∞方向)
+    rmm = 4,                     ///<最も近い絶対値が大きい方向に丸める
+    invalid_rounding_mode5 = 5,  ///< 不正な値。将来使用するため予約。
+    invalid_rounding_mode6 = 6,  ///< 不正な値。将来使用するため予約。
+    dyn = 7,                     ///<動的丸めモード(丸めモードレジスタでは使用できない値)
+  };
+};
+
+// 自動生成されるヘッダファイルの取り込み
+// ・ドットを含む命令(fadd.s など)の呼び出し用のクラス DotAccessors の定義
+//   アクセサは空のクラスなので、CodeGenerator のサイズとコンストラクタの処理はほとんど増えない
+#include "xkon_dot.hpp"
+
 template <Isa support_isa>
-class CodeGenerator : public Registers {
+class CodeGenerator : public Registers, public RoundingModes, public DotAccessors<CodeGenerator<support_isa>> {
   typedef CodeGenerator<support_isa> self_t;
 
   Strage st;
@@ -985,26 +3151,57 @@ class CodeGenerator : public Registers {
   //////////////////////////////////////////////////////////////////////////////
 
  public:
-  /// 丸めモード
-  enum RoundingMode {
-    rne = 0,                     ///<最近の偶数へ丸める
-    rtz = 1,                     ///<ゼロに向かって丸める
-    rdn = 2,                     ///<切り下げ(-∞方向)
-    rup = 3,                     ///<切り上げ(+∞方向)
-    rmm = 4,                     ///<最も近い絶対値が大きい方向に丸める
-    invalid_rounding_mode5 = 5,  ///< 不正な値。将来使用するため予約。
-    invalid_rounding_mode6 = 6,  ///< 不正な値。将来使用するため予約。
-    dyn = 7,                     ///<動的丸めモード(丸めモードレジスタでは使用できない値)
-  };
+  CodeGenerator(std::size_t size = 4096) : Registers(), RoundingModes(), DotAccessors<self_t>(), st(size) {}
 
   static Constant from(RoundingMode rm) { return Constant(3, rm); }
 
   template <typename T>
   T generate() {
     char* pExec = st.generate();
+    // シンボルがすべて定義済みなら、生成した場所で実行できるようにリロケーションを適用する
+    if (!st.getRelocations().empty() && isResolvable(st.getRelocations(), st.getSymbols())) {
+      relocate(pExec, reinterpret_cast<addr_t>(pExec), st.getRelocations(), st.getSymbols(), targetIs<RV64I>() ? 64 : 32);
+    }
+#if XKON_PERF
+    if (perf::Log::instance().enabled()) {
+      perf::Log::instance().codeLoad(pExec, perf::functions(pExec, getCodeSize(), st.getExports(), st.getLabels()), targetIs<RV64I>() ? 64 : 32,
+                                      &st.getSourceMap());
+    }
+#endif
+#if DEBUG && !XKON_DESC
+    printf("%s", listing().c_str());
+#endif
     return (T)pExec;
   }
 
+  /// 生成済みの命令列の先頭アドレス
+  const char* getCode() const { return st.getCode(); }
+
+  /// 生成済みの命令列のバイト数
+  std::size_t getCodeSize() const { return st.getCodeSize(); }
+
+  /// 命令列とラベルを破棄して、同じメモリー領域で別の関数を生成できるようにする
+  /// 確保済みの領域は再利用するので、生成を繰り返してもメモリー確保は命令生成関数の分だけになる
+  void reset() {
+    st.reset();
+    openFrame.reset();
+  }
+
+  /// generate() で命令をエンコードするスレッド数(既定は 1 で並列化しない、0 ならハードウェアのスレッド数)
+  /// 2 以上にすると、Strage::PARALLEL_MIN_SIZE バイト以上の命令列を区間に分けて並列にエンコードする。出力はスレッド数によらず同じ
+  /// generate() ごとにスレッドを起動するので、多数の関数を並行してコンパイルする場合は 1 のままにする
+  void setEncodeThreads(int n) { st.setEncodeThreads(n); }
+
+  /// ラベル名からオフセット
+  const std::map<std::string, addr_t>& getLabels() const { return st.getLabels(); }
+
+  /// 生成済みの命令列の逆アセンブルリスト
+  std::string listing() const {
+    Disassembler dis(targetIs<RV64I>() ? 64 : 32);
+    dis.addLabels(st.getLabels());
+    return dis.listing(st.getCode(), st.getCodeSize());
+  }
+
  private:
   /**
    * val を size ビットの符号付整数とみなして、
@@ -1055,15 +3252,193 @@ class CodeGenerator : public Registers {
   Label far(const char* label) { return Label(st, label, true); }
   Label far(const Label& label) { return label.toFar(); }
 
+  /// beqz と同じ条件分岐。label が条件分岐の届く範囲を超える場合は、bnez で直後の j を飛び越える組を生成する
+  /// 生成するまで分岐先までの距離が分からない場合(長いループの出口など)に使う。generate() でラベルのアドレスを再計算する
+  void beqzRelaxed(const IntReg& rs, const char* label) { st << relaxedBranch(0x63 | (rs.idx << 15), false, label); }
+  /// bnez と同じ条件分岐。届かない場合は beqz で直後の j を飛び越える(beqzRelaxed() を参照)
+  void bnezRelaxed(const IntReg& rs, const char* label) { st << relaxedBranch(0x63 | (rs.idx << 15), true, label); }
+
  public:
   //////////////////////////////////////////////////////////////////////////////
   // ラベル
 
   void L(const char* label) {
     std::string l(label);
-    st << [=](Strage& s) { st.addLabel(l.c_str()); };
+    st << [=](Strage& s) { s.addLabel(l.c_str()); };
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // モジュール
+  // 1つの CodeGenerator に複数の関数を生成して、関数名またはハンドルで先頭アドレスを取得する
+
+  /// 関数 name の開始
+  /// name のラベルを定義してエクスポートし、getFunction() に渡すハンドルを返す
+  std::size_t function(const char* name) {
+    closeFrame();
+    L(name);
+    return st.exportLabel(name);
+  }
+
+  /// モジュール内の関数 name の呼び出し
+  /// 呼び出し先との距離に応じて c.jal / jal / call(auipc+jalr) のうち最も短いものを生成する
+  /// 呼び出し先が後方でもよい(generate() の開始時に距離を再計算して選び直す)
+  void callFunction(const char* name) {
+    if (targetIs<RV32I>()) {
+      const Label label = str2label(name);
+      auto nearForm = std::make_shared<std::list<Strage::InsnGen_t>>();
+      auto farForm = std::make_shared<std::list<Strage::InsnGen_t>>();
+      st.beginCapture(nearForm.get());
+      jal(ra, label);
+      st.endCapture();
+      st.beginCapture(farForm.get());
+      call(label);
+      st.endCapture();
+
+      // 一度 jal で届かなくなったら call に固定して、ラベルのアドレスの再計算が収束するようにする
+      auto far = std::make_shared<bool>(false);
+      st << [=](Strage& s) {
+        if (!*far && !isSintN(label.relAddr(), 21)) {
+          *far = true;
+        }
+        for (auto& e : *(*far ? farForm : nearForm)) {
+          e(s);
+          s.updatePC();
+        }
+      };
+      st.requestLayout();
+    } else {
+      unsupported("call");
+    }
+  }
+
+  /// エクスポートした関数の先頭アドレス(generate() の後で使う)
+  template <typename T>
+  T getFunction(const char* name) const {
+    const auto itr = st.getLabels().find(name);
+    const std::vector<std::string>& exports = st.getExports();
+    if (itr == st.getLabels().end() || std::find(exports.begin(), exports.end(), name) == exports.end()) {
+      throw UnsupportedException("Unknown function.");
+    }
+    return (T)(st.getCode() + itr->second);
+  }
+  template <typename T>
+  T getFunction(std::size_t handle) const {
+    return getFunction<T>(st.getExports().at(handle).c_str());
+  }
+
+  /// エクスポートした関数の一覧(関数名から先頭アドレス)
+  std::map<std::string, const void*> getSymbols() const {
+    std::map<std::string, const void*> res;
+    for (const auto& name : st.getExports()) {
+      res[name] = getFunction<const void*>(name.c_str());
+    }
+    return res;
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // リロケーション
+  // 外部シンボルの参照はアドレスを埋め込まずにリロケーション情報を残す
+  // generate() の時点で全シンボルが定義済みならその場で解決する。未定義なら relocate() で解決する
+
+  /// 外部シンボルの参照方法の設定(以降に追加する la() / callSymbol() に適用される)
+  void setRelocMode(RelocMode mode) { st.setRelocMode(mode); }
+
+  /// 外部シンボルの定義
+  void defineSymbol(const char* name, addr_t addr) { st.defineSymbol(name, addr); }
+  void defineSymbol(const char* name, const void* addr) { st.defineSymbol(name, reinterpret_cast<addr_t>(addr)); }
+
+  /// 定義済みの外部シンボル
+  const SymbolTable& getExternalSymbols() const { return st.getSymbols(); }
+
+  /// generate() で生成したリロケーション情報
+  const std::vector<Relocation>& getRelocations() const { return st.getRelocations(); }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // ソース位置
+
+  /// 以降に生成する命令にソースの識別子 id を付ける(SourceMap::NO_SOURCE で解除)
+  void setSource(uint32 id) {
+    st << [=](Strage& s) { s.markSource(id); };
+  }
+
+  /// generate() で生成した命令のオフセットからソースの識別子への対応表
+  const SourceMap& getSourceMap() const { return st.getSourceMap(); }
+
+  /// 生成した命令のアドレス pc のソースの識別子。無ければ SourceMap::NO_SOURCE
+  uint32 sourceOf(const void* pc) const {
+    const char* p = static_cast<const char*>(pc);
+    return (st.getCode() <= p) ? st.getSourceMap().lookup(static_cast<addr_t>(p - st.getCode())) : SourceMap::NO_SOURCE;
+  }
+
+  /// 外部シンボル symbol + addend のアドレスを rd にロードする
+  /// 命令列の長さはモードごとに固定(RelocGot はさらにコード末尾に GOT のスロットを1つ追加する)
+  void la(const IntReg& rd, const char* symbol, int32 addend = 0) {
+    if (targetIs<RV32I>()) {
+      symbolRef(rd, symbol, addend, false);
+    } else {
+      unsupported(__func__);
+    }
+  }
+
+  /// 外部シンボル symbol の関数の呼び出し(戻りアドレスは ra)
+  void callSymbol(const char* symbol) {
+    if (targetIs<RV32I>()) {
+      symbolRef(ra, symbol, 0, true);
+    } else {
+      unsupported("call");
+    }
+  }
+
+ private:
+  /**
+   * 外部シンボルの上位20ビットを rd に求めて、下位12ビットを addi rd,rd,lo (isCall なら jalr rd,lo(rd))の即値にする
+   * RelocGot では rd に GOT のスロットの内容を読み込む(isCall なら続けて jalr rd,0(rd))
+   */
+  void symbolRef(const IntReg& rd, const std::string& symbol, int32 addend, bool isCall) {
+    const RelocMode mode = st.getRelocMode();
+    const std::string slot = (mode == RelocGot) ? st.gotSlot(symbol, addend, 4) : std::string();
+    const std::string ref = symbol + (addend != 0 ? "+" + std::to_string(addend) : "");
+
+    st << [=](Strage& s) {
+      switch (mode) {
+        case RelocAbsolute:
+          s.addRelocation(RelocHi20Lo12, symbol, addend);
+          s.word(Constant(20, 0) << rd.Idx() << "7'b0110111"_c);
+          s.desc(XKON_LAZY(s.format("oiL") % "lui" % rd % ("%hi(" + ref + ")")));
+          break;
+        case RelocPcrel:
+          s.addRelocation(RelocPcrelHi20Lo12, symbol, addend);
+          s.word(Constant(20, 0) << rd.Idx() << "7'b0010111"_c);
+          s.desc(XKON_LAZY(s.format("oiL") % "auipc" % rd % ("%pcrel_hi(" + ref + ")")));
+          break;
+        case RelocGot: {
+          // スロットへの相対アドレスを call() と同様に上位と下位に分ける
+          const uint32 offset = static_cast<uint32>(Label(s, slot.c_str()).relAddr());
+          const uint32 imm = (offset + 0x800) & 0xfffff000;
+          const int32 lo = static_cast<int32>(offset - imm);
+          const IntOffsetReg rs1 = rd(lo);
+          s.word((_31 - _12)[imm] << rd.Idx() << "7'b0010111"_c);
+          s.desc(XKON_LAZY(s.format("oiL") % "auipc" % rd % ("%got_pcrel_hi(" + ref + ")")));
+          s.updatePC();
+          s.word((_11 - _0)[lo] << rs1.Idx() << "3'b010"_c << rd.Idx() << "7'b0000011"_c);
+          s.desc(XKON_LAZY(s.format("oiI") % "lw" % rd % rs1));
+          break;
+        }
+      }
+      if (isCall) {
+        const IntOffsetReg rs1 = rd(0);
+        s.updatePC();
+        s.word(Constant(12, 0) << rs1.Idx() << "3'b000"_c << rd.Idx() << "7'b1100111"_c);
+        s.desc(XKON_LAZY(s.format("oJ") % "jalr" % rs1));
+      } else if (mode != RelocGot) {
+        s.updatePC();
+        s.word(Constant(12, 0) << rd.Idx() << "3'b000"_c << rd.Idx() << "7'b0010011"_c);
+        s.desc(XKON_LAZY(s.format("oiis") % "addi" % rd % rd % 0));
+      }
+    };
   }
 
+ public:
   //////////////////////////////////////////////////////////////////////////////
   // CPU命令の実装
 #define XKON_NOINLINE __attribute__((noinline))
@@ -3651,10 +6026,415 @@ class CodeGenerator : public Registers {
   // !impl pseudo::fsflags rd, rs (csrrw rd, fflags, rs) Swap FP exception flags
   // !impl pseudo::fsflags rs (csrrw x0, fflags, rs) Write FP exception flags
 
-  // 以下の要素を定義した自動生成されるヘッダファイルの取り込み
-  // ・ドットを含む命令の実装用のクラスの定義
-  // ・メンバー変数の定義
-  // ・コンストラクタの定義
-#include "xkon_dot.hpp"
+  //////////////////////////////////////////////////////////////////////////////
+  // スタックフレーム
+  //
+  // prologue() から次の prologue() / function() または命令列の終わりまでに実際に書き込まれた
+  // callee-saved レジスタ(ra,s0-s11)だけを退避する、16バイト境界に整列した最小のスタックフレームを自動で構築する。
+  // 最後の epilogue() より後に追加した命令(出口のブロックより後ろに配置したブロックなど)の書込みも退避の対象になる。
+  // 退避と復帰の命令列は generate() の開始時に確定し、sw/lw/addi の生成処理を通して
+  // 可能な限り c.swsp/c.lwsp/c.addi16sp の圧縮命令で生成される。
+  //
+  // 退避と復帰を必要な経路にだけ置く処理(シュリンクラッピング)は自動では行わない。
+  // prologue() と epilogue() を退避が必要な経路にだけ置くこと。
+  // 例えば、引数のチェックだけで抜ける経路は prologue() の前に置いて ret() すれば、
+  // その経路ではレジスタの退避と復帰が一切行われない。
+  // epilogue() は関数の出口ごとに何回呼んでもよい。
+  //
+  // 例:
+  //   beqz(a0, "quick");
+  //   Frame f = prologue();
+  //   ...              // s1,s2 の書込みと関数呼出し
+  //   epilogue(f);     // ra,s1,s2 を復帰して16バイトのフレームを解放
+  //   ret();
+  //   L("quick");
+  //   ret();
+
+  /// prologue() で開始したスタックフレームの管理情報
+  class Frame {
+    friend self_t;
+
+    struct State {
+      uint32 saved = 0;                                      ///< 退避するレジスタのビットマップ
+      std::shared_ptr<std::list<Strage::InsnGen_t>> enter;  ///< 退避処理の命令列
+      std::list<std::shared_ptr<std::list<Strage::InsnGen_t>>> leaves;  ///< 復帰処理の命令列(出口ごと)
+    };
+    std::shared_ptr<State> state;
+
+    explicit Frame(std::shared_ptr<State> state) : state(state) {}
+
+   public:
+    /// 退避するレジスタのビットマップ(generate() 後に確定)
+    uint32 savedRegs() const { return state->saved; }
+  };
+
+ private:
+  /// callee-saved な整数レジスタ(ra,s0,s1,s2-s11)のビットマップ
+  static constexpr uint32 CALLEE_SAVED = (1u << 1) | (1u << 8) | (1u << 9) | (0x3ffu << 18);
+
+  /// 退避対象のレジスタを退避の順番(ra,s0,s1,s2,...)に並べて返す
+  static std::vector<int> savedList(uint32 saved) {
+    std::vector<int> list;
+    for (int i = 1; i < 32; ++i) {
+      if (saved & (1u << i)) {
+        list.push_back(i);
+      }
+    }
+    return list;
+  }
+
+  /// 退避対象のレジスタ数から16バイト境界に整列したフレームサイズを返す
+  static int32 frameSize(uint32 saved) {
+    const int32 n = static_cast<int32>(savedList(saved).size());
+    return (n * 4 + 15) & ~15;
+  }
+
+  /// 書き込まれた callee-saved レジスタを収集中のフレーム
+  std::shared_ptr<typename Frame::State> openFrame;
+
+  /// 収集中のフレームに prologue() 以降に書き込まれた callee-saved レジスタを加えて、収集を終える
+  void closeFrame() {
+    if (openFrame) {
+      openFrame->saved |= st.getDefs() & CALLEE_SAVED;
+      openFrame.reset();
+    }
+  }
+
+ public:
+  /// スタックフレームの開始
+  /// この位置に、次の prologue() / function() または命令列の終わりまでに書き込まれた callee-saved レジスタの退避処理が生成される
+  Frame prologue() {
+    closeFrame();
+    std::shared_ptr<typename Frame::State> state = std::make_shared<typename Frame::State>();
+    state->enter = std::make_shared<std::list<Strage::InsnGen_t>>();
+    st.clearDefs();
+    st << Strage::group(state->enter);
+    openFrame = state;
+
+    st.addFinalizer([=]() {
+      if (openFrame == state) {
+        closeFrame();
+      }
+      const int32 size = frameSize(state->saved);
+      if (size == 0) {
+        return;
+      }
+      st.beginCapture(state->enter.get());
+      addi(sp, sp, -size);
+      int32 offset = size;
+      for (int idx : savedList(state->saved)) {
+        offset -= 4;
+        sw(intReg(idx), sp[offset]);
+      }
+      st.endCapture();
+
+      for (auto& leave : state->leaves) {
+        st.beginCapture(leave.get());
+        int32 offset = size;
+        for (int idx : savedList(state->saved)) {
+          offset -= 4;
+          lw(intReg(idx), sp[offset]);
+        }
+        addi(sp, sp, size);
+        st.endCapture();
+      }
+    });
+
+    return Frame(state);
+  }
+
+  /// スタックフレームの終了
+  /// この位置に、退避したレジスタの復帰処理が生成される(ret() は別途呼ぶこと)
+  void epilogue(const Frame& frame) {
+    std::shared_ptr<std::list<Strage::InsnGen_t>> leave = std::make_shared<std::list<Strage::InsnGen_t>>();
+    frame.state->leaves.push_back(leave);
+    st << Strage::group(leave);
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // 制御フロー解析
+  //
+  // 記録済みの命令列から基本ブロック・分岐先・整数レジスタの生存区間を求める。
+  // prologue() などの後から決まる命令列は、解析の時点で確定させる。
+
+  /// 記録済みの命令列の制御フローグラフ
+  Cfg cfg() { return Cfg(st.analyze(), st.getExports()); }
+
+  /// 到達不能なブロックの命令生成関数を削除し、削除した数を返す
+  std::size_t removeUnreachable() {
+    const Cfg g = cfg();
+    std::vector<std::list<Strage::InsnGen_t>::iterator> itrs;
+    for (std::size_t i : g.unreachableRecords()) {
+      itrs.push_back(g.getRecords()[i].itr);
+    }
+    if (!itrs.empty()) {
+      st.erase(itrs);
+    }
+    return itrs.size();
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // ブロック配置の最適化
+  //
+  // ラベルから始まるブロックに実行回数(プロファイル結果)や likely/unlikely のヒントを付け、
+  // optimizeLayout() を呼ぶと、実行頻度の低いブロックを命令列の末尾(コールド領域)に移動する。
+  // 移動したブロックへ条件分岐で抜けていた箇所は分岐条件を反転し、頻度の高い経路が
+  // そのまま次の命令に進むようにする。
+  //
+  // 以下のブロックを実行頻度が低いとみなす。
+  // ・unlikely() を指定したブロック、実行回数が0または最大の実行回数の1/COLD_RATIO未満のブロック
+  // ・likely() を指定したブロックへの条件分岐で、分岐しなかった場合に進むブロック
+  //
+  // 移動したブロックへの分岐は far() と同様に圧縮命令を使わずに生成する。
+  // 移動したブロックとの間の条件分岐が届く範囲を超える場合は、反対の条件で直後の j を
+  // 飛び越える形にする(callFunction() と同様に generate() の開始時に距離を再計算して選び直す)。
+  //
+  // 例:
+  //   bnez(a0, "error");
+  //   unlikely("error");
+  //   ...              // 通常の処理
+  //   ret();
+  //   L("error");      // コールド領域に移動し、bnez はそのまま "error" へ分岐する
+  //   ...
+
+  static constexpr uint64_t LIKELY_COUNT = ~static_cast<uint64_t>(0);
+  static constexpr uint64_t COLD_RATIO = 100;
+
+  /// ラベル label から始まるブロックの実行回数の指定
+  void count(const char* label, uint64_t n) { st.setCount(label, n); }
+  /// ラベル label から始まるブロックは実行されやすい
+  void likely(const char* label) { count(label, LIKELY_COUNT); }
+  /// ラベル label から始まるブロックは実行されにくい
+  void unlikely(const char* label) { count(label, 0); }
+
+ private:
+  /// 実行頻度の低いブロックの判定
+  std::vector<bool> coldBlocks(const Cfg& g) const {
+    const auto& blocks = g.getBlocks();
+    const auto& counts = st.getCounts();
+
+    // ブロックの実行回数(指定が無ければ -1)
+    std::vector<int64_t> n(blocks.size(), -1);
+    uint64_t max = 0;
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+      for (const auto& l : blocks[i].labels) {
+        const auto itr = counts.find(l);
+        if (itr != counts.end()) {
+          n[i] = (itr->second == LIKELY_COUNT) ? INT64_MAX : static_cast<int64_t>(itr->second);
+          if (itr->second != LIKELY_COUNT) {
+            max = std::max(max, itr->second);
+          }
+        }
+      }
+    }
+
+    std::vector<bool> cold(blocks.size(), false);
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+      if (n[i] == 0 || (0 < n[i] && n[i] != INT64_MAX && static_cast<uint64_t>(n[i]) * COLD_RATIO < max)) {
+        cold[i] = true;
+      }
+      // likely なブロックへの条件分岐の、分岐しない側
+      const auto& insn = g.getInsns()[blocks[i].last - 1];
+      if (insn.flow == FlowBranch && blocks[i].succs.size() == 2 && n[blocks[i].succs[0]] == INT64_MAX && n[blocks[i].succs[1]] < 0) {
+        cold[blocks[i].succs[1]] = true;
+      }
+    }
+    return cold;
+  }
+
+  /// 条件分岐命令 code と同じ条件(invert なら反転した条件)でラベル label へ分岐する命令を生成する
+  void branchLike(uint32 code, bool invert, const char* label) {
+    if ((code & 3) != 3) {
+      // C.BEQZ / C.BNEZ
+      const IntReg rs = intReg(8 + ((code >> 7) & 7));
+      if ((((code >> 13) & 7) == 6) != invert) {
+        beqz(rs, far(label));
+      } else {
+        bnez(rs, far(label));
+      }
+      return;
+    }
+    const IntReg rs1 = intReg((code >> 15) & 0x1f);
+    const IntReg rs2 = intReg((code >> 20) & 0x1f);
+    switch (((code >> 12) & 7) ^ (invert ? 1 : 0)) {
+      case 0:
+        beq(rs1, rs2, far(label));
+        break;
+      case 1:
+        bne(rs1, rs2, far(label));
+        break;
+      case 4:
+        blt(rs1, rs2, far(label));
+        break;
+      case 5:
+        bge(rs1, rs2, far(label));
+        break;
+      case 6:
+        bltu(rs1, rs2, far(label));
+        break;
+      case 7:
+        bgeu(rs1, rs2, far(label));
+        break;
+      default:
+        XKON_ASSERT(0);
+        break;
+    }
+  }
+
+  /// 命令生成関数を記録せずに組み立てる
+  std::list<Strage::InsnGen_t> capture(std::function<void()> emit) {
+    std::list<Strage::InsnGen_t> list;
+    st.beginCapture(&list);
+    emit();
+    st.endCapture();
+    return list;
+  }
+
+  /// branchLike() の分岐の命令生成関数。label が条件分岐の届く範囲を超える場合は
+  /// 反対の条件で直後を飛び越える条件分岐と j の組を生成する
+  Strage::InsnGen_t relaxedBranch(uint32 code, bool invert, const std::string& label) {
+    const Label target = str2label(label.c_str());
+    const std::string skip = st.newLabel(".hs");
+    auto nearForm = std::make_shared<std::list<Strage::InsnGen_t>>(capture([&]() { branchLike(code, invert, label.c_str()); }));
+    auto farForm = std::make_shared<std::list<Strage::InsnGen_t>>(capture([&]() {
+      branchLike(code, !invert, skip.c_str());
+      j(far(label.c_str()));
+      L(skip.c_str());
+    }));
+
+    // 一度届かなくなったら j の組に固定して、ラベルのアドレスの再計算が収束するようにする
+    auto far = std::make_shared<bool>(false);
+    st.requestLayout();
+    return [=](Strage& s) {
+      if (!*far && !isSintN(target.relAddr(), 12)) {  // beq などの命令生成と同じ範囲
+        *far = true;
+      }
+      for (auto& e : *(*far ? farForm : nearForm)) {
+        e(s);
+        s.updatePC();
+      }
+    };
+  }
+
+  /// ブロック b の先頭のラベル(無ければ pos の前に新しいラベルを挿入する)
+  std::string blockLabel(const Cfg::Block& b, std::list<Strage::InsnGen_t>::iterator pos) {
+    if (!b.labels.empty()) {
+      return b.labels.front();
+    }
+    const std::string label = st.newLabel(".hc");
+    for (auto& e : capture([&]() { L(label.c_str()); })) {
+      st.insert(pos, e);
+    }
+    return label;
+  }
+
+ public:
+  /// 実行頻度の低いブロックをコールド領域に移動し、移動したブロック数を返す
+  std::size_t optimizeLayout() {
+    const Cfg g = cfg();
+    const auto& blocks = g.getBlocks();
+    const auto& insns = g.getInsns();
+    const auto& records = g.getRecords();
+    const std::vector<bool> cold = coldBlocks(g);
+
+    // アドレス addr 以降の最初の命令生成関数の番号
+    const auto recordAt = [&](addr_t addr) {
+      std::size_t i = 0;
+      while (i < records.size() && records[i].addr < addr) {
+        ++i;
+      }
+      return i;
+    };
+
+    std::vector<std::pair<std::list<Strage::InsnGen_t>::iterator, std::list<Strage::InsnGen_t>::iterator>> moves;
+    std::vector<bool> inCold(blocks.size(), false);
+    std::set<std::size_t> replaced;  ///< 分岐を置き換えた命令生成関数の番号
+    std::size_t moved = 0;
+    std::size_t i = 1;
+    while (i < blocks.size()) {
+      if (!cold[i]) {
+        ++i;
+        continue;
+      }
+
+      // 連続するコールドなブロックと、そこからしか到達しないラベルの無いブロックをまとめる
+      std::size_t last = i;
+      while (last + 1 < blocks.size()) {
+        const Cfg::Block& next = blocks[last + 1];
+        const bool onlyFromRun = next.labels.empty() && next.preds.size() == 1 && next.preds[0] == static_cast<int>(last);
+        if (!cold[last + 1] && !onlyFromRun) {
+          break;
+        }
+        ++last;
+      }
+      const std::size_t first = i;
+      i = last + 1;
+      if (last + 1 >= blocks.size()) {
+        continue;  // 既に末尾にある
+      }
+
+      // 命令生成関数の境界とブロックの境界が一致しない場合は移動しない
+      const Cfg::Block& next = blocks[last + 1];
+      if (records[insns[blocks[first].first].record].addr != blocks[first].begin || insns[next.first].record == insns[blocks[last].last - 1].record) {
+        continue;
+      }
+
+      // 直前のブロックから流れ込む場合は、分岐しない側がコールドな条件分岐だけ条件を反転して移動できる
+      const Cfg::Block& prev = blocks[first - 1];
+      const Cfg::Insn& prevLast = insns[prev.last - 1];
+      const bool fallIn = prevLast.flow != FlowJump && prevLast.flow != FlowReturn && prevLast.flow != FlowIndirectJump;
+      if (fallIn) {
+        const bool takenToNext = prev.succs.size() == 2 && prev.succs[0] == static_cast<int>(last + 1);
+        if (prevLast.flow != FlowBranch || !takenToNext || records[prevLast.record].code.size() != 1) {
+          continue;
+        }
+      }
+
+      // ブロックの組み替え
+      auto runFirst = records[recordAt(blocks[first].begin)].itr;
+      auto nextFirst = records[recordAt(next.begin)].itr;
+      if (fallIn) {
+        const std::string label = blockLabel(blocks[first], runFirst);
+        if (blocks[first].labels.empty()) {
+          runFirst = std::prev(runFirst);
+        }
+        *records[prevLast.record].itr = relaxedBranch(prevLast.code, true, label);
+        replaced.insert(prevLast.record);
+      }
+      const Cfg::Insn& runLast = insns[blocks[last].last - 1];
+      if (runLast.flow != FlowJump && runLast.flow != FlowReturn && runLast.flow != FlowIndirectJump) {
+        // コールド領域から直後のブロックへ戻る
+        const std::string label = blockLabel(next, nextFirst);
+        if (next.labels.empty()) {
+          nextFirst = std::prev(nextFirst);
+        }
+        for (auto& e : capture([&]() { j(far(label.c_str())); })) {
+          st.insert(nextFirst, e);
+        }
+      }
+      moves.push_back(std::make_pair(runFirst, nextFirst));
+      moved += last - first + 1;
+      std::fill(inCold.begin() + first, inCold.begin() + last + 1, true);
+    }
+
+    // 移動したブロックとの間の条件分岐は距離が変わるので、届かない場合に j との組にできるようにする
+    for (std::size_t b = 0; b < blocks.size(); ++b) {
+      const Cfg::Insn& insn = insns[blocks[b].last - 1];
+      if (insn.flow != FlowBranch || blocks[b].succs.empty() || replaced.count(insn.record) != 0 || records[insn.record].code.size() != 1) {
+        continue;
+      }
+      const Cfg::Block& dst = blocks[blocks[b].succs[0]];
+      if ((inCold[b] || inCold[blocks[b].succs[0]]) && !dst.labels.empty() && dst.begin == static_cast<addr_t>(insn.addr + insn.offset)) {
+        *records[insn.record].itr = relaxedBranch(insn.code, false, dst.labels.front());
+        replaced.insert(insn.record);
+      }
+    }
+
+    for (auto& m : moves) {
+      st.moveToEnd(m.first, m.second);
+    }
+    st.layout();
+    return moved;
+  }
 };
 }  // namespace xkon
@@ -0,0 +1,164 @@
+#pragma once
+
+/**
+ * バックグラウンドでの命令生成
+ *
+ * CodeGenerator の構築(命令の記録)と generate() は呼び出したスレッドで同期的に行われるので、
+ * 命令生成の時間がそのまま呼び出し側の処理の遅延になる。
+ * CompileQueue はワーカースレッドで生成器の構築と generate() を行い、結果を future で返す。
+ *
+ * * submit() には生成器を構築して std::unique_ptr で返す関数を渡す。生成器の構築もワーカースレッドで行う。
+ * * entry を指定すると、生成が終わった時点で関数のアドレスを entry にアトミックに書き込む(release)。
+ *   呼び出し側は entry を読んで(acquire) nullptr の間はインタプリタや前の段階のコードを実行し続ければよく、
+ *   生成の完了を待つ必要は無い。
+ * * published を指定すると、関数のアドレスを entry に書き込んだ後にワーカースレッドで呼び出す(統計の集計などに使う)。
+ * * CodeHeap を指定すると命令列を CodeHeap に配置して生成器は破棄する。
+ *   指定しない場合は生成器を CompileQueue が保持し、命令列は CompileQueue の破棄まで有効。
+ * * 生成器の構築で発生した例外は future に格納する(entry は変更しない)。
+ *   CodeHeap の領域が足りない場合は nullptr を返す。
+ * * 破棄時は受け付け済みの生成をすべて終えてからワーカースレッドを終了する。
+ *
+ * 例:
+ *   heap::CodeHeap heap(16 << 20);
+ *   async::CompileQueue queue(2, &heap);
+ *   std::atomic<int (*)(int)> entry(nullptr);
+ *   queue.submit([=]() { return std::unique_ptr<Gen>(new Gen(src)); }, &entry);
+ *   ...
+ *   int (*f)(int) = entry.load(std::memory_order_acquire);
+ *   r = (f != nullptr) ? f(x) : interpret(x);
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "xkon.hpp"
+#include "xkon_heap.hpp"
+
+namespace xkon {
+namespace async {
+
+class CompileQueue {
+  CompileQueue(const CompileQueue&);
+  void operator=(const CompileQueue&);
+
+  heap::CodeHeap* heap;
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<std::function<void()>> tasks;
+  bool stopping;
+  std::vector<std::shared_ptr<void>> retained;  ///< heap が無い場合に命令列を保持する生成器
+  std::atomic<std::size_t> codeSize;
+  std::vector<std::thread> workers;  ///< 他のメンバの初期化後に起動するため最後に置く
+
+  // submit() の published の型(T は entry から推論させる)
+  template <typename T>
+  struct Published {
+    typedef std::function<void(T)> type;
+  };
+
+  void run() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this]() { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+          return;
+        }
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  // g の命令を生成して配置し、関数のアドレスを entry に公開する
+  template <typename T, typename G>
+  T compile(std::unique_ptr<G> g, std::atomic<T>* entry, const std::string& name, const std::function<void(T)>& published) {
+    g->template generate<void*>();
+    const std::size_t size = g->getCodeSize();
+    T f;
+    if (heap != nullptr) {
+      f = heap->template install<T>(*g, name.empty() ? nullptr : name.c_str());
+    } else {
+      f = name.empty() ? (T)g->getCode() : g->template getFunction<T>(name.c_str());
+      std::lock_guard<std::mutex> lock(mutex);
+      retained.push_back(std::shared_ptr<G>(std::move(g)));
+    }
+    if (f != nullptr) {
+      codeSize += size;
+      if (entry != nullptr) {
+        entry->store(f, std::memory_order_release);
+      }
+      if (published) {
+        published(f);
+      }
+    }
+    return f;
+  }
+
+ public:
+  /// threads 個(0 ならハードウェアのスレッド数)のワーカースレッドを起動する。heap を指定すると命令列を heap に配置する
+  explicit CompileQueue(int threads = 0, heap::CodeHeap* heap = nullptr)
+      : heap(heap), mutex(), ready(), tasks(), stopping(false), retained(), codeSize(0), workers() {
+    if (threads <= 0) {
+      threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    for (int i = 0; i < threads; ++i) {
+      workers.emplace_back([this]() { run(); });
+    }
+  }
+
+  ~CompileQueue() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    ready.notify_all();
+    for (auto& t : workers) {
+      t.join();
+    }
+  }
+
+  /**
+   * build() が返す生成器の命令生成を受け付ける
+   * name を指定した場合はエクスポートした関数 name の、省略した場合は命令列の先頭のアドレスを返す
+   * entry を指定すると完了時にアドレスを書き込み、published を指定すると書き込んだ後で呼び出す
+   */
+  template <typename T, typename F>
+  std::future<T> submit(F build, std::atomic<T>* entry = nullptr, const char* name = nullptr,
+                        typename Published<T>::type published = typename Published<T>::type()) {
+    const std::shared_ptr<std::promise<T>> promise = std::make_shared<std::promise<T>>();
+    std::future<T> res = promise->get_future();
+    const std::string fname = (name != nullptr) ? name : "";
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back([this, build, entry, fname, published, promise]() {
+        try {
+          promise->set_value(compile<T>(build(), entry, fname, published));
+        } catch (...) {
+          promise->set_exception(std::current_exception());
+        }
+      });
+    }
+    ready.notify_one();
+    return res;
+  }
+
+  /// ワーカースレッドの数
+  int getThreads() const { return static_cast<int>(workers.size()); }
+
+  /// 生成を終えて公開した命令列の合計バイト数
+  std::size_t getCodeSize() const { return codeSize.load(std::memory_order_relaxed); }
+};
+
+}  // namespace async
+}  // namespace xkon
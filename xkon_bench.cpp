@@ -0,0 +1,492 @@
+// Assembler benchmark suite.
+//
+// Usage: xkon_bench.out [-n runs] [-w warmup] [-i isas] [-t threads] [-o json]
+//   -n runs   : Number of measured runs per case (default 10).
+//   -w warmup : Number of unmeasured runs before the measurement (default 1).
+//   -i isas   : Comma separated list of RV32G,RV32GC,RV64GC (default all).
+//   -t threads: Maximum number of encoding threads of the parallel case (default the hardware threads).
+//   -o json   : Output file of the results in JSON (default xkon_bench.json).
+//
+// For each ISA variant, the following cases are measured and written one JSON object per line.
+//   emit      : Emitter throughput per instruction class. Emit time is the recording of the
+//               instructions (the generator's constructor), generate time is generate().
+//   generate  : generate() latency versus function size with a mixed instruction stream.
+//   parallel  : generate() latency of a large function (3-4 MB of code) by the number of encoding threads
+//               (1, 2, 4, ... up to -t), the case name is mixed<n>/t<threads>.
+//   labels    : Label-heavy code, a label every other instruction and branches between them.
+//   construct : Construction and destruction of an empty generator.
+//   first     : Time to the first executable function (construct, emit, generate and call).
+//               The generated code is called only on RISC-V hosts.
+//   reuse     : Same as first, but with one generator reused by reset(). Heap bytes are the bytes
+//               allocated per function.
+// Heap bytes are the live heap allocated by the emission, divided by the number of emitter calls.
+// Every result also carries sizeof(CodeGenerator) as object_bytes.
+#define DEBUG 0
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "xkon.hpp"
+
+// Heap usage counters (atomic, generate() may encode in several threads).
+namespace {
+std::atomic<size_t> heap_live(0);
+std::atomic<size_t> heap_total(0);
+}  // namespace
+
+void *operator new(size_t size) {
+  // The size is kept in front of the block to count the live bytes on delete.
+  size_t *p = static_cast<size_t *>(malloc(size + sizeof(max_align_t)));
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  *p = size;
+  heap_live += size;
+  heap_total += size;
+  return reinterpret_cast<char *>(p) + sizeof(max_align_t);
+}
+
+__attribute__((noinline)) void operator delete(void *ptr) noexcept {
+  if (ptr != NULL) {
+    size_t *p = reinterpret_cast<size_t *>(static_cast<char *>(ptr) - sizeof(max_align_t));
+    heap_live -= *p;
+    free(p);
+  }
+}
+
+void operator delete(void *ptr, size_t) noexcept { operator delete(ptr); }
+
+namespace {
+
+using xkon::Isa;
+
+// Elapsed time in nanoseconds.
+typedef std::chrono::steady_clock bench_clock;
+double elapsed(bench_clock::time_point start) { return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count(); }
+
+struct Stats {
+  double median, p10, p90, min, max;
+};
+
+Stats summarize(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  const auto pct = [&v](double q) { return v[static_cast<size_t>(q * (v.size() - 1) + 0.5)]; };
+  return Stats{pct(0.5), pct(0.1), pct(0.9), v.front(), v.back()};
+}
+
+std::string json(const Stats &s) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), "{\"median\":%.0f,\"p10\":%.0f,\"p90\":%.0f,\"min\":%.0f,\"max\":%.0f}", s.median, s.p10, s.p90, s.min, s.max);
+  return buf;
+}
+
+struct Result {
+  std::string isa;
+  std::string bench;
+  std::string name;
+  size_t ops;         // Number of emitter calls.
+  Stats emit;         // Emit (or construction) time.
+  Stats gen;          // generate() time.
+  size_t code_bytes;  // Generated code size.
+  double heap_bytes;  // Live heap bytes per emitter call after the emission.
+  size_t object_bytes;  // sizeof(CodeGenerator).
+  std::string error;    // Reason if the case could not be run (e.g. instructions not supported by the ISA).
+};
+
+// Workloads. Each emits n instructions (emitter calls) into g and is run in the generator's constructor.
+// Registers are the only thing taken from the base class, the emitters are called through g.
+struct Workload : xkon::Registers {
+  // Register-register ALU operations, half of them compressible.
+  template <class G>
+  static void alu(G &g, int n) {
+    for (int i = 0; i < n; i += 8) {
+      g.add(a0, a0, a1);
+      g.sub(s0, s0, a2);
+      g.and_(a3, a3, a4);
+      g.or_(a5, a5, s1);
+      g.xor_(t0, t1, t2);
+      g.sll(t3, t4, t5);
+      g.slt(a6, a7, s2);
+      g.sltu(s3, s4, s5);
+    }
+  }
+
+  // Register-immediate operations.
+  template <class G>
+  static void imm(G &g, int n) {
+    for (int i = 0; i < n; i += 8) {
+      g.addi(a0, a0, 1);
+      g.addi(t0, t1, -1000);
+      g.andi(a1, a1, 15);
+      g.ori(t2, t3, 0x123);
+      g.xori(a2, a3, -1);
+      g.slli(a4, a4, 3);
+      g.srai(s0, s0, 7);
+      g.sltiu(t4, t5, 100);
+    }
+  }
+
+  // Constants of varying width (1 or 2 instructions each).
+  template <class G>
+  static void li(G &g, int n) {
+    xkon::uint32 v = 12345;
+    for (int i = 0; i < n; ++i) {
+      v = v * 1103515245 + 12345;
+      g.li(a0, (i & 1) ? (v & 0x3ff) : v);
+    }
+  }
+
+  // Loads and stores.
+  template <class G>
+  static void mem(G &g, int n) {
+    for (int i = 0; i < n; i += 8) {
+      g.lw(a0, sp(8));
+      g.sw(a1, sp(12));
+      g.lw(a2, s0(4));
+      g.sw(a3, s1(64));
+      g.lbu(t0, t1(-1));
+      g.sb(t2, t3(2000));
+      g.lh(a4, a5(-100));
+      g.sh(t4, t5(6));
+    }
+  }
+
+  // Multiply and divide.
+  template <class G>
+  static void muldiv(G &g, int n) {
+    for (int i = 0; i < n; i += 4) {
+      g.mul(a0, a1, a2);
+      g.mulhu(t0, t1, t2);
+      g.div(a3, a4, a5);
+      g.remu(s2, s3, s4);
+    }
+  }
+
+  // Atomic memory operations.
+  template <class G>
+  static void amo(G &g, int n) {
+    for (int i = 0; i < n; i += 4) {
+      g.lr_w(a0, a1());
+      g.sc_w(a2, a3, a1());
+      g.amoadd_w(t0, t1, a4());
+      g.amoswap_w(s2, s3, a5());
+    }
+  }
+
+  // Floating point arithmetic, conversion and memory access.
+  template <class G>
+  static void fp(G &g, int n) {
+    for (int i = 0; i < n; i += 8) {
+      g.fadd_s(ft0, ft1, ft2);
+      g.fmul_d(fa0, fa1, fa2, G::rne);
+      g.fmadd_s(ft3, ft4, ft5, ft6);
+      g.fsqrt_d(fs0, fs1);
+      g.fcvt_w_s(a0, ft0, G::rtz);
+      g.fcvt_d_w(fa3, a1);
+      g.flw(ft7, sp(8));
+      g.fsd(fs2, s0(16));
+    }
+  }
+
+  // Branches to labels, a label every 8 instructions.
+  template <class G>
+  static void branch(G &g, int n) {
+    char label[32];
+    for (int i = 0; i < n; i += 8) {
+      snprintf(label, sizeof(label), "B%d", i);
+      g.L(label);
+      g.addi(a0, a0, -1);
+      g.bnez(a0, label);
+      g.beq(a1, a2, label);
+      g.blt(t0, t1, label);
+      g.addi(a1, a1, 1);
+      g.bltu(a3, a4, label);
+      g.beqz(a5, label);
+      g.j(label);
+    }
+  }
+
+  // Mix of the above for the generate() latency.
+  template <class G>
+  static void mixed(G &g, int n) {
+    char label[32];
+    for (int i = 0; i < n; i += 8) {
+      snprintf(label, sizeof(label), "M%d", i);
+      g.L(label);
+      g.add(a0, a0, a1);
+      g.addi(t0, t1, 100);
+      g.lw(a2, sp(8));
+      g.sw(a3, s0(4));
+      g.mul(a4, a5, a0);
+      g.fadd_d(fa0, fa1, fa2);
+      g.slli(a1, a1, 2);
+      g.bnez(a0, label);
+    }
+  }
+
+  // A label every other instruction, each branching back 16 labels.
+  template <class G>
+  static void labels(G &g, int n) {
+    char label[32];
+    char target[32];
+    for (int i = 0; i < n; i += 2) {
+      snprintf(label, sizeof(label), "L%d", i);
+      snprintf(target, sizeof(target), "L%d", std::max(0, i - 32));
+      g.L(label);
+      g.addi(a0, a0, 1);
+      g.bne(a0, a1, target);
+    }
+  }
+
+  // Smallest useful function: return 42.
+  template <class G>
+  static void answer(G &g, int) {
+    g.li(a0, 42);
+    g.ret();
+  }
+};
+
+template <Isa isa>
+class Generator : public xkon::CodeGenerator<isa> {
+ public:
+  template <class F>
+  Generator(int n, F f) : xkon::CodeGenerator<isa>(1024 + 16 * n) {
+    f(*this, n);
+  }
+};
+
+// Try the workload once. Returns the reason if the ISA does not support it.
+template <Isa isa, class F>
+std::string probe(int n, F f) {
+  try {
+    Generator<isa> g(n, f);
+    g.template generate<void *>();
+  } catch (const xkon::UnsupportedException &e) {
+    return e.what();
+  }
+  return "";
+}
+
+// threads is the number of encoding threads of generate() (1: sequential).
+template <Isa isa, class F>
+Result measure(const char *isa_name, const char *bench, const std::string &name, int n, F f, int runs, int warmup, int threads = 1) {
+  const Stats zero = Stats{0, 0, 0, 0, 0};
+  const std::string error = probe<isa>(n, f);
+  if (!error.empty()) {
+    return Result{isa_name, bench, name, static_cast<size_t>(n), zero, zero, 0, 0, sizeof(xkon::CodeGenerator<isa>), error};
+  }
+
+  std::vector<double> emit, gen;
+  size_t code_bytes = 0;
+  double heap_bytes = 0;
+
+  for (int i = 0; i < warmup + runs; ++i) {
+    const size_t live = heap_live;
+    const bench_clock::time_point start = bench_clock::now();
+    Generator<isa> *g = new Generator<isa>(n, f);
+    const double t_emit = elapsed(start);
+    heap_bytes = static_cast<double>(heap_live - live - sizeof(Generator<isa>)) / n;
+
+    g->setEncodeThreads(threads);
+    const bench_clock::time_point start_gen = bench_clock::now();
+    g->template generate<void *>();
+    const double t_gen = elapsed(start_gen);
+    code_bytes = g->getCodeSize();
+    delete g;
+
+    if (warmup <= i) {
+      emit.push_back(t_emit);
+      gen.push_back(t_gen);
+    }
+  }
+  return Result{isa_name, bench, name, static_cast<size_t>(n), summarize(emit), summarize(gen), code_bytes, heap_bytes, sizeof(xkon::CodeGenerator<isa>), ""};
+}
+
+template <Isa isa>
+Result measureConstruct(const char *isa_name, int runs, int warmup) {
+  std::vector<double> construct;
+  for (int i = 0; i < warmup + runs; ++i) {
+    const bench_clock::time_point start = bench_clock::now();
+    for (int k = 0; k < 100; ++k) {
+      delete new xkon::CodeGenerator<isa>(64);
+    }
+    if (warmup <= i) {
+      construct.push_back(elapsed(start) / 100);
+    }
+  }
+  const Stats zero = Stats{0, 0, 0, 0, 0};
+  return Result{isa_name, "construct", "empty", 0, summarize(construct), zero, 0, 0, sizeof(xkon::CodeGenerator<isa>), ""};
+}
+
+template <Isa isa>
+Result measureFirst(const char *isa_name, int runs, int warmup) {
+  const Stats zero = Stats{0, 0, 0, 0, 0};
+  const std::string error = probe<isa>(2, Workload::answer<Generator<isa>>);
+  if (!error.empty()) {
+    return Result{isa_name, "first", "answer", 2, zero, zero, 0, 0, sizeof(xkon::CodeGenerator<isa>), error};
+  }
+
+  std::vector<double> first;
+  size_t code_bytes = 0;
+  for (int i = 0; i < warmup + runs; ++i) {
+    const bench_clock::time_point start = bench_clock::now();
+    Generator<isa> g(2, Workload::answer<Generator<isa>>);
+    int (*func)() = g.template generate<int (*)()>();
+#if defined(__riscv)
+    if ((sizeof(void *) == 8) == ((isa & xkon::RV64) != 0) && func() != 42) {
+      fprintf(stderr, "Unexpected result of the generated function\n");
+    }
+#else
+    (void)func;
+#endif
+    const double t = elapsed(start);
+    code_bytes = g.getCodeSize();
+    if (warmup <= i) {
+      first.push_back(t);
+    }
+  }
+  return Result{isa_name, "first", "answer", 2, summarize(first), zero, code_bytes, 0, sizeof(xkon::CodeGenerator<isa>), ""};
+}
+
+template <Isa isa>
+Result measureReuse(const char *isa_name, int runs, int warmup) {
+  const Stats zero = Stats{0, 0, 0, 0, 0};
+  const std::string error = probe<isa>(2, Workload::answer<Generator<isa>>);
+  if (!error.empty()) {
+    return Result{isa_name, "reuse", "answer", 2, zero, zero, 0, 0, sizeof(xkon::CodeGenerator<isa>), error};
+  }
+
+  std::vector<double> first;
+  size_t code_bytes = 0;
+  double heap_bytes = 0;
+  Generator<isa> g(2, Workload::answer<Generator<isa>>);
+  g.template generate<void *>();
+  for (int i = 0; i < warmup + runs; ++i) {
+    const size_t total = heap_total;
+    const bench_clock::time_point start = bench_clock::now();
+    g.reset();
+    Workload::answer(g, 2);
+    int (*func)() = g.template generate<int (*)()>();
+#if defined(__riscv)
+    if ((sizeof(void *) == 8) == ((isa & xkon::RV64) != 0) && func() != 42) {
+      fprintf(stderr, "Unexpected result of the generated function\n");
+    }
+#else
+    (void)func;
+#endif
+    const double t = elapsed(start);
+    heap_bytes = static_cast<double>(heap_total - total);
+    code_bytes = g.getCodeSize();
+    if (warmup <= i) {
+      first.push_back(t);
+    }
+  }
+  return Result{isa_name, "reuse", "answer", 2, summarize(first), zero, code_bytes, heap_bytes, sizeof(xkon::CodeGenerator<isa>), ""};
+}
+
+template <Isa isa>
+void run(const char *isa_name, int runs, int warmup, int max_threads, std::vector<Result> &results) {
+  typedef Generator<isa> G;
+  const int n = 4096;
+  printf("= %s\n", isa_name);
+  fflush(stdout);
+
+  results.push_back(measure<isa>(isa_name, "emit", "alu", n, Workload::alu<G>, runs, warmup));
+  results.push_back(measure<isa>(isa_name, "emit", "imm", n, Workload::imm<G>, runs, warmup));
+  results.push_back(measure<isa>(isa_name, "emit", "li", n, Workload::li<G>, runs, warmup));
+  results.push_back(measure<isa>(isa_name, "emit", "mem", n, Workload::mem<G>, runs, warmup));
+  results.push_back(measure<isa>(isa_name, "emit", "muldiv", n, Workload::muldiv<G>, runs, warmup));
+  results.push_back(measure<isa>(isa_name, "emit", "amo", n, Workload::amo<G>, runs, warmup));
+  results.push_back(measure<isa>(isa_name, "emit", "fp", n, Workload::fp<G>, runs, warmup));
+  results.push_back(measure<isa>(isa_name, "emit", "branch", n, Workload::branch<G>, runs, warmup));
+  for (int size = 64; size <= 16384; size *= 4) {
+    results.push_back(measure<isa>(isa_name, "generate", "mixed" + std::to_string(size), size, Workload::mixed<G>, runs, warmup));
+  }
+  const int large = 1 << 20;
+  for (int threads = 1;; threads = std::min(threads * 2, max_threads)) {
+    const std::string name = "mixed" + std::to_string(large) + "/t" + std::to_string(threads);
+    results.push_back(measure<isa>(isa_name, "parallel", name, large, Workload::mixed<G>, runs, warmup, threads));
+    if (max_threads <= threads) {
+      break;
+    }
+  }
+  results.push_back(measure<isa>(isa_name, "labels", "labels", n, Workload::labels<G>, runs, warmup));
+  results.push_back(measureConstruct<isa>(isa_name, runs, warmup));
+  results.push_back(measureFirst<isa>(isa_name, runs, warmup));
+  results.push_back(measureReuse<isa>(isa_name, runs, warmup));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int runs = 10;
+  int warmup = 1;
+  std::string isas = "RV32G,RV32GC,RV64GC";
+  const char *output = "xkon_bench.json";
+#if XKON_PARALLEL
+  int max_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+#else
+  int max_threads = 1;
+#endif
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      runs = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      warmup = std::max(0, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+      isas = argv[++i];
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      max_threads = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [-n runs] [-w warmup] [-i isas] [-t threads] [-o json]\n", argv[0]);
+      return 1;
+    }
+  }
+  const auto enabled = [&isas](const char *name) { return ("," + isas + ",").find("," + std::string(name) + ",") != std::string::npos; };
+
+  std::vector<Result> results;
+  if (enabled("RV32G")) {
+    run<xkon::RV32G>("RV32G", runs, warmup, max_threads, results);
+  }
+  if (enabled("RV32GC")) {
+    run<xkon::RV32GC>("RV32GC", runs, warmup, max_threads, results);
+  }
+  if (enabled("RV64GC")) {
+    run<xkon::RV64GC>("RV64GC", runs, warmup, max_threads, results);
+  }
+
+  FILE *fp = fopen(output, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Cannot write %s\n", output);
+    return 1;
+  }
+  printf("\n%-7s %-9s %-18s %7s %12s %12s %14s %9s %8s\n", "isa", "bench", "case", "ops", "emit[ns]", "gen[ns]", "ops/s", "code[B]", "heap/op");
+  for (const Result &r : results) {
+    if (!r.error.empty()) {
+      fprintf(fp, "{\"isa\":\"%s\",\"bench\":\"%s\",\"case\":\"%s\",\"error\":\"%s\"}\n", r.isa.c_str(), r.bench.c_str(), r.name.c_str(), r.error.c_str());
+      printf("%-7s %-9s %-18s %s\n", r.isa.c_str(), r.bench.c_str(), r.name.c_str(), r.error.c_str());
+      continue;
+    }
+    const double total = r.emit.median + r.gen.median;
+    const double ops_per_sec = (r.ops != 0 && 0 < total) ? r.ops * 1e9 / total : 0;
+    fprintf(fp,
+            "{\"isa\":\"%s\",\"bench\":\"%s\",\"case\":\"%s\",\"runs\":%d,\"warmup\":%d,\"ops\":%zu,\"emit_ns\":%s,\"generate_ns\":%s,"
+            "\"ops_per_sec\":%.0f,\"code_bytes\":%zu,\"heap_bytes_per_op\":%.1f,\"object_bytes\":%zu}\n",
+            r.isa.c_str(), r.bench.c_str(), r.name.c_str(), runs, warmup, r.ops, json(r.emit).c_str(), json(r.gen).c_str(), ops_per_sec, r.code_bytes,
+            r.heap_bytes, r.object_bytes);
+    printf("%-7s %-9s %-18s %7zu %12.0f %12.0f %14.0f %9zu %8.1f\n", r.isa.c_str(), r.bench.c_str(), r.name.c_str(), r.ops, r.emit.median, r.gen.median,
+           ops_per_sec, r.code_bytes, r.heap_bytes);
+  }
+  fclose(fp);
+  printf("\nResults are written to %s\n", output);
+  return 0;
+}
@@ -0,0 +1,4 @@
+#!/bin/bash
+# Usage: ./xkon_bench.sh [-n runs] [-w warmup] [-i isas] [-o json]
+riscv32-unknown-elf-g++ -O2 xkon_bench.cpp -fno-operator-names -std=c++14 -Wall -march=rv32g -o xkon_bench.out
+spike --isa=rv32gc pk xkon_bench.out "$@"
@@ -0,0 +1,1436 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stack>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "xkon.hpp"
+#include "xkon_async.hpp"
+#include "xkon_cache.hpp"
+#include "xkon_heap.hpp"
+#include "xkon_ir.hpp"
+
+// The tape is reserved with mmap and grown on SIGSEGV where available.
+#if !defined(XKON_BF_GUARDED_TAPE)
+#if defined(__linux__)
+#define XKON_BF_GUARDED_TAPE 1
+#else
+#define XKON_BF_GUARDED_TAPE 0
+#endif
+#endif
+
+#if !defined(__riscv)
+#include "xkon_emu.hpp"
+#endif
+
+#if XKON_BF_GUARDED_TAPE
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+typedef unsigned char uchar;
+typedef void(func_t)(void);
+
+// Buffered I/O area shared by the JIT compiled code and the host.
+// The generated code stores output bytes into `out` and calls flush() only when the buffer is full
+// or the generated code returns. Input is read ahead into `in` a line at a time by fill(),
+// which writes out the pending output first so that a prompt is shown before waiting for input.
+struct BfIO {
+  static const int OUT_SIZE = 256;  // Power of 2, so that a full buffer is detected from the cursor alignment.
+  static const int IN_SIZE = 256;
+
+  alignas(OUT_SIZE) uchar out[OUT_SIZE];
+  uchar in[IN_SIZE];
+  uchar *in_cur;  // Next input byte.
+  uchar *in_end;  // End of the read ahead input.
+
+  BfIO() : in_cur(in), in_end(in) {}
+
+  // The process wide instance, so that read ahead input is not lost between engines.
+  static BfIO &instance() {
+    static BfIO io;
+    return io;
+  }
+
+  // Write out[0..end).
+  static void flush(BfIO *io, uchar *end) { fwrite(io->out, 1, end - io->out, stdout); }
+
+  // Write out[0..out_end) and read ahead input until a newline. Returns the end of the input read into `in`.
+  static uchar *fill(BfIO *io, uchar *out_end) {
+    flush(io, out_end);
+    uchar *p = io->in;
+    *p++ = static_cast<uchar>(wait());
+    while (p[-1] != '\n' && p < io->in + IN_SIZE) {
+      const int ch = getchar();
+      if (ch == EOF) {
+        break;
+      }
+      *p++ = static_cast<uchar>(ch);
+    }
+    io->in_cur = io->in;
+    io->in_end = p;
+    return p;
+  }
+
+  // Read a byte, waiting for input at EOF. stdout is flushed first, so that a prompt is visible.
+  static int wait() {
+    fflush(stdout);
+    while (true) {
+      int ch = getchar();
+      if (ch != EOF) return ch;
+    }
+  }
+};
+
+static void put(int ch) { putchar(ch); }
+static int getch(void) {
+  // Consume the input read ahead by the JIT compiled code first.
+  BfIO &io = BfIO::instance();
+  if (io.in_cur < io.in_end) {
+    return *io.in_cur++;
+  }
+  return BfIO::wait();
+}
+
+// Throw std::invalid_argument unless every '[' in src[0..len) has a matching ']'.
+// All engines check the program first, as the compilers rely on balanced brackets for the jump targets.
+static void checkBrackets(const char *src, size_t len) {
+  std::vector<size_t> open;
+  for (size_t i = 0; i < len; ++i) {
+    if (src[i] == '[') {
+      open.push_back(i);
+    } else if (src[i] == ']') {
+      if (open.empty()) {
+        throw std::invalid_argument("unmatched ']' at " + std::to_string(i));
+      }
+      open.pop_back();
+    }
+  }
+  if (!open.empty()) {
+    throw std::invalid_argument("unmatched '[' at " + std::to_string(open.back()));
+  }
+}
+
+// BF tape (memory cells).
+// With XKON_BF_GUARDED_TAPE, RESERVE_SIZE bytes of address space are reserved as inaccessible
+// and only the first INITIAL_SIZE bytes after a guard page are made accessible.
+// An access past the accessible part raises SIGSEGV, and the handler makes more pages accessible
+// and restarts the access, so neither the interpreter nor the JIT compiled code check bounds.
+// The page before cell 0 and the last page of the reservation are never made accessible.
+// Otherwise the tape is a fixed buffer of INITIAL_SIZE bytes without bounds checks.
+class BfTape {
+  BfTape(const BfTape &);
+  void operator=(const BfTape &);
+
+ public:
+  static const size_t INITIAL_SIZE = 64 * 1024;
+  static const size_t RESERVE_SIZE = 64 * 1024 * 1024;
+
+ private:
+  uchar *base;  // Cell 0.
+  size_t size;  // Accessible bytes from base.
+
+#if XKON_BF_GUARDED_TAPE
+  uchar *reserved;  // Start of the reservation (the lower guard page).
+  size_t page;
+  BfTape *next;  // List of live tapes searched by the signal handler.
+
+  static BfTape *&tapes() {
+    static BfTape *head = NULL;
+    return head;
+  }
+
+  // Handler before the tape handler was installed.
+  static struct sigaction &previous() {
+    static struct sigaction sa;
+    return sa;
+  }
+
+  static void install() {
+    static bool installed = false;
+    if (installed) {
+      return;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = onFault;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, &previous());
+    installed = true;
+  }
+
+  static void onFault(int, siginfo_t *info, void *) {
+    uchar *addr = static_cast<uchar *>(info->si_addr);
+    for (BfTape *t = tapes(); t != NULL; t = t->next) {
+      if (t->grow(addr)) {
+        return;
+      }
+    }
+    // Not a tape access (or a guard page). Restore the previous handler and let the access fault again.
+    sigaction(SIGSEGV, &previous(), NULL);
+  }
+
+  // Make the tape accessible up to addr. Returns false if addr is not in the growable part of the tape.
+  bool grow(uchar *addr) {
+    uchar *const limit = reserved + RESERVE_SIZE - page;
+    if (addr < base + size || limit <= addr) {
+      return false;
+    }
+    size_t n = size;
+    while (base + n <= addr) {
+      n *= 2;
+    }
+    n = std::min(n, static_cast<size_t>(limit - base));
+    if (mprotect(base + size, n - size, PROT_READ | PROT_WRITE) != 0) {
+      return false;
+    }
+    size = n;
+    return true;
+  }
+
+ public:
+  BfTape() : base(NULL), size(INITIAL_SIZE), reserved(NULL), page(sysconf(_SC_PAGESIZE)), next(NULL) {
+    void *p = mmap(NULL, RESERVE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    XKON_ASSERT(p != MAP_FAILED);
+    reserved = static_cast<uchar *>(p);
+    base = reserved + page;
+    const int r = mprotect(base, size, PROT_READ | PROT_WRITE);
+    XKON_ASSERT(r == 0);
+    (void)r;
+
+    install();
+    next = tapes();
+    tapes() = this;
+  }
+
+  ~BfTape() {
+    for (BfTape **t = &tapes(); *t != NULL; t = &(*t)->next) {
+      if (*t == this) {
+        *t = next;
+        break;
+      }
+    }
+    munmap(reserved, RESERVE_SIZE);
+  }
+
+  // Clear all cells. The pages are dropped and read as zero again on the next access.
+  void reset() { madvise(base, size, MADV_DONTNEED); }
+#else
+ public:
+  BfTape() : base(static_cast<uchar *>(calloc(INITIAL_SIZE, 1))), size(INITIAL_SIZE) { XKON_ASSERT(base != NULL); }
+  ~BfTape() { free(base); }
+
+  // Clear all cells.
+  void reset() { memset(base, 0, size); }
+#endif
+
+  // Pointer to cell 0. Does not change when the tape grows.
+  uchar *data() const { return base; }
+  // Number of accessible cells.
+  size_t capacity() const { return size; }
+  // Number of cells the tape can grow to.
+#if XKON_BF_GUARDED_TAPE
+  size_t limit() const { return RESERVE_SIZE - 2 * page; }
+#else
+  size_t limit() const { return size; }
+#endif
+};
+
+// Calls JIT compiled code.
+// On RISC-V hosts the code is called directly. On other hosts it runs on xkon::emu::Emulator,
+// and the code and the tape must be registered with map() while the code is used.
+// Host addresses embedded in the code must be translated by address() (after map() for the tape).
+class BfNative {
+  BfNative(const BfNative &);
+  void operator=(const BfNative &);
+
+#if defined(__riscv)
+ public:
+  BfNative() {}
+
+  static xkon::addr_t address(const void *p) { return reinterpret_cast<xkon::addr_t>(p); }
+
+  void map(const void *, size_t) {}
+  void unmap(const void *) {}
+  void call(func_t *f) { f(); }
+  void call(void (*f)(uchar *), uchar *p) { f(p); }
+  uchar *call(uchar *(*f)(uchar *), uchar *p) { return f(p); }
+#else
+  typedef xkon::emu::Emulator<32> Machine;
+
+  std::vector<const void *> mapped;
+
+  // The emulator shared by all engines, with the BF I/O routines bound.
+  static Machine &machine() {
+    static Machine *m = NULL;
+    if (m == NULL) {
+      m = new Machine();
+      m->bind(put);
+      m->bind(getch);
+      m->bind(BfIO::flush);
+      m->bind(BfIO::fill);
+      m->map(&BfIO::instance(), sizeof(BfIO));
+    }
+    return *m;
+  }
+
+ public:
+  // Address of p in the code, i.e. the guest address in the emulator.
+  static xkon::addr_t address(const void *p) { return machine().guest(p); }
+
+  BfNative() : mapped() {}
+  ~BfNative() {
+    for (const void *p : mapped) {
+      machine().unmap(p);
+    }
+  }
+
+  void map(const void *p, size_t size) {
+    machine().map(p, size);
+    mapped.push_back(p);
+  }
+  void unmap(const void *p) {
+    machine().unmap(p);
+    mapped.erase(std::find(mapped.begin(), mapped.end(), p));
+  }
+
+  void call(func_t *f) { machine().call((const void *)f); }
+  void call(void (*f)(uchar *), uchar *p) { machine().call((const void *)f, {machine().guest(p)}); }
+  uchar *call(uchar *(*f)(uchar *), uchar *p) {
+    Machine &m = machine();
+    return m.ptr<uchar>(m.call((const void *)f, {m.guest(p)}));
+  }
+#endif
+};
+
+// Code generation of BF commands shared by BfJIT and BfLoopJIT.
+// Register usage
+// a0 : Temporary for memory access & function argument/result.
+// a1-a5 : Cached cells.
+// t0-t2 : Temporary for loop idioms. t1 is also the return address of the shared I/O slow paths.
+// s1 : BF memory pointer (the BF pointer is s1 + off between loop boundaries).
+// s2 : Output cursor in BfIO::out.
+// s3 : Input cursor in BfIO::in.
+// s5 : End of the read ahead input in BfIO::in.
+class BfCodeGen : public xkon::CodeGenerator<xkon::RV32GC> {
+  void operator=(const BfCodeGen &);
+
+  // Cell kept in a register.
+  struct Cell {
+    int offset;     // Offset from s1.
+    int reg;        // Register index.
+    bool dirty;     // Modified and not written back yet.
+    unsigned used;  // Last access time for LRU replacement.
+  };
+
+  static const int CACHE_REG = 11;  // a1
+  static const int CACHE_NUM = 5;   // a1-a5
+
+  BfIO &io;
+  std::string io_label;  // Prefix of the labels of the shared I/O slow paths.
+  int label_count;
+  int off;                  // Virtual pointer offset from s1.
+  std::vector<Cell> cells;  // Cached cells.
+  unsigned clock;           // Access time counter for cells.
+
+  std::string getLabel() {
+    char buf[16];
+    sprintf(buf, ".L%d", label_count++);
+    return buf;
+  }
+
+  static bool isSint12(int v) { return -2048 <= v && v < 2048; }
+
+  // Find the cached cell at s1 + offset.
+  Cell *findCell(int offset) {
+    for (auto &c : cells) {
+      if (c.offset == offset) {
+        c.used = ++clock;
+        return &c;
+      }
+    }
+    return NULL;
+  }
+
+  // Register holding the cell at s1 + offset, loading it if not cached.
+  // If load is false, the cell is going to be overwritten and is not loaded.
+  Cell &cell(int offset, bool load = true) {
+    Cell *c = findCell(offset);
+    if (c != NULL) {
+      return *c;
+    }
+
+    int reg = CACHE_REG + static_cast<int>(cells.size());
+    if (CACHE_NUM <= static_cast<int>(cells.size())) {
+      // Replace the least recently used cell.
+      auto lru = std::min_element(cells.begin(), cells.end(), [](const Cell &a, const Cell &b) { return a.used < b.used; });
+      writeBack(*lru);
+      reg = lru->reg;
+      cells.erase(lru);
+    }
+    if (load) {
+      lbu(xkon::intReg(reg), s1[offset]);
+    }
+    cells.push_back(Cell{offset, reg, false, ++clock});
+    return cells.back();
+  }
+
+  void writeBack(Cell &c) {
+    if (c.dirty) {
+      sb(xkon::intReg(c.reg), s1[c.offset]);
+      c.dirty = false;
+    }
+  }
+
+  // Write back all cached cells and forget them.
+  // Used before function calls (a1-a5 are caller-saved) and at loop edges.
+  void flush() {
+    for (auto &c : cells) {
+      writeBack(c);
+    }
+    cells.clear();
+  }
+
+  // Apply the virtual pointer offset to s1.
+  void materialize() {
+    flush();
+    if (isSint12(off)) {
+      if (off != 0) {
+        addi(s1, s1, off);
+      }
+    } else {
+      li(t0, off);
+      add(s1, s1, t0);
+    }
+    off = 0;
+  }
+
+  // Move the BF pointer.
+  void move(int count) {
+    off += count;
+    if (!isSint12(off)) {
+      materialize();
+    }
+  }
+
+  // Slow path of '.' (bf_flush) or ',' (bf_fill) shared by the function, entered by `jal t1, label`.
+  // Calls the host I/O routine func(&io, s2) and resets the output cursor (and the input cursors for bf_fill).
+  // a1-a5 are caller-saved, so the cached cells are kept on the stack across the call
+  // and the cache state is the same whether the slow path is taken or not.
+  void ioStub(const std::string &label, bool fill) {
+    L(label.c_str());
+    addi(sp, sp, -32);
+    sw(t1, sp[0]);
+    for (int i = 0; i < CACHE_NUM; ++i) {
+      sw(xkon::intReg(CACHE_REG + i), sp[4 + 4 * i]);
+    }
+    la(a0, "bf_io");
+    mv(a1, s2);
+    callSymbol(fill ? "bf_fill" : "bf_flush");
+    if (fill) {
+      mv(s5, a0);
+      la(s3, "bf_io", offsetof(BfIO, in));
+    }
+    la(s2, "bf_io", offsetof(BfIO, out));
+    for (int i = 0; i < CACHE_NUM; ++i) {
+      lw(xkon::intReg(CACHE_REG + i), sp[4 + 4 * i]);
+    }
+    lw(t1, sp[0]);
+    addi(sp, sp, 32);
+    jr(t1);
+  }
+
+  // Compile the loop src[0..] ("[...]") without looping if it is one of the idioms below.
+  //   [-] [+]            : Clear the cell.
+  //   [->+<] [->++>+++<<] : Add multiples of the cell to other cells and clear the cell (balanced move loop).
+  //   [>] [<]            : Scan for a zero cell.
+  // Returns the number of characters of the loop, or 0 if the loop is not an idiom.
+  size_t idiom(const char *src, const char *end) {
+    std::map<int, int> delta;
+    int offset = 0;
+    const size_t n = simpleLoop(src, end, delta, offset);
+    if (n == 0) {
+      return 0;
+    }
+
+    if (delta.empty() && (offset == 1 || offset == -1)) {
+      materialize();
+      scan(offset);
+      return n;
+    }
+
+    // The loop is executed (-cell / step) times, where step is +1 or -1.
+    const int step = sext8(delta[0]);
+    if (offset != 0 || (step != 1 && step != -1)) {
+      return 0;
+    }
+    for (auto &e : delta) {
+      if (!isSint12(off + e.first)) {
+        return 0;
+      }
+    }
+
+    // The cells are accessed through the cache, so they are written back at the next loop edge or I/O point.
+    bool move = false;
+    for (auto &e : delta) {
+      move |= e.first != 0 && sext8(e.second) != 0;
+    }
+    const xkon::IntReg src_reg = xkon::intReg(cell(off, move).reg);
+    for (auto &e : delta) {
+      const int factor = sext8(e.second * -step);
+      if (e.first == 0 || factor == 0) {
+        continue;
+      }
+      // Pin the source cell so that it is not replaced while loading the destination cell.
+      findCell(off);
+      Cell &dst = cell(off + e.first);
+      const xkon::IntReg r = xkon::intReg(dst.reg);
+      if (factor == 1) {
+        add(r, r, src_reg);
+      } else if (factor == -1) {
+        sub(r, r, src_reg);
+      } else {
+        li(t1, factor);
+        mul(t1, src_reg, t1);
+        add(r, r, t1);
+      }
+      dst.dirty = true;
+    }
+    Cell &c = cell(off, move);
+    li(xkon::intReg(c.reg), 0);
+    c.dirty = true;
+    return n;
+  }
+
+  // Scan for a zero cell in the direction dir (+1 or -1).
+  // Cells are checked one by one until the pointer reaches the word boundary,
+  // then a word at a time using "(x - 0x01010101) & ~x & 0x80808080" which is non zero if x has a zero byte.
+  // The word loads never cross the word containing the current cell.
+  void scan(int dir) {
+    const std::string l = getLabel();
+
+    // Byte loop until the pointer reaches the word boundary.
+    L((l + "B").c_str());
+    lbu(a0, s1[0]);
+    beqz(a0, (l + "E").c_str());
+    addi(s1, s1, dir);
+    andi(t0, s1, 3);
+    if (dir < 0) {
+      xori(t0, t0, 3);
+    }
+    bnez(t0, (l + "B").c_str());
+
+    // Word loop.
+    li(t1, 0x01010101);
+    slli(t2, t1, 7);
+    L((l + "W").c_str());
+    lw(t0, s1[(dir < 0) ? -3 : 0]);
+    sub(a0, t0, t1);
+    not_(t0, t0);
+    and_(a0, a0, t0);
+    and_(a0, a0, t2);
+    bnez(a0, (l + "F").c_str());
+    addi(s1, s1, 4 * dir);
+    j((l + "W").c_str());
+
+    // Byte loop in the word containing a zero cell.
+    L((l + "F").c_str());
+    lbu(a0, s1[0]);
+    beqz(a0, (l + "E").c_str());
+    addi(s1, s1, dir);
+    j((l + "F").c_str());
+    L((l + "E").c_str());
+  }
+
+ protected:
+  // Host addresses are referenced through relocations, so the code can be copied and fixed up with relocate().
+  explicit BfCodeGen(size_t size) : xkon::CodeGenerator<xkon::RV32GC>(size), io(BfIO::instance()), io_label(), label_count(0), off(0), cells(), clock(0) {
+    for (const auto &e : hostSymbols()) {
+      defineSymbol(e.first.c_str(), e.second);
+    }
+  }
+
+ public:
+  // Host addresses referenced from the generated code, except bf_tape defined by each engine.
+  static xkon::SymbolTable hostSymbols() {
+    xkon::SymbolTable symbols;
+    symbols["bf_io"] = BfNative::address(&BfIO::instance());
+    symbols["bf_flush"] = BfNative::address((const void *)BfIO::flush);
+    symbols["bf_fill"] = BfNative::address((const void *)BfIO::fill);
+    return symbols;
+  }
+
+  // Code buffer size enough for len BF commands, also used by the other engines and the benchmark.
+  // A command takes up to about 40 bytes, since the slow paths of '.' and ',' are shared by the function.
+  static size_t bufferSize(size_t len) { return 1024 + 64 * len; }
+  static size_t bufferSize(const char *src) { return bufferSize(strlen(src)); }
+
+  // Parse the loop src[0..] ("[...]") if it only contains + - > <.
+  // delta is the increment of each cell per iteration and offset is the pointer movement per iteration,
+  // both relative to the pointer at loop entry.
+  // Returns the number of characters of the loop, or 0 if the loop contains other commands.
+  static size_t simpleLoop(const char *src, const char *end, std::map<int, int> &delta, int &offset) {
+    delta.clear();
+    offset = 0;
+    const char *p = src + 1;
+    for (; p < end && *p != ']'; ++p) {
+      switch (*p) {
+        case '+':
+          delta[offset]++;
+          break;
+        case '-':
+          delta[offset]--;
+          break;
+        case '>':
+          offset++;
+          break;
+        case '<':
+          offset--;
+          break;
+        default:
+          return 0;
+      }
+    }
+    return (p == end) ? 0 : static_cast<size_t>(p - src + 1);
+  }
+
+  // Sign extend the lower 8 bits.
+  static int sext8(int v) { return static_cast<signed char>(v & 0xff); }
+
+ protected:
+  // Load the I/O cursors only if used in src[0..len).
+  // The output cursor is also loaded for ',', as bf_fill writes out the pending output.
+  void loadIO(const char *src, size_t len) {
+    const bool out = memchr(src, '.', len) != NULL;
+    const bool in = memchr(src, ',', len) != NULL;
+    if (out || in) {
+      io_label = getLabel();
+      la(s2, "bf_io", offsetof(BfIO, out));
+    }
+    if (in) {
+      la(t0, "bf_io");
+      lw(s3, t0[offsetof(BfIO, in_cur)]);
+      lw(s5, t0[offsetof(BfIO, in_end)]);
+    }
+  }
+
+  // Flush the output and save the input cursor before returning to the host,
+  // followed by the slow paths of '.' and ',' (jumped over).
+  // Must be called after body() with the same src[0..len) as loadIO().
+  void closeIO(const char *src, size_t len) {
+    const bool out = memchr(src, '.', len) != NULL;
+    const bool in = memchr(src, ',', len) != NULL;
+    if (!out && !in) {
+      return;
+    }
+    const std::string l = getLabel();
+    if (out) {
+      andi(t0, s2, BfIO::OUT_SIZE - 1);
+      beqz(t0, (l + "F").c_str());
+      jal(t1, (io_label + "O").c_str());
+      L((l + "F").c_str());
+    }
+    if (in) {
+      la(t0, "bf_io");
+      sw(s3, t0[offsetof(BfIO, in_cur)]);
+      sw(s5, t0[offsetof(BfIO, in_end)]);
+    }
+    j((l + "E").c_str());
+    if (out) {
+      ioStub(io_label + "O", false);
+    }
+    if (in) {
+      ioStub(io_label + "I", true);
+    }
+    L((l + "E").c_str());
+  }
+
+  // Compile BF commands src[0..len).
+  // Pointer movement is deferred to the loop boundaries and cells are accessed as off(s1).
+  // At the end, cached cells are written back and s1 points to the BF pointer.
+  // The generated code is tagged with the position in src of the command (see getSourceMap()).
+  void body(const char *src, size_t len) {
+    checkBrackets(src, len);
+
+    // [ and ] command nesting management stack.
+    std::stack<std::string> par;
+
+    // Variables for optimize command repeat.
+    char code = '\0'; // Unprocessed command character code.
+    int count = 0; // Count unprocessed command 
+    const char *run = src; // First command of the unprocessed repeat.
+
+    // JIT compile main loop
+    for (const char *p = src;; ++p) {
+      // 最後の命令の読み出し後にコンパイル未完了な命令がcode/countに残る可能性があるので
+      // for文内でループを抜けず、未処理の命令の処理が終わるタイミングでbreakする
+      const char c = (p < src + len) ? *p : '\0';
+
+      // Generate optimized code.
+      if (c != code && (0 < count && code != '\0')) {
+        setSource(static_cast<xkon::uint32>(run - src));
+        switch (code) {
+          case '>':
+            move(count);
+            break;
+          case '<':
+            move(-count);
+            break;
+          case '+':
+          case '-': {
+            Cell &cl = cell(off);
+            const int n = sext8((code == '+') ? count : -count);
+            if (n != 0) {
+              addi(xkon::intReg(cl.reg), xkon::intReg(cl.reg), n);
+              cl.dirty = true;
+            }
+            break;
+          }
+        }
+        code = '\0';
+        count = 0;
+      }
+
+      // Check main loop is ended.
+      if (c == '\0') {
+        break;
+      }
+
+      // Read command.
+      if (c != code) {
+        run = p;
+      }
+      switch (c) {
+        case '<':
+        case '>':
+        case '+':
+        case '-':
+          code = c;
+          count++;
+          break;
+        case '[': {
+          setSource(static_cast<xkon::uint32>(p - src));
+          // Compile loop idioms into straight-line code.
+          const size_t n = idiom(p, src + len);
+          if (n != 0) {
+            p += n - 1;
+            break;
+          }
+
+          std::string l = getLabel();
+          par.push(l);
+
+          materialize();
+          L((l + "B").c_str());
+          // The loop body may be longer than the range of a conditional branch.
+          beqzRelaxed(xkon::intReg(cell(0).reg), (l + "E").c_str());
+          break;
+        }
+        case ']': {
+          setSource(static_cast<xkon::uint32>(p - src));
+          std::string l = par.top();
+          par.pop();
+          materialize();
+          j((l + "B").c_str());
+          L((l + "E").c_str());
+
+          // The loop exit is only reached from the check at the loop head,
+          // where the cell has been loaded into the first cache register.
+          cells.push_back(Cell{0, CACHE_REG, false, ++clock});
+          break;
+        }
+        case '.': {
+          setSource(static_cast<xkon::uint32>(p - src));
+          // Store into the output buffer and flush it when the cursor reaches the end (aligned to OUT_SIZE).
+          const std::string l = getLabel();
+          sb(xkon::intReg(cell(off).reg), s2[0]);
+          addi(s2, s2, 1);
+          andi(t0, s2, BfIO::OUT_SIZE - 1);
+          bnez(t0, (l + "P").c_str());
+          jal(t1, (io_label + "O").c_str());
+          L((l + "P").c_str());
+          break;
+        }
+        case ',': {
+          setSource(static_cast<xkon::uint32>(p - src));
+          // Read from the input buffer and read ahead when it is empty.
+          const std::string l = getLabel();
+          Cell &cl = cell(off, false);
+          bne(s3, s5, (l + "G").c_str());
+          jal(t1, (io_label + "I").c_str());
+          L((l + "G").c_str());
+          lbu(xkon::intReg(cl.reg), s3[0]);
+          addi(s3, s3, 1);
+          cl.dirty = true;
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+    setSource(xkon::SourceMap::NO_SOURCE);
+    materialize();
+  }
+};
+
+class BfJIT : public BfCodeGen {
+  void operator=(const BfJIT &);
+
+  BfTape tape;
+  BfNative native;
+  func_t *jit;
+
+ public:
+  // size = 0 sizes the code buffer from src.
+  BfJIT(const char *src, size_t size = 0) : BfCodeGen((size != 0) ? size : bufferSize(src)), tape(), native(), jit(NULL) {
+    native.map(tape.data(), tape.limit());
+
+    // Save only the registers actually written below to stack area.
+    Frame frame = prologue();
+
+    defineSymbol("bf_tape", BfNative::address(tape.data()));
+    la(s1, "bf_tape");
+    loadIO(src, strlen(src));
+    body(src, strlen(src));
+    closeIO(src, strlen(src));
+
+    // Restore register from stack area.
+    epilogue(frame);
+    ret();
+  }
+
+  void gen() {
+    this->jit = this->generate<void (*)(void)>();
+    native.map((const void *)jit, getCodeSize());
+  }
+
+  void exec() {
+    tape.reset();
+    native.call(jit);
+  }
+
+  // Position in src of the command which generated the instruction at pc, or -1.
+  long sourcePosition(const void *pc) const {
+    const xkon::uint32 id = sourceOf(pc);
+    return (id != xkon::SourceMap::NO_SOURCE) ? static_cast<long>(id) : -1;
+  }
+};
+
+// JIT with the persistent code cache.
+// The code compiled by BfJIT is stored in dir, and later runs of the same program (also in other processes)
+// map the stored code and only fix up the host addresses instead of compiling.
+// If the cache cannot be written, the code compiled in this run is used.
+class BfCachedJIT {
+  BfCachedJIT(const BfCachedJIT &);
+  void operator=(const BfCachedJIT &);
+
+  BfTape tape;
+  BfNative native;
+  std::unique_ptr<xkon::cache::CodeCache> cache;
+  std::unique_ptr<xkon::cache::CachedCode> cached;
+  std::unique_ptr<BfJIT> compiled;
+  func_t *jit;
+
+ public:
+  BfCachedJIT(const char *src, const char *dir) : tape(), native(), cache(new xkon::cache::CodeCache(dir)), cached(), compiled(), jit(NULL) {
+    native.map(tape.data(), tape.limit());
+    xkon::SymbolTable symbols = BfCodeGen::hostSymbols();
+    symbols["bf_tape"] = BfNative::address(tape.data());
+    const uint64_t key = xkon::cache::Hash().add(std::string("BfJIT")).add(std::string(src)).value();
+
+    cached = cache->load<xkon::RV32GC>(key, symbols);
+    if (!cached) {
+      compiled.reset(new BfJIT(src));
+      compiled->gen();
+      if (cache->store(key, *compiled)) {
+        cached = cache->load<xkon::RV32GC>(key, symbols);
+      }
+    }
+    if (cached) {
+      compiled.reset();
+      jit = (func_t *)cached->getCode();
+      native.map((const void *)jit, cached->getCodeSize());
+    }
+  }
+
+  // True if the code was loaded from the cache or stored into it.
+  bool isCached() const { return cached != nullptr; }
+
+  size_t getCodeSize() const { return cached ? cached->getCodeSize() : compiled->getCodeSize(); }
+
+  void exec() {
+    if (cached) {
+      tape.reset();
+      native.call(jit);
+    } else {
+      compiled->exec();
+    }
+  }
+};
+
+// BF bytecode with run-length operands and precomputed jump targets, shared by Bf and BfTiered.
+// run() dispatches the bytecode with threaded code (computed goto) on GCC/Clang.
+class BfBytecode {
+ public:
+  enum OpCode {
+    OpAdd,   // Add arg to the cell.
+    OpMove,  // Add arg to the pointer.
+    OpJz,    // Jump to arg if the cell is zero ('[').
+    OpJnz,   // Jump to arg if the cell is not zero (']').
+    OpPut,   // Output the cell.
+    OpGet,   // Input to the cell.
+    OpEnd,   // End of the program.
+  };
+
+  struct Insn {
+    OpCode op;
+    int arg;
+  };
+
+ private:
+  std::vector<Insn> code;
+  std::vector<size_t> pos;  // Position in the source of each instruction.
+
+  void push(OpCode op, int arg, const char *src, const char *p) {
+    code.push_back(Insn{op, arg});
+    pos.push_back(p - src);
+  }
+
+  // Loop hooks of run() for plain interpretation.
+  struct NoLoops {
+    bool enter(size_t, uchar *&) { return false; }
+    bool back(size_t) { return false; }
+  };
+
+ public:
+  explicit BfBytecode(const char *src) : code(), pos() {
+    checkBrackets(src, strlen(src));
+
+    // [ and ] command nesting management stack.
+    std::stack<size_t> par;
+
+    for (const char *p = src; *p != '\0'; ++p) {
+      switch (*p) {
+        case '+':
+        case '-': {
+          const char *first = p;
+          int n = 0;
+          for (; *p == '+' || *p == '-'; ++p) {
+            n += (*p == '+') ? 1 : -1;
+          }
+          --p;
+          if ((n & 0xff) != 0) {
+            push(OpAdd, n & 0xff, src, first);
+          }
+          break;
+        }
+        case '>':
+        case '<': {
+          const char *first = p;
+          int n = 0;
+          for (; *p == '>' || *p == '<'; ++p) {
+            n += (*p == '>') ? 1 : -1;
+          }
+          --p;
+          if (n != 0) {
+            push(OpMove, n, src, first);
+          }
+          break;
+        }
+        case '[':
+          par.push(code.size());
+          push(OpJz, 0, src, p);
+          break;
+        case ']': {
+          // Both jump to the instruction after the opposite bracket.
+          const size_t head = par.top();
+          par.pop();
+          code[head].arg = static_cast<int>(code.size() + 1);
+          push(OpJnz, static_cast<int>(head + 1), src, p);
+          break;
+        }
+        case '.':
+          push(OpPut, 0, src, p);
+          break;
+        case ',':
+          push(OpGet, 0, src, p);
+          break;
+        default:
+          break;
+      }
+    }
+    push(OpEnd, 0, src, src);
+  }
+
+  const std::vector<Insn> &insns() const { return code; }
+  // Position in the source of the instruction i.
+  size_t position(size_t i) const { return pos[i]; }
+  // Size of the bytecode in bytes.
+  size_t size() const { return code.size() * sizeof(Insn); }
+
+  // Interpret the bytecode with the pointer p.
+  // At a loop head (OpJz at index i), loops.enter(i, p) may run the whole loop and return true with p moved to the cell
+  // at the loop exit. When a loop iterates (OpJnz jumping back to the loop starting at i), loops.back(i) returns true
+  // to enter the loop again at its head (so that enter() is called), or false to continue with the loop body.
+  template <class Loops>
+  void run(uchar *p, Loops &loops) const {
+    const Insn *const base = &code[0];
+    const Insn *pc = base;
+
+#if defined(__GNUC__)
+    // Handler addresses in the order of OpCode.
+    static void *const handlers[] = {&&op_add, &&op_move, &&op_jz, &&op_jnz, &&op_put, &&op_get, &&op_end};
+#define BF_DISPATCH() goto *handlers[pc->op]
+
+    BF_DISPATCH();
+  op_add:
+    *p += pc->arg;
+    ++pc;
+    BF_DISPATCH();
+  op_move:
+    p += pc->arg;
+    ++pc;
+    BF_DISPATCH();
+  op_jz:
+    if (loops.enter(pc - base, p)) {
+      pc = base + pc->arg;
+    } else {
+      pc = (*p == 0) ? base + pc->arg : pc + 1;
+    }
+    BF_DISPATCH();
+  op_jnz:
+    if (*p != 0) {
+      pc = base + pc->arg;
+      if (loops.back(pc - 1 - base)) {
+        --pc;
+      }
+    } else {
+      ++pc;
+    }
+    BF_DISPATCH();
+  op_put:
+    put(*p);
+    ++pc;
+    BF_DISPATCH();
+  op_get:
+    *p = getch();
+    ++pc;
+    BF_DISPATCH();
+  op_end:
+    return;
+#undef BF_DISPATCH
+#else
+    while (true) {
+      switch (pc->op) {
+        case OpAdd:
+          *p += pc->arg;
+          ++pc;
+          break;
+        case OpMove:
+          p += pc->arg;
+          ++pc;
+          break;
+        case OpJz:
+          if (loops.enter(pc - base, p)) {
+            pc = base + pc->arg;
+          } else {
+            pc = (*p == 0) ? base + pc->arg : pc + 1;
+          }
+          break;
+        case OpJnz:
+          if (*p != 0) {
+            pc = base + pc->arg;
+            if (loops.back(pc - 1 - base)) {
+              --pc;
+            }
+          } else {
+            ++pc;
+          }
+          break;
+        case OpPut:
+          put(*p);
+          ++pc;
+          break;
+        case OpGet:
+          *p = getch();
+          ++pc;
+          break;
+        case OpEnd:
+          return;
+      }
+    }
+#endif
+  }
+
+  void run(uchar *p) const {
+    NoLoops loops;
+    run(p, loops);
+  }
+};
+
+// Implement as interpreter.
+// The source is compiled into bytecode with run-length operands and precomputed jump targets,
+// and the bytecode is dispatched with threaded code (computed goto) on GCC/Clang.
+class Bf {
+  BfBytecode code;
+  BfTape tape;
+
+public:
+  Bf(const char *src) : code(src), tape() {
+  }
+
+  // Size of the bytecode in bytes.
+  size_t codeSize() const { return code.size(); }
+
+  void exec() {
+    tape.reset();
+    code.run(tape.data());
+  }
+};
+
+// Implement as JIT compiler through the SSA IR.
+// Unlike BfJIT, the pointer is passed to the generated function as argument.
+// Pointer movement and cell updates are left to the IR optimizer,
+// which folds them into offset addressing and removes redundant loads/stores.
+// Clear and multiply-move loops are built as straight-line code and output goes through the BfIO buffer,
+// as in BfJIT. Scan loops stay byte loops, and cells are only forwarded within a block.
+class BfIR : public xkon::CodeGenerator<xkon::RV32GC> {
+  void operator=(const BfIR &);
+
+  typedef void(ir_func_t)(uchar *);
+
+  BfTape tape;
+  BfNative native;
+  ir_func_t *jit;
+  size_t ir_size;
+
+  // Start a new block, so that the values used after the following calls live across blocks
+  // and are assigned callee-saved registers.
+  static void split(xkon::ir::Function &f) {
+    xkon::ir::Block *b = f.newBlock();
+    f.br(b);
+    f.setBlock(b);
+  }
+
+ public:
+  // Build IR of BF commands src[0..len) starting with the pointer p.
+  // The output is written out before returning. Returns the pointer after the commands.
+  static xkon::ir::Value *build(xkon::ir::Function &f, xkon::ir::Value *p, const char *src, size_t len) {
+    using xkon::ir::Block;
+    using xkon::ir::Value;
+
+    checkBrackets(src, len);
+    const xkon::addr_t io = BfNative::address(&BfIO::instance());
+    const xkon::addr_t out = BfNative::address(BfIO::instance().out);
+    const xkon::addr_t flush = BfNative::address((const void *)BfIO::flush);
+
+    // [ and ] command nesting management stack.
+    struct Loop {
+      Block *head;
+      Block *exit;
+      Value *ptr;
+      Value *cur;
+    };
+    std::stack<Loop> loops;
+
+    // Output cursor in BfIO::out, carried through the loops like the pointer.
+    const bool io_used = memchr(src, '.', len) != NULL || memchr(src, ',', len) != NULL;
+    Value *cur = io_used ? f.iconst(out) : NULL;
+
+    const char *end = src + len;
+    for (const char *c = src; c < end; ++c) {
+      switch (*c) {
+        case '+':
+        case '-':
+        case '>':
+        case '<': {
+          // Optimize command repeat.
+          const char code = *c;
+          int count = 1;
+          while (c + 1 < end && c[1] == code) {
+            ++c;
+            ++count;
+          }
+          if (code == '+' || code == '-') {
+            Value *v = f.load8(p);
+            f.store8(f.add(v, f.iconst(code == '+' ? count : -count)), p);
+          } else {
+            p = f.add(p, f.iconst(code == '>' ? count : -count));
+          }
+          break;
+        }
+        case '[': {
+          // Clear and multiply-move loops: add multiples of the cell to other cells and clear the cell.
+          std::map<int, int> delta;
+          int offset = 0;
+          const size_t n = BfCodeGen::simpleLoop(c, end, delta, offset);
+          const int step = BfCodeGen::sext8(delta[0]);
+          if (n != 0 && offset == 0 && (step == 1 || step == -1)) {
+            Value *v = f.load8(p);
+            for (auto &e : delta) {
+              const int factor = BfCodeGen::sext8(e.second * -step);
+              if (e.first == 0 || factor == 0) {
+                continue;
+              }
+              Value *q = f.add(p, f.iconst(e.first));
+              f.store8(f.add(f.load8(q), f.mul(v, f.iconst(factor))), q);
+            }
+            f.store8(f.iconst(0), p);
+            c += n - 1;
+            break;
+          }
+
+          Block *from = f.block();
+          Block *head = f.newBlock();
+          Block *body = f.newBlock();
+          Block *exit = f.newBlock();
+          f.br(head);
+
+          f.setBlock(head);
+          Value *ph = f.phi();
+          f.incoming(ph, p, from);
+          Value *ch = NULL;
+          if (cur != NULL) {
+            ch = f.phi();
+            f.incoming(ch, cur, from);
+          }
+          f.bnez(f.load8(ph), body, exit);
+
+          f.setBlock(body);
+          p = ph;
+          cur = ch;
+          loops.push(Loop{head, exit, ph, ch});
+          break;
+        }
+        case ']': {
+          Loop l = loops.top();
+          loops.pop();
+          f.incoming(l.ptr, p, f.block());
+          if (cur != NULL) {
+            f.incoming(l.cur, cur, f.block());
+          }
+          f.br(l.head);
+
+          // Place the exit block after the loop body.
+          f.place(l.exit);
+          f.setBlock(l.exit);
+          p = l.ptr;
+          cur = l.cur;
+          break;
+        }
+        case '.': {
+          // Store into the output buffer and flush it when the cursor reaches the end (aligned to OUT_SIZE).
+          f.store8(f.load8(p), cur);
+          Value *next = f.add(cur, f.iconst(1));
+          Block *from = f.block();
+          Block *full = f.newBlock();
+          Block *join = f.newBlock();
+          f.bnez(f.and_(next, f.iconst(BfIO::OUT_SIZE - 1)), join, full);
+
+          f.setBlock(full);
+          f.call(flush, {f.iconst(io), next});
+          Value *reset = f.iconst(out);
+          f.br(join);
+
+          f.setBlock(join);
+          cur = f.phi();
+          f.incoming(cur, next, from);
+          f.incoming(cur, reset, full);
+          break;
+        }
+        case ',':
+          // Write out the pending output first, so that a prompt is shown before waiting for input.
+          split(f);
+          f.call(flush, {f.iconst(io), cur});
+          cur = f.iconst(out);
+          f.store8(f.call(BfNative::address((const void *)getch)), p);
+          break;
+        default:
+          break;
+      }
+    }
+    if (cur != NULL) {
+      split(f);
+      f.call(flush, {f.iconst(io), cur});
+    }
+    return p;
+  }
+
+  // size = 0 sizes the code buffer from src.
+  BfIR(const char *src, size_t size = 0) : xkon::CodeGenerator<xkon::RV32GC>((size != 0) ? size : BfCodeGen::bufferSize(src)), tape(), native(), jit(NULL), ir_size(0) {
+    native.map(tape.data(), tape.limit());
+    xkon::ir::Function f;
+    build(f, f.arg(0), src, strlen(src));
+    f.ret();
+    f.optimize();
+    ir_size = f.size();
+    xkon::ir::lower(f, *this);
+  }
+
+  // Number of IR instructions after optimization.
+  size_t irSize() const { return ir_size; }
+
+  void gen() {
+    this->jit = this->generate<ir_func_t *>();
+    native.map((const void *)jit, getCodeSize());
+  }
+
+  void exec() {
+    tape.reset();
+    native.call(jit, tape.data());
+  }
+};
+
+// Baseline tier of BfTiered.
+// Compiles one loop src[0..len) ("[...]") into a function which takes the pointer,
+// runs the loop until it exits and returns the pointer.
+class BfLoopJIT : public BfCodeGen {
+  void operator=(const BfLoopJIT &);
+
+ public:
+  BfLoopJIT(const char *src, size_t len) : BfCodeGen(bufferSize(len)) {
+    Frame frame = prologue();
+
+    mv(s1, a0);
+    loadIO(src, len);
+
+    L(".head");
+    lbu(a0, s1[0]);
+    // The loop body may be longer than the range of a conditional branch.
+    beqzRelaxed(a0, ".exit");
+    body(src + 1, len - 2);
+    j(".head");
+    L(".exit");
+    closeIO(src, len);
+
+    mv(a0, s1);
+    epilogue(frame);
+    ret();
+  }
+};
+
+// Implement as tiered execution: bytecode interpreter -> baseline JIT.
+// Starts in the bytecode interpreter of Bf and counts loop iterations at ']'.
+// Loops iterated BASELINE_THRESHOLD times are compiled by BfLoopJIT, whole loops including the nested ones,
+// so a hot outer loop runs in compiled code from its head to its exit.
+// The BF machine state is only the pointer and the program counter,
+// so the interpreter enters compiled code at the loop head ('[') even in the middle of the loop.
+// With compile threads, the loops are compiled in the background into a shared code heap
+// and the interpreter keeps running until the entry of the loop is published.
+// Loops are not recompiled through the SSA IR (BfIR), as its code is not faster than the baseline code.
+class BfTiered {
+  void operator=(const BfTiered &);
+  friend class BfBytecode;
+
+  typedef uchar *(loop_func_t)(uchar *);
+
+  // Per loop state, indexed by the bytecode index of '['.
+  struct Loop {
+    unsigned long hits;  // Number of iterations executed in the interpreter.
+    bool requested;      // Compilation requested (the entry may not be published yet).
+    std::shared_ptr<BfLoopJIT> code;
+  };
+
+  const char *src;
+  BfBytecode code;
+  std::vector<Loop> loops;
+  std::unique_ptr<std::atomic<loop_func_t *>[]> funcs;  // Entry of the compiled loop, indexed by the bytecode index of '['.
+  BfTape tape;
+  BfNative native;
+  std::atomic<int> compiled;  // Number of compiled loops.
+  std::unique_ptr<xkon::heap::CodeHeap> heap;
+  std::unique_ptr<xkon::async::CompileQueue> queue;  // Destroyed first, the workers use the members above.
+
+  // Compile the loop starting at the bytecode index head.
+  void promote(size_t head) {
+    Loop &l = loops[head];
+    l.requested = true;
+    const size_t first = code.position(head);
+    const size_t n = code.position(code.insns()[head].arg - 1) - first + 1;
+    const char *loop = &src[first];
+    if (queue) {
+      queue->submit([loop, n]() { return std::unique_ptr<BfLoopJIT>(new BfLoopJIT(loop, n)); }, &funcs[head], NULL,
+                    [this](loop_func_t *) { compiled++; });
+      return;
+    }
+    std::shared_ptr<BfLoopJIT> g = std::make_shared<BfLoopJIT>(loop, n);
+    funcs[head] = g->generate<loop_func_t *>();
+    l.code = g;
+    native.map((const void *)funcs[head].load(), g->getCodeSize());
+    compiled++;
+  }
+
+  // Loop hooks of BfBytecode::run().
+  // Run the loop at the bytecode index head in compiled code if published.
+  bool enter(size_t head, uchar *&p) {
+    loop_func_t *f = funcs[head].load(std::memory_order_acquire);
+    if (f == NULL) {
+      return false;
+    }
+    p = native.call(f, p);
+    return true;
+  }
+
+  // Count an iteration of the loop at head, and enter the compiled code at the loop head once published.
+  bool back(size_t head) {
+    Loop &l = loops[head];
+    if (!l.requested) {
+      if (++l.hits < BASELINE_THRESHOLD) {
+        return false;
+      }
+      promote(head);
+    }
+    return funcs[head].load(std::memory_order_acquire) != NULL;
+  }
+
+ public:
+  static const unsigned long BASELINE_THRESHOLD = 64;
+  static const size_t HEAP_SIZE = 4 << 20; // Code heap of the background compilation.
+
+  // compileThreads = 0 compiles on the executing thread when a loop becomes hot.
+  BfTiered(const char *src, int compileThreads = 0)
+      : src(src), code(src), loops(code.insns().size(), Loop{0, false, nullptr}), funcs(new std::atomic<loop_func_t *>[code.insns().size()]), tape(), native(), compiled(0), heap(), queue() {
+    native.map(tape.data(), tape.limit());
+    for (size_t i = 0; i < code.insns().size(); ++i) {
+      funcs[i] = NULL;
+    }
+    if (0 < compileThreads) {
+      heap.reset(new xkon::heap::CodeHeap(HEAP_SIZE));
+      native.map(heap->getMemory(), heap->getCapacity());
+      queue.reset(new xkon::async::CompileQueue(compileThreads, heap.get()));
+    }
+  }
+
+  // Number of loops compiled by the baseline JIT.
+  int compiledLoops() const { return compiled; }
+
+  // Total size of the compiled loops in bytes.
+  size_t codeSize() const {
+    if (queue) {
+      return queue->getCodeSize();
+    }
+    size_t n = 0;
+    for (const Loop &l : loops) {
+      if (l.code) {
+        n += l.code->getCodeSize();
+      }
+    }
+    return n;
+  }
+
+  void exec() {
+    tape.reset();
+    code.run(tape.data(), *this);
+  }
+};
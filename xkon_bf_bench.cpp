@@ -0,0 +1,257 @@
+// BF benchmark suite.
+//
+// Usage: bench.out [-n runs] [-w warmup] [-e engines] [-c dir] [-j threads] [-o json] [file.b ...]
+//   -n runs    : Number of measured runs per program and engine (default 5).
+//   -w warmup  : Number of unmeasured runs before the measurement (default 1).
+//   -e engines : Comma separated list of interp,jit,ir,tiered,async,cache (default all but cache).
+//   -c dir     : Code cache directory of the cache engine (default /tmp).
+//   -j threads : Compile threads of the async engine (default 2).
+//   -o json    : Output file of the results in JSON (default bf_bench.json).
+//   file.b     : Additional programs.
+//
+// The built-in workloads include xkon_mandel.b, xkon_hanoi.b and xkon_factor.b of the current directory
+// (the repository root, next to this file); missing ones are skipped. They were written for this benchmark
+// and are not the well-known mandelbrot.b, hanoi.b and factor.b, which can be passed as file.b.
+//
+// For each program and engine, compile time, run time and code size are measured,
+// and the median and percentiles are written one JSON object per line.
+// Compile time is the construction of the engine (and code generation for JIT engines).
+// BfTiered compiles during the run, so its compile time is only the bytecode compilation.
+// The async engine is BfTiered compiling in background threads while the interpreter keeps running.
+// The cache engine stores the code in the first (warmup) run, so its compile time is loading the cached code.
+#define DEBUG 0
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "xkon_bf.hpp"
+
+namespace {
+
+struct Program {
+  std::string name;
+  std::string src;
+};
+
+bool load(const char *path, Program &prog) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::stringstream ss;
+  ss << in.rdbuf();
+  prog.src.clear();
+  for (char c : ss.str()) {
+    if (strchr("+-<>[].,", c) != NULL) {
+      prog.src += c;
+    }
+  }
+  const char *base = strrchr(path, '/');
+  prog.name = (base != NULL) ? base + 1 : path;
+  return true;
+}
+
+// Built-in workloads.
+std::vector<Program> builtins() {
+  std::vector<Program> list;
+  list.push_back(Program{"hello",
+                         "++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++..+++.>>.<-.<.+++.------.--------.>>+.>++."});
+  // bench.b: Prints "ZYXWVUTSRQPONMLKJIHGFEDCBA" with 10^7 clear loops per letter.
+  list.push_back(Program{"bench",
+                         ">++[<+++++++++++++>-]<[[>+>+<<-]>[<+>-]++++++++"
+                         "[>++++++++<-]>.[-]<<>++++++++++[>++++++++++[>++"
+                         "++++++++[>++++++++++[>++++++++++[>++++++++++[>+"
+                         "+++++++++[-]<-]<-]<-]<-]<-]<-]<-]++++++++++."});
+  // Long nested loops with moves in the innermost loop.
+  list.push_back(Program{"loops", "++++++++[>++++++++[>++++++++[>++++++++[>++++++++[>+>++<<-]<-]<-]<-]<-]>>>>>>[-]++++++++++."});
+  // xkon_mandel.b: Fixed point arithmetic in deep loop nests (80x25 ASCII art, 32 iterations per point).
+  // xkon_hanoi.b: Recursion with a frame per level on the tape (16 disks).
+  // xkon_factor.b: Trial division of 2 to 255 with many short loops and output.
+  for (const char *path : {"xkon_mandel.b", "xkon_hanoi.b", "xkon_factor.b"}) {
+    Program p;
+    if (load(path, p)) {
+      list.push_back(p);
+    }
+  }
+  return list;
+}
+
+// Elapsed time in nanoseconds.
+typedef std::chrono::steady_clock bench_clock;
+double elapsed(bench_clock::time_point start) { return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count(); }
+
+// Cycle counter (0 if not available).
+unsigned long long cycles() {
+#if defined(__riscv)
+  unsigned long c;
+  asm volatile("rdcycle %0" : "=r"(c));
+  return c;
+#else
+  return 0;
+#endif
+}
+
+struct Stats {
+  double median, p10, p90, min, max;
+};
+
+Stats summarize(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  const auto pct = [&v](double q) { return v[static_cast<size_t>(q * (v.size() - 1) + 0.5)]; };
+  return Stats{pct(0.5), pct(0.1), pct(0.9), v.front(), v.back()};
+}
+
+std::string json(const Stats &s) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), "{\"median\":%.0f,\"p10\":%.0f,\"p90\":%.0f,\"min\":%.0f,\"max\":%.0f}", s.median, s.p10, s.p90, s.min, s.max);
+  return buf;
+}
+
+struct Result {
+  std::string program;
+  std::string engine;
+  Stats compile;
+  Stats run;
+  Stats run_cycles;
+  size_t code_bytes;
+};
+
+// Engine adapters. The code buffers are sized from the source by BfCodeGen::bufferSize().
+Bf *create(const Program &p, Bf *) { return new Bf(p.src.c_str()); }
+BfJIT *create(const Program &p, BfJIT *) {
+  BfJIT *e = new BfJIT(p.src.c_str());
+  e->gen();
+  return e;
+}
+BfIR *create(const Program &p, BfIR *) {
+  BfIR *e = new BfIR(p.src.c_str());
+  e->gen();
+  return e;
+}
+BfTiered *create(const Program &p, BfTiered *) { return new BfTiered(p.src.c_str()); }
+int compileThreads = 2;
+struct BfAsyncTiered : BfTiered {
+  BfAsyncTiered(const char *src) : BfTiered(src, compileThreads) {}
+};
+BfAsyncTiered *create(const Program &p, BfAsyncTiered *) { return new BfAsyncTiered(p.src.c_str()); }
+const char *cacheDir = "/tmp";
+BfCachedJIT *create(const Program &p, BfCachedJIT *) { return new BfCachedJIT(p.src.c_str(), cacheDir); }
+
+size_t codeSize(const Bf &e) { return e.codeSize(); }
+size_t codeSize(const BfJIT &e) { return e.getCodeSize(); }
+size_t codeSize(const BfIR &e) { return e.getCodeSize(); }
+size_t codeSize(const BfTiered &e) { return e.codeSize(); }
+size_t codeSize(const BfCachedJIT &e) { return e.getCodeSize(); }
+
+template <class Engine>
+Result measure(const Program &prog, const char *engine, int runs, int warmup) {
+  std::vector<double> compile, run, run_cycles;
+
+  for (int i = 0; i < warmup + runs; ++i) {
+    const bench_clock::time_point start = bench_clock::now();
+    Engine *e = create(prog, static_cast<Engine *>(NULL));
+    const double t = elapsed(start);
+    delete e;
+    if (warmup <= i) {
+      compile.push_back(t);
+    }
+  }
+
+  Engine *e = create(prog, static_cast<Engine *>(NULL));
+  for (int i = 0; i < warmup + runs; ++i) {
+    const unsigned long long c = cycles();
+    const bench_clock::time_point start = bench_clock::now();
+    e->exec();
+    const double t = elapsed(start);
+    if (warmup <= i) {
+      run.push_back(t);
+      run_cycles.push_back(static_cast<double>(cycles() - c));
+    }
+  }
+  // BfTiered's code size is known after the run.
+  const size_t size = codeSize(*e);
+  delete e;
+
+  return Result{prog.name, engine, summarize(compile), summarize(run), summarize(run_cycles), size};
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int runs = 5;
+  int warmup = 1;
+  std::string engines = "interp,jit,ir,tiered,async";
+  const char *output = "bf_bench.json";
+  std::vector<Program> programs = builtins();
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      runs = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      warmup = std::max(0, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+      engines = argv[++i];
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      cacheDir = argv[++i];
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      compileThreads = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else {
+      Program p;
+      if (!load(argv[i], p)) {
+        fprintf(stderr, "Cannot read %s\n", argv[i]);
+        return 1;
+      }
+      programs.push_back(p);
+    }
+  }
+  const auto enabled = [&engines](const char *name) { return ("," + engines + ",").find("," + std::string(name) + ",") != std::string::npos; };
+
+  std::vector<Result> results;
+  for (const Program &p : programs) {
+    printf("==================================================================================================\n");
+    printf("= %s\n", p.name.c_str());
+    fflush(stdout);
+    if (enabled("interp")) {
+      results.push_back(measure<Bf>(p, "interp", runs, warmup));
+    }
+    if (enabled("jit")) {
+      results.push_back(measure<BfJIT>(p, "jit", runs, warmup));
+    }
+    if (enabled("ir")) {
+      results.push_back(measure<BfIR>(p, "ir", runs, warmup));
+    }
+    if (enabled("tiered")) {
+      results.push_back(measure<BfTiered>(p, "tiered", runs, warmup));
+    }
+    if (enabled("async")) {
+      results.push_back(measure<BfAsyncTiered>(p, "async", runs, warmup));
+    }
+    if (enabled("cache")) {
+      results.push_back(measure<BfCachedJIT>(p, "cache", runs, warmup));
+    }
+    printf("\n");
+  }
+
+  FILE *fp = fopen(output, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Cannot write %s\n", output);
+    return 1;
+  }
+  printf("\n%-14s %-8s %14s %14s %14s %10s\n", "program", "engine", "compile[ns]", "run[ns]", "run p90[ns]", "code[B]");
+  for (const Result &r : results) {
+    fprintf(fp, "{\"program\":\"%s\",\"engine\":\"%s\",\"runs\":%d,\"warmup\":%d,\"compile_ns\":%s,\"run_ns\":%s,\"run_cycles\":%s,\"code_bytes\":%zu}\n",
+            r.program.c_str(), r.engine.c_str(), runs, warmup, json(r.compile).c_str(), json(r.run).c_str(), json(r.run_cycles).c_str(), r.code_bytes);
+    printf("%-14s %-8s %14.0f %14.0f %14.0f %10zu\n", r.program.c_str(), r.engine.c_str(), r.compile.median, r.run.median, r.run.p90, r.code_bytes);
+  }
+  fclose(fp);
+  printf("\nResults are written to %s\n", output);
+  return 0;
+}
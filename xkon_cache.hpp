@@ -0,0 +1,405 @@
+#pragma once
+
+/**
+ * 生成したコードのディスクキャッシュ
+ *
+ * generate() 後の命令列・エクスポートした関数・リロケーション情報をファイルに保存し、
+ * 次回の起動時はファイルを読み込んで relocate() するだけで、命令生成を行わずに実行できるようにする。
+ *
+ * * キーは生成器の入力(ソースコードや生成オプション等)から Hash で計算した値を呼び出し側で与える。
+ *   ファイル名はキーと ISA から決まり、読込み時にヘッダのキー・ISA・形式のバージョン・チェックサムを検証する。
+ *   検証に失敗したファイルやリロケーションを解決できないファイルは無視する(load() が nullptr を返す)。
+ * * 外部のアドレスはすべて la()/callSymbol() で外部シンボルとして参照すること。
+ *   li() 等で命令に直接埋め込んだアドレスは、保存したプロセスのアドレスのまま実行されてしまう。
+ * * mmap が使える環境ではファイルを MAP_PRIVATE で割り当て、リロケーション適用後に実行可能にする。
+ *   使えない環境(riscv32-unknown-elf 等)ではファイル全体を読み込んだメモリ領域で実行する。
+ *
+ * 例:
+ *   cache::CodeCache cache("/tmp/xkon");
+ *   const uint64_t key = cache::Hash().add(src).value();
+ *   std::unique_ptr<cache::CachedCode> c = cache.load<RV32GC>(key, symbols);
+ *   if (!c) {
+ *     ... 命令生成 ...
+ *     g.generate<void*>();
+ *     cache.store(key, g);
+ *     c = cache.load<RV32GC>(key, symbols);
+ *   }
+ *   auto f = c->getFunction<int (*)(int)>("f");
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "xkon.hpp"
+
+#ifndef XKON_CACHE_MMAP
+#if defined(__unix__) || defined(__APPLE__)
+#define XKON_CACHE_MMAP 1
+#else
+#define XKON_CACHE_MMAP 0
+#endif
+#endif
+
+#if XKON_CACHE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace xkon {
+namespace cache {
+
+/// キャッシュファイルの形式のバージョン
+/// ファイルの形式や生成する命令列が変わる変更をしたら上げる
+const uint32 VERSION = 1;
+
+/// キャッシュのキー計算用のハッシュ関数(FNV-1a 64ビット)
+class Hash {
+  uint64_t h;
+
+ public:
+  Hash() : h(0xcbf29ce484222325ull) {}
+
+  Hash& add(const void* data, std::size_t size) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+      h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return *this;
+  }
+  Hash& add(const std::string& s) { return add(s.data(), s.size()).add(static_cast<uint64_t>(s.size())); }
+  Hash& add(uint64_t v) {
+    unsigned char buf[8];
+    for (int i = 0; i < 8; ++i) {
+      buf[i] = static_cast<unsigned char>(v >> (8 * i));
+    }
+    return add(buf, sizeof(buf));
+  }
+
+  uint64_t value() const { return h; }
+};
+
+/// キャッシュファイルのヘッダ
+/// ヘッダの後にメタデータ(エクスポートとリロケーション)、codeOffset から命令列が続く
+struct FileHeader {
+  char magic[8];        ///< "XKONCODE"
+  uint32 version;       ///< VERSION
+  uint32 isa;           ///< CodeGenerator のテンプレート引数の Isa
+  uint32 xlen;          ///< GOT のスロットのビット数
+  uint32 reserved;
+  uint64_t key;         ///< 生成器の入力のハッシュ値
+  uint64_t metaSize;    ///< メタデータのバイト数
+  uint64_t codeOffset;  ///< ファイルの先頭から命令列までのバイト数(CODE_ALIGN の倍数)
+  uint64_t codeSize;    ///< 命令列のバイト数
+  uint64_t checksum;    ///< メタデータと命令列の Hash の値
+};
+
+/// ファイル内の命令列の配置境界(ページ単位で実行可能にできるように)
+const uint64_t CODE_ALIGN = 4096;
+
+/**
+ * キャッシュから読み込んだコード
+ * 破棄するとコードの領域も解放する
+ */
+class CachedCode {
+  CachedCode(const CachedCode&);
+  void operator=(const CachedCode&);
+
+  char* image;           ///< ファイル全体を割り当てた領域
+  std::size_t imageSize;
+  bool mapped;           ///< image が mmap した領域
+  char* code;
+  std::size_t codeSize;
+  std::map<std::string, addr_t> exports;  ///< 関数名から命令列の先頭からのオフセット
+  std::vector<Relocation> relocs;
+
+  friend class CodeCache;
+
+  CachedCode() : image(nullptr), imageSize(0), mapped(false), code(nullptr), codeSize(0), exports(), relocs() {}
+
+ public:
+  ~CachedCode() {
+#if XKON_CACHE_MMAP
+    if (mapped) {
+      munmap(image, imageSize);
+      return;
+    }
+#endif
+    delete[] image;
+  }
+
+  const char* getCode() const { return code; }
+  std::size_t getCodeSize() const { return codeSize; }
+  const std::vector<Relocation>& getRelocations() const { return relocs; }
+
+  /// エクスポートした関数の先頭アドレス。無ければ nullptr
+  template <typename T>
+  T getFunction(const char* name) const {
+    const auto itr = exports.find(name);
+    return (itr == exports.end()) ? nullptr : (T)(code + itr->second);
+  }
+};
+
+/**
+ * ディレクトリ dir 以下のキャッシュファイルの読み書き
+ */
+class CodeCache {
+  std::string dir;
+
+  // メタデータのシリアライズ
+  static void put32(std::string& out, uint32 v) { out.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+  static void put64(std::string& out, uint64_t v) { out.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+  static void putStr(std::string& out, const std::string& s) {
+    put32(out, static_cast<uint32>(s.size()));
+    out.append(s);
+  }
+
+  // メタデータのデシリアライズ(範囲外を読もうとしたら false を返す)
+  class Reader {
+    const char* p;
+    const char* end;
+
+   public:
+    Reader(const char* p, std::size_t size) : p(p), end(p + size) {}
+    bool get32(uint32& v) { return read(&v, sizeof(v)); }
+    bool get64(uint64_t& v) { return read(&v, sizeof(v)); }
+    bool getStr(std::string& s) {
+      uint32 n;
+      if (!get32(n) || static_cast<std::size_t>(end - p) < n) {
+        return false;
+      }
+      s.assign(p, n);
+      p += n;
+      return true;
+    }
+
+   private:
+    bool read(void* v, std::size_t n) {
+      if (static_cast<std::size_t>(end - p) < n) {
+        return false;
+      }
+      memcpy(v, p, n);
+      p += n;
+      return true;
+    }
+  };
+
+  static Hash checksum(const char* meta, std::size_t metaSize, const char* code, std::size_t codeSize) {
+    Hash h;
+    h.add(meta, metaSize);
+    h.add(code, codeSize);
+    return h;
+  }
+
+  // ファイル全体を割り当てた領域を返す
+  static bool mapFile(const std::string& path, CachedCode& c) {
+#if XKON_CACHE_MMAP
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FileHeader))) {
+      close(fd);
+      return false;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    c.image = static_cast<char*>(p);
+    c.imageSize = st.st_size;
+    c.mapped = true;
+    return true;
+#else
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+      return false;
+    }
+    std::vector<char> buf;
+    char tmp[4096];
+    std::size_t n;
+    while ((n = fread(tmp, 1, sizeof(tmp), fp)) != 0) {
+      buf.insert(buf.end(), tmp, tmp + n);
+    }
+    fclose(fp);
+    if (buf.size() < sizeof(FileHeader)) {
+      return false;
+    }
+    c.image = new char[buf.size()];
+    c.imageSize = buf.size();
+    memcpy(c.image, buf.data(), buf.size());
+    return true;
+#endif
+  }
+
+  // 命令列を実行可能にする。できなければ false
+  static bool protect(CachedCode& c) {
+#if XKON_CACHE_MMAP
+    if (c.mapped) {
+      const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+      const uintptr_t begin = reinterpret_cast<uintptr_t>(c.code) & ~(page - 1);
+      const uintptr_t end = reinterpret_cast<uintptr_t>(c.image) + c.imageSize;
+      if (mprotect(reinterpret_cast<void*>(begin), end - begin, PROT_READ | PROT_EXEC) != 0) {
+        return false;
+      }
+    }
+#endif
+    __builtin___clear_cache(c.code, c.code + c.codeSize);
+    return true;
+  }
+
+ public:
+  explicit CodeCache(const std::string& dir) : dir(dir) {}
+
+  /// key と isa のキャッシュファイルのパス
+  std::string path(uint64_t key, Isa isa) const {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/%016llx-%x.xkc", static_cast<unsigned long long>(key), static_cast<unsigned int>(isa));
+    return dir + buf;
+  }
+
+  /**
+   * generate() 済みの g の命令列を key で保存する
+   * 書込み途中のファイルを他のプロセスが読まないように、一時ファイルに書いてから置き換える
+   */
+  template <Isa isa>
+  bool store(uint64_t key, const CodeGenerator<isa>& g) const {
+    std::string meta;
+    const std::map<std::string, const void*> symbols = g.getSymbols();
+    put32(meta, static_cast<uint32>(symbols.size()));
+    for (const auto& e : symbols) {
+      putStr(meta, e.first);
+      put64(meta, static_cast<const char*>(e.second) - g.getCode());
+    }
+    put32(meta, static_cast<uint32>(g.getRelocations().size()));
+    for (const auto& r : g.getRelocations()) {
+      put32(meta, r.type);
+      put64(meta, r.offset);
+      put64(meta, static_cast<uint64_t>(r.addend));
+      putStr(meta, r.symbol);
+    }
+
+    FileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "XKONCODE", sizeof(h.magic));
+    h.version = VERSION;
+    h.isa = isa;
+    h.xlen = ((isa & RV64) != 0) ? 64 : 32;
+    h.key = key;
+    h.metaSize = meta.size();
+    h.codeOffset = (sizeof(h) + meta.size() + CODE_ALIGN - 1) & ~(CODE_ALIGN - 1);
+    h.codeSize = g.getCodeSize();
+    h.checksum = checksum(meta.data(), meta.size(), g.getCode(), g.getCodeSize()).value();
+
+#if XKON_CACHE_MMAP
+    const std::string tmp = path(key, isa) + "." + std::to_string(getpid());
+#else
+    const std::string tmp = path(key, isa) + ".tmp";
+#endif
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (fp == nullptr) {
+      return false;
+    }
+    const std::vector<char> pad(h.codeOffset - sizeof(h) - meta.size(), 0);
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    ok = ok && fwrite(meta.data(), 1, meta.size(), fp) == meta.size();
+    ok = ok && fwrite(pad.data(), 1, pad.size(), fp) == pad.size();
+    ok = ok && fwrite(g.getCode(), 1, g.getCodeSize(), fp) == g.getCodeSize();
+    ok = (fclose(fp) == 0) && ok;
+    ok = ok && rename(tmp.c_str(), path(key, isa).c_str()) == 0;
+    if (!ok) {
+      remove(tmp.c_str());
+    }
+    return ok;
+  }
+
+  /**
+   * key のコードを読み込み、symbols で外部シンボルを解決して実行できる状態にして返す
+   * ファイルが無い・検証に失敗した・未定義のシンボルがある場合は nullptr を返す
+   */
+  template <Isa isa>
+  std::unique_ptr<CachedCode> load(uint64_t key, const SymbolTable& symbols) const {
+    std::unique_ptr<CachedCode> c(new CachedCode());
+    if (!mapFile(path(key, isa), *c)) {
+      return nullptr;
+    }
+
+    // ヘッダの検証
+    FileHeader h;
+    memcpy(&h, c->image, sizeof(h));
+    if (memcmp(h.magic, "XKONCODE", sizeof(h.magic)) != 0 || h.version != VERSION || h.isa != static_cast<uint32>(isa) || h.key != key) {
+      return nullptr;
+    }
+    if (h.metaSize > c->imageSize - sizeof(h) || h.codeOffset < sizeof(h) + h.metaSize || h.codeOffset % CODE_ALIGN != 0 ||
+        h.codeOffset > c->imageSize || h.codeSize != c->imageSize - h.codeOffset) {
+      return nullptr;
+    }
+    const char* meta = c->image + sizeof(h);
+    c->code = c->image + h.codeOffset;
+    c->codeSize = h.codeSize;
+    if (checksum(meta, h.metaSize, c->code, c->codeSize).value() != h.checksum) {
+      return nullptr;
+    }
+
+    // メタデータの読込み
+    Reader in(meta, h.metaSize);
+    uint32 n;
+    if (!in.get32(n)) {
+      return nullptr;
+    }
+    for (uint32 i = 0; i < n; ++i) {
+      std::string name;
+      uint64_t offset;
+      if (!in.getStr(name) || !in.get64(offset) || c->codeSize <= offset) {
+        return nullptr;
+      }
+      c->exports[name] = offset;
+    }
+    if (!in.get32(n)) {
+      return nullptr;
+    }
+    for (uint32 i = 0; i < n; ++i) {
+      uint32 type;
+      uint64_t offset, addend;
+      std::string symbol;
+      if (!in.get32(type) || !in.get64(offset) || !in.get64(addend) || !in.getStr(symbol) || RelocGotSlot < type) {
+        return nullptr;
+      }
+      // 修正する範囲が命令列に収まること(offset + バイト数は桁あふれしうるので引き算で比べる)
+      const uint64_t bytes = (type == RelocGotSlot) ? h.xlen / 8 : 8;
+      if (c->codeSize < offset || c->codeSize - offset < bytes) {
+        return nullptr;
+      }
+      c->relocs.push_back(Relocation{static_cast<RelocType>(type), offset, symbol, static_cast<addrdiff_t>(addend)});
+    }
+
+    // リロケーションの適用
+    if (!isResolvable(c->relocs, symbols)) {
+      return nullptr;
+    }
+    relocate(c->code, reinterpret_cast<addr_t>(c->code), c->relocs, symbols, h.xlen);
+    if (!protect(*c)) {
+      return nullptr;
+    }
+#if XKON_PERF
+    if (perf::Log::instance().enabled()) {
+      std::vector<std::string> names;
+      for (const auto& e : c->exports) {
+        names.push_back(e.first);
+      }
+      perf::Log::instance().codeLoad(c->code, perf::functions(c->code, c->codeSize, names, c->exports), h.xlen);
+    }
+#endif
+    return c;
+  }
+};
+
+}  // namespace cache
+}  // namespace xkon
@@ -0,0 +1,634 @@
+#pragma once
+
+/**
+ * 生成したコードの ELF ファイルへの出力
+ *
+ * generate() 後の CodeGenerator の命令列を、アセンブラを通さずに RISC-V の ELF ファイルとして書き出す。
+ * RV32 は ELF32、RV64 は ELF64 で出力する。
+ *
+ * * リロケータブルオブジェクト(ObjectFile)
+ *   命令列を .text に、エクスポートした関数を大域シンボル(STT_FUNC)に、
+ *   外部シンボルを未定義シンボルにして、リロケーション情報を .rela.text に出力する。
+ *   RelocHi20Lo12 は R_RISCV_HI20/R_RISCV_LO12_I、RelocPcrelHi20Lo12 は R_RISCV_PCREL_HI20/R_RISCV_PCREL_LO12_I
+ *   (auipc の位置にローカルシンボル .Lpcrel_hiN を定義する)、RelocGotSlot は R_RISCV_32/R_RISCV_64 になる。
+ * * 共有オブジェクト(SharedObject)
+ *   dlopen() できる最小限の構成(.hash/.dynsym/.dynstr/.rela.dyn/.text/.dynamic)で出力する。
+ *   外部シンボルは GOT のスロットの動的リロケーションでしか解決できないので、
+ *   RelocGot 以外のリロケーションがある場合は UnsupportedException を発生させる。
+ *   GOT のスロットは .text の末尾にあるため、ロード可能なセグメントは1つで読み書き実行可能とする。
+ *
+ * 例:
+ *   g.setRelocMode(RelocGot);
+ *   g.function("f");
+ *   ... 命令生成 ...
+ *   g.generate<void*>();
+ *   elf::save("f.so", g, elf::SharedObject, "f.so");
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "xkon.hpp"
+
+namespace xkon {
+namespace elf {
+
+/// 出力するファイルの種類
+enum FileType {
+  ObjectFile,    ///< ET_REL
+  SharedObject,  ///< ET_DYN
+};
+
+/// e_flags に記録する浮動小数点の呼出し規約(リンカは異なる ABI のファイルを結合しない)
+enum FloatAbi {
+  FloatAbiSoft,    ///< 浮動小数点数を整数レジスタで渡す(ilp32/lp64)
+  FloatAbiSingle,  ///< float を浮動小数点レジスタで渡す(ilp32f/lp64f)
+  FloatAbiDouble,  ///< float/double を浮動小数点レジスタで渡す(ilp32d/lp64d)
+};
+
+namespace internal {
+
+// ELF の定数(必要なもののみ)
+enum {
+  ET_REL = 1,
+  ET_DYN = 3,
+  EM_RISCV = 243,
+  EF_RISCV_RVC = 0x1,
+  EF_RISCV_FLOAT_ABI_SINGLE = 0x2,
+  EF_RISCV_FLOAT_ABI_DOUBLE = 0x4,
+
+  SHT_PROGBITS = 1,
+  SHT_SYMTAB = 2,
+  SHT_STRTAB = 3,
+  SHT_RELA = 4,
+  SHT_HASH = 5,
+  SHT_DYNAMIC = 6,
+  SHT_DYNSYM = 11,
+  SHF_WRITE = 0x1,
+  SHF_ALLOC = 0x2,
+  SHF_EXECINSTR = 0x4,
+  SHF_INFO_LINK = 0x40,
+
+  STB_LOCAL = 0,
+  STB_GLOBAL = 1,
+  STT_NOTYPE = 0,
+  STT_FUNC = 2,
+  STT_SECTION = 3,
+
+  PT_LOAD = 1,
+  PT_DYNAMIC = 2,
+  PT_GNU_STACK = 0x6474e551,
+  PF_X = 1,
+  PF_W = 2,
+  PF_R = 4,
+
+  DT_NULL = 0,
+  DT_HASH = 4,
+  DT_STRTAB = 5,
+  DT_SYMTAB = 6,
+  DT_RELA = 7,
+  DT_RELASZ = 8,
+  DT_RELAENT = 9,
+  DT_STRSZ = 10,
+  DT_SYMENT = 11,
+  DT_SONAME = 14,
+
+  R_RISCV_32 = 1,
+  R_RISCV_64 = 2,
+  R_RISCV_PCREL_HI20 = 23,
+  R_RISCV_PCREL_LO12_I = 24,
+  R_RISCV_HI20 = 26,
+  R_RISCV_LO12_I = 27,
+};
+
+/// リトルエンディアンのバイト列の組み立て
+class Buffer {
+ public:
+  std::string data;
+
+  std::size_t size() const { return data.size(); }
+  void put(uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+      data += static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+  }
+  void u8(uint64_t v) { put(v, 1); }
+  void u16(uint64_t v) { put(v, 2); }
+  void u32(uint64_t v) { put(v, 4); }
+  void u64(uint64_t v) { put(v, 8); }
+  void append(const std::string& s) { data += s; }
+  void align(std::size_t n) {
+    while (data.size() % n != 0) {
+      data += '\0';
+    }
+  }
+};
+
+/// 文字列テーブル
+class StringTable {
+  std::map<std::string, uint32> index;
+
+ public:
+  std::string data;
+
+  StringTable() : index(), data(1, '\0') {}
+
+  uint32 add(const std::string& s) {
+    if (s.empty()) {
+      return 0;
+    }
+    const auto itr = index.find(s);
+    if (itr != index.end()) {
+      return itr->second;
+    }
+    const uint32 off = static_cast<uint32>(data.size());
+    data += s;
+    data += '\0';
+    index[s] = off;
+    return off;
+  }
+};
+
+/// シンボル
+struct Symbol {
+  uint32 name;
+  unsigned char info;
+  uint16_t shndx;
+  uint64_t value;
+  uint64_t size;
+};
+
+/// リロケーション
+struct Rela {
+  uint64_t offset;
+  uint32 sym;
+  uint32 type;
+  int64_t addend;
+};
+
+/// セクションヘッダ
+struct Section {
+  uint32 name;
+  uint32 type;
+  uint64_t flags;
+  uint64_t addr;
+  uint64_t offset;
+  uint64_t size;
+  uint32 link;
+  uint32 info;
+  uint64_t align;
+  uint64_t entsize;
+};
+
+/**
+ * XLEN ビットの ELF ファイルの組み立て
+ */
+template <int XLEN>
+class Writer {
+  static const int W = XLEN / 8;  ///< アドレスのバイト数
+
+ public:
+  static const int EHDR_SIZE = (XLEN == 64) ? 64 : 52;
+  static const int PHDR_SIZE = (XLEN == 64) ? 56 : 32;
+  static const int SHDR_SIZE = (XLEN == 64) ? 64 : 40;
+  static const int SYM_SIZE = (XLEN == 64) ? 24 : 16;
+  static const int RELA_SIZE = (XLEN == 64) ? 24 : 12;
+  static const int DYN_SIZE = 2 * W;
+
+  static void ehdr(Buffer& b, uint16_t type, uint32 flags, uint64_t phoff, uint16_t phnum, uint64_t shoff, uint16_t shnum, uint16_t shstrndx) {
+    b.append(std::string("\x7f" "ELF", 4));
+    b.u8((XLEN == 64) ? 2 : 1);  // ELFCLASS
+    b.u8(1);                     // ELFDATA2LSB
+    b.u8(1);                     // EV_CURRENT
+    b.put(0, 9);
+    b.u16(type);
+    b.u16(EM_RISCV);
+    b.u32(1);
+    b.put(0, W);  // e_entry
+    b.put(phoff, W);
+    b.put(shoff, W);
+    b.u32(flags);
+    b.u16(EHDR_SIZE);
+    b.u16(phnum != 0 ? PHDR_SIZE : 0);
+    b.u16(phnum);
+    b.u16(SHDR_SIZE);
+    b.u16(shnum);
+    b.u16(shstrndx);
+  }
+
+  static void phdr(Buffer& b, uint32 type, uint32 flags, uint64_t offset, uint64_t size, uint64_t align) {
+    b.u32(type);
+    if (XLEN == 64) {
+      b.u32(flags);
+    }
+    b.put(offset, W);  // p_offset
+    b.put(offset, W);  // p_vaddr
+    b.put(offset, W);  // p_paddr
+    b.put(size, W);    // p_filesz
+    b.put(size, W);    // p_memsz
+    if (XLEN != 64) {
+      b.u32(flags);
+    }
+    b.put(align, W);
+  }
+
+  static void shdr(Buffer& b, const Section& s) {
+    b.u32(s.name);
+    b.u32(s.type);
+    b.put(s.flags, W);
+    b.put(s.addr, W);
+    b.put(s.offset, W);
+    b.put(s.size, W);
+    b.u32(s.link);
+    b.u32(s.info);
+    b.put(s.align, W);
+    b.put(s.entsize, W);
+  }
+
+  static void sym(Buffer& b, const Symbol& s) {
+    b.u32(s.name);
+    if (XLEN == 64) {
+      b.u8(s.info);
+      b.u8(0);
+      b.u16(s.shndx);
+      b.u64(s.value);
+      b.u64(s.size);
+    } else {
+      b.u32(s.value);
+      b.u32(s.size);
+      b.u8(s.info);
+      b.u8(0);
+      b.u16(s.shndx);
+    }
+  }
+
+  static void rela(Buffer& b, const Rela& r) {
+    b.put(r.offset, W);
+    b.put((XLEN == 64) ? ((static_cast<uint64_t>(r.sym) << 32) | r.type) : ((r.sym << 8) | r.type), W);
+    b.put(static_cast<uint64_t>(r.addend), W);
+  }
+
+  static void dyn(Buffer& b, uint64_t tag, uint64_t val) {
+    b.put(tag, W);
+    b.put(val, W);
+  }
+};
+
+/// SysV の .hash のハッシュ関数
+inline uint32 hash(const char* name) {
+  uint32 h = 0;
+  for (const unsigned char* p = reinterpret_cast<const unsigned char*>(name); *p != '\0'; ++p) {
+    h = (h << 4) + *p;
+    const uint32 g = h & 0xf0000000;
+    if (g != 0) {
+      h ^= g >> 24;
+    }
+    h &= ~g;
+  }
+  return h;
+}
+
+/// 命令列のリロケーションの修正箇所を0にする(リンカやローダーが埋めるので、生成時のアドレスを残さない)
+inline void clearRelocations(std::string& code, const std::vector<Relocation>& relocs, int xlen) {
+  for (const auto& r : relocs) {
+    if (r.type == RelocGotSlot) {
+      memset(&code[r.offset], 0, xlen / 8);
+    } else {
+      code[r.offset + 1] &= 0x0f;  // 上位20ビット
+      code[r.offset + 2] = 0;
+      code[r.offset + 3] = 0;
+      code[r.offset + 6] &= 0x0f;  // 下位12ビット
+      code[r.offset + 7] = 0;
+    }
+  }
+}
+
+/// エクスポートした関数(先頭からのオフセット順)
+struct Function {
+  std::string name;
+  uint64_t offset;
+  uint64_t size;
+};
+
+template <Isa isa>
+std::vector<Function> functions(const CodeGenerator<isa>& g) {
+  std::vector<Function> res;
+  for (const auto& e : g.getSymbols()) {
+    res.push_back(Function{e.first, static_cast<uint64_t>(static_cast<const char*>(e.second) - g.getCode()), 0});
+  }
+  std::sort(res.begin(), res.end(), [](const Function& a, const Function& b) { return a.offset < b.offset; });
+  // 次の関数の先頭(最後の関数は GOT のスロットの手前)までを関数のサイズとする
+  uint64_t end = g.getCodeSize();
+  for (const auto& r : g.getRelocations()) {
+    if (r.type == RelocGotSlot && r.offset < end) {
+      end = r.offset;
+    }
+  }
+  for (std::size_t i = 0; i < res.size(); ++i) {
+    const uint64_t next = (i + 1 < res.size()) ? res[i + 1].offset : end;
+    res[i].size = (res[i].offset < next) ? next - res[i].offset : 0;
+  }
+  return res;
+}
+
+/// リロケータブルオブジェクトの出力
+template <int XLEN, Isa isa>
+std::string objectFile(const CodeGenerator<isa>& g, uint32 flags) {
+  typedef Writer<XLEN> E;
+  enum { SEC_TEXT = 1, SEC_RELA, SEC_SYMTAB, SEC_STRTAB, SEC_SHSTRTAB, SEC_NUM };
+
+  std::string code(g.getCode(), g.getCodeSize());
+  clearRelocations(code, g.getRelocations(), XLEN);
+
+  // シンボルテーブル(ローカルシンボルが先)
+  StringTable strtab;
+  std::vector<Symbol> syms;
+  syms.push_back(Symbol{0, 0, 0, 0, 0});
+  syms.push_back(Symbol{0, (STB_LOCAL << 4) | STT_SECTION, SEC_TEXT, 0, 0});
+  std::map<uint64_t, uint32> pcrelLabels;  // auipc のオフセットからローカルシンボル
+  for (const auto& r : g.getRelocations()) {
+    if (r.type == RelocPcrelHi20Lo12) {
+      pcrelLabels[r.offset] = static_cast<uint32>(syms.size());
+      const std::string name = ".Lpcrel_hi" + std::to_string(pcrelLabels.size() - 1);
+      syms.push_back(Symbol{strtab.add(name), (STB_LOCAL << 4) | STT_NOTYPE, SEC_TEXT, r.offset, 0});
+    }
+  }
+  const uint32 firstGlobal = static_cast<uint32>(syms.size());
+  for (const auto& f : functions(g)) {
+    syms.push_back(Symbol{strtab.add(f.name), (STB_GLOBAL << 4) | STT_FUNC, SEC_TEXT, f.offset, f.size});
+  }
+  std::map<std::string, uint32> undefined;
+  for (const auto& r : g.getRelocations()) {
+    if (undefined.find(r.symbol) == undefined.end()) {
+      undefined[r.symbol] = static_cast<uint32>(syms.size());
+      syms.push_back(Symbol{strtab.add(r.symbol), (STB_GLOBAL << 4) | STT_NOTYPE, 0, 0, 0});
+    }
+  }
+
+  // リロケーション
+  Buffer rela;
+  for (const auto& r : g.getRelocations()) {
+    const uint32 sym = undefined[r.symbol];
+    switch (r.type) {
+      case RelocHi20Lo12:
+        E::rela(rela, Rela{r.offset, sym, R_RISCV_HI20, r.addend});
+        E::rela(rela, Rela{r.offset + 4, sym, R_RISCV_LO12_I, r.addend});
+        break;
+      case RelocPcrelHi20Lo12:
+        E::rela(rela, Rela{r.offset, sym, R_RISCV_PCREL_HI20, r.addend});
+        E::rela(rela, Rela{r.offset + 4, pcrelLabels[r.offset], R_RISCV_PCREL_LO12_I, 0});
+        break;
+      case RelocGotSlot:
+        E::rela(rela, Rela{r.offset, sym, (XLEN == 64) ? R_RISCV_64 : R_RISCV_32, r.addend});
+        break;
+    }
+  }
+  Buffer symtab;
+  for (const auto& s : syms) {
+    E::sym(symtab, s);
+  }
+
+  // ファイルの組み立て
+  StringTable shstrtab;
+  Section sec[SEC_NUM];
+  memset(sec, 0, sizeof(sec));
+  Buffer b;
+  b.put(0, E::EHDR_SIZE);
+  const auto place = [&b, &sec](int i, const std::string& data, std::size_t align) {
+    b.align(align);
+    sec[i].offset = b.size();
+    sec[i].size = data.size();
+    sec[i].align = align;
+    b.append(data);
+  };
+  place(SEC_TEXT, code, 16);
+  place(SEC_RELA, rela.data, 8);
+  place(SEC_SYMTAB, symtab.data, 8);
+  place(SEC_STRTAB, strtab.data, 1);
+  sec[SEC_TEXT].name = shstrtab.add(".text");
+  sec[SEC_TEXT].type = SHT_PROGBITS;
+  sec[SEC_TEXT].flags = SHF_ALLOC | SHF_EXECINSTR;
+  sec[SEC_RELA].name = shstrtab.add(".rela.text");
+  sec[SEC_RELA].type = SHT_RELA;
+  sec[SEC_RELA].flags = SHF_INFO_LINK;
+  sec[SEC_RELA].link = SEC_SYMTAB;
+  sec[SEC_RELA].info = SEC_TEXT;
+  sec[SEC_RELA].entsize = E::RELA_SIZE;
+  sec[SEC_SYMTAB].name = shstrtab.add(".symtab");
+  sec[SEC_SYMTAB].type = SHT_SYMTAB;
+  sec[SEC_SYMTAB].link = SEC_STRTAB;
+  sec[SEC_SYMTAB].info = firstGlobal;
+  sec[SEC_SYMTAB].entsize = E::SYM_SIZE;
+  sec[SEC_STRTAB].name = shstrtab.add(".strtab");
+  sec[SEC_STRTAB].type = SHT_STRTAB;
+  sec[SEC_SHSTRTAB].name = shstrtab.add(".shstrtab");
+  sec[SEC_SHSTRTAB].type = SHT_STRTAB;
+  place(SEC_SHSTRTAB, shstrtab.data, 1);
+
+  b.align(8);
+  const uint64_t shoff = b.size();
+  for (const auto& s : sec) {
+    E::shdr(b, s);
+  }
+  Buffer h;
+  E::ehdr(h, ET_REL, flags, 0, 0, shoff, SEC_NUM, SEC_SHSTRTAB);
+  b.data.replace(0, h.size(), h.data);
+  return b.data;
+}
+
+/// 共有オブジェクトの出力
+template <int XLEN, Isa isa>
+std::string sharedObject(const CodeGenerator<isa>& g, uint32 flags, const char* soname) {
+  typedef Writer<XLEN> E;
+  enum { SEC_HASH = 1, SEC_DYNSYM, SEC_DYNSTR, SEC_RELA, SEC_TEXT, SEC_DYNAMIC, SEC_SHSTRTAB, SEC_NUM };
+  const int PHNUM = 3;
+
+  std::string code(g.getCode(), g.getCodeSize());
+  clearRelocations(code, g.getRelocations(), XLEN);
+  for (const auto& r : g.getRelocations()) {
+    if (r.type != RelocGotSlot) {
+      throw UnsupportedException("Shared object requires RelocGot for the external symbol '" + r.symbol + "'.");
+    }
+  }
+
+  // 動的シンボルテーブル
+  StringTable dynstr;
+  std::vector<Symbol> syms;
+  std::vector<std::string> names;
+  syms.push_back(Symbol{0, 0, 0, 0, 0});
+  names.push_back("");
+  const std::vector<Function> funcs = functions(g);
+  for (const auto& f : funcs) {
+    syms.push_back(Symbol{dynstr.add(f.name), (STB_GLOBAL << 4) | STT_FUNC, SEC_TEXT, f.offset, f.size});
+    names.push_back(f.name);
+  }
+  std::map<std::string, uint32> undefined;
+  for (const auto& r : g.getRelocations()) {
+    if (undefined.find(r.symbol) == undefined.end()) {
+      undefined[r.symbol] = static_cast<uint32>(syms.size());
+      syms.push_back(Symbol{dynstr.add(r.symbol), (STB_GLOBAL << 4) | STT_NOTYPE, 0, 0, 0});
+      names.push_back(r.symbol);
+    }
+  }
+  const uint32 sonameOff = (soname != nullptr) ? dynstr.add(soname) : 0;
+
+  // .hash
+  const uint32 nbucket = static_cast<uint32>(syms.size());
+  std::vector<uint32> bucket(nbucket, 0), chain(syms.size(), 0);
+  for (uint32 i = 1; i < syms.size(); ++i) {
+    const uint32 h = hash(names[i].c_str()) % nbucket;
+    chain[i] = bucket[h];
+    bucket[h] = i;
+  }
+  Buffer hashtab;
+  hashtab.u32(nbucket);
+  hashtab.u32(static_cast<uint32>(chain.size()));
+  for (uint32 v : bucket) {
+    hashtab.u32(v);
+  }
+  for (uint32 v : chain) {
+    hashtab.u32(v);
+  }
+
+  // ファイルの組み立て(ファイルのオフセット = 仮想アドレス)
+  StringTable shstrtab;
+  Section sec[SEC_NUM];
+  memset(sec, 0, sizeof(sec));
+  Buffer b;
+  b.put(0, E::EHDR_SIZE + PHNUM * E::PHDR_SIZE);
+  const auto place = [&b, &sec](int i, const std::string& data, std::size_t align) {
+    b.align(align);
+    sec[i].offset = sec[i].addr = b.size();
+    sec[i].size = data.size();
+    sec[i].align = align;
+    b.append(data);
+  };
+  place(SEC_HASH, hashtab.data, 8);
+  b.align(8);
+  const uint64_t dynsymOff = b.size();
+  // .text の位置を先に決めて、エクスポートした関数のシンボルの値にする
+  const uint64_t relaOff = (dynsymOff + syms.size() * E::SYM_SIZE + dynstr.data.size() + 7) & ~7ull;
+  const uint64_t textOff = (relaOff + g.getRelocations().size() * E::RELA_SIZE + 15) & ~15ull;
+  Buffer dynsym;
+  for (auto s : syms) {
+    if (s.shndx == SEC_TEXT) {
+      s.value += textOff;
+    }
+    E::sym(dynsym, s);
+  }
+  place(SEC_DYNSYM, dynsym.data, 8);
+  place(SEC_DYNSTR, dynstr.data, 1);
+  Buffer rela;
+  for (const auto& r : g.getRelocations()) {
+    E::rela(rela, Rela{textOff + r.offset, undefined[r.symbol], (XLEN == 64) ? R_RISCV_64 : R_RISCV_32, r.addend});
+  }
+  place(SEC_RELA, rela.data, 8);
+  place(SEC_TEXT, code, 16);
+  XKON_ASSERT(sec[SEC_RELA].offset == relaOff && sec[SEC_TEXT].offset == textOff);
+  b.align(8);
+  Buffer dynamic;
+  E::dyn(dynamic, DT_HASH, sec[SEC_HASH].addr);
+  E::dyn(dynamic, DT_STRTAB, sec[SEC_DYNSTR].addr);
+  E::dyn(dynamic, DT_SYMTAB, sec[SEC_DYNSYM].addr);
+  E::dyn(dynamic, DT_STRSZ, sec[SEC_DYNSTR].size);
+  E::dyn(dynamic, DT_SYMENT, E::SYM_SIZE);
+  E::dyn(dynamic, DT_RELA, sec[SEC_RELA].addr);
+  E::dyn(dynamic, DT_RELASZ, sec[SEC_RELA].size);
+  E::dyn(dynamic, DT_RELAENT, E::RELA_SIZE);
+  if (soname != nullptr) {
+    E::dyn(dynamic, DT_SONAME, sonameOff);
+  }
+  E::dyn(dynamic, DT_NULL, 0);
+  place(SEC_DYNAMIC, dynamic.data, 8);
+  const uint64_t loadSize = b.size();
+
+  sec[SEC_HASH].name = shstrtab.add(".hash");
+  sec[SEC_HASH].type = SHT_HASH;
+  sec[SEC_HASH].flags = SHF_ALLOC;
+  sec[SEC_HASH].link = SEC_DYNSYM;
+  sec[SEC_HASH].entsize = 4;
+  sec[SEC_DYNSYM].name = shstrtab.add(".dynsym");
+  sec[SEC_DYNSYM].type = SHT_DYNSYM;
+  sec[SEC_DYNSYM].flags = SHF_ALLOC;
+  sec[SEC_DYNSYM].link = SEC_DYNSTR;
+  sec[SEC_DYNSYM].info = 1;
+  sec[SEC_DYNSYM].entsize = E::SYM_SIZE;
+  sec[SEC_DYNSTR].name = shstrtab.add(".dynstr");
+  sec[SEC_DYNSTR].type = SHT_STRTAB;
+  sec[SEC_DYNSTR].flags = SHF_ALLOC;
+  sec[SEC_RELA].name = shstrtab.add(".rela.dyn");
+  sec[SEC_RELA].type = SHT_RELA;
+  sec[SEC_RELA].flags = SHF_ALLOC;
+  sec[SEC_RELA].link = SEC_DYNSYM;
+  sec[SEC_RELA].entsize = E::RELA_SIZE;
+  sec[SEC_TEXT].name = shstrtab.add(".text");
+  sec[SEC_TEXT].type = SHT_PROGBITS;
+  sec[SEC_TEXT].flags = SHF_ALLOC | SHF_EXECINSTR | SHF_WRITE;
+  sec[SEC_DYNAMIC].name = shstrtab.add(".dynamic");
+  sec[SEC_DYNAMIC].type = SHT_DYNAMIC;
+  sec[SEC_DYNAMIC].flags = SHF_ALLOC | SHF_WRITE;
+  sec[SEC_DYNAMIC].link = SEC_DYNSTR;
+  sec[SEC_DYNAMIC].entsize = E::DYN_SIZE;
+  sec[SEC_SHSTRTAB].name = shstrtab.add(".shstrtab");
+  sec[SEC_SHSTRTAB].type = SHT_STRTAB;
+  place(SEC_SHSTRTAB, shstrtab.data, 1);
+  sec[SEC_SHSTRTAB].addr = 0;
+
+  b.align(8);
+  const uint64_t shoff = b.size();
+  for (const auto& s : sec) {
+    E::shdr(b, s);
+  }
+  Buffer h;
+  E::ehdr(h, ET_DYN, flags, E::EHDR_SIZE, PHNUM, shoff, SEC_NUM, SEC_SHSTRTAB);
+  E::phdr(h, PT_LOAD, PF_R | PF_W | PF_X, 0, loadSize, 0x1000);
+  E::phdr(h, PT_DYNAMIC, PF_R | PF_W, sec[SEC_DYNAMIC].offset, sec[SEC_DYNAMIC].size, 8);
+  E::phdr(h, PT_GNU_STACK, PF_R | PF_W, 0, 0, 16);
+  b.data.replace(0, h.size(), h.data);
+  return b.data;
+}
+
+}  // namespace internal
+
+/**
+ * generate() 済みの g の命令列を type の ELF ファイルのイメージにする
+ * soname は共有オブジェクトの DT_SONAME(nullptr なら出力しない)
+ * abi は生成したコードが従う呼出し規約。ISA に F/D があっても浮動小数点レジスタで引数を渡すとは限らないので、
+ * ISA からは決めずに指定する(既定はソフトフロート)
+ */
+template <Isa isa>
+std::string write(const CodeGenerator<isa>& g, FileType type, const char* soname = nullptr, FloatAbi abi = FloatAbiSoft) {
+  const bool rv64 = (isa & RV64) != 0;
+  uint32 flags = ((isa & EXT_C) == EXT_C) ? internal::EF_RISCV_RVC : 0;
+  if (abi == FloatAbiDouble) {
+    XKON_ASSERT((isa & EXT_D) == EXT_D);
+    flags |= internal::EF_RISCV_FLOAT_ABI_DOUBLE;
+  } else if (abi == FloatAbiSingle) {
+    XKON_ASSERT((isa & EXT_F) == EXT_F);
+    flags |= internal::EF_RISCV_FLOAT_ABI_SINGLE;
+  }
+  if (type == ObjectFile) {
+    return rv64 ? internal::objectFile<64>(g, flags) : internal::objectFile<32>(g, flags);
+  } else {
+    return rv64 ? internal::sharedObject<64>(g, flags, soname) : internal::sharedObject<32>(g, flags, soname);
+  }
+}
+
+/// write() のイメージをファイル path に書き込む
+template <Isa isa>
+bool save(const char* path, const CodeGenerator<isa>& g, FileType type, const char* soname = nullptr, FloatAbi abi = FloatAbiSoft) {
+  const std::string image = write(g, type, soname, abi);
+  FILE* fp = fopen(path, "wb");
+  if (fp == nullptr) {
+    return false;
+  }
+  const bool ok = fwrite(image.data(), 1, image.size(), fp) == image.size();
+  return (fclose(fp) == 0) && ok;
+}
+
+}  // namespace elf
+}  // namespace xkon
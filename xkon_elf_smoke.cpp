@@ -0,0 +1,69 @@
+// ELF writer smoke test.
+//
+// Usage: xkon_elf_smoke.out [dir]
+//   dir : Output directory (default the current directory).
+//
+// Writes a relocatable object and a shared object for RV32GC and RV64GC with xkon_elf.hpp:
+//   <isa>_pcrel.o  : PC-relative references to an external symbol (R_RISCV_PCREL_HI20/LO12_I).
+//   <isa>_abs.o    : Absolute references (R_RISCV_HI20/LO12_I), RV32 only.
+//   <isa>_double.o : Same as <isa>_pcrel.o with the double-float ABI in e_flags (the others are soft-float), RV32 only.
+//   <isa>.so       : GOT references (dynamic relocations), with DT_SONAME.
+// la() and callSymbol() are RV32 only, so the RV64GC files only export add1 and have no relocations.
+// xkon_elf_smoke.sh runs readelf on the files and fails on any warning or error.
+#define DEBUG 0
+#include <cstdio>
+#include <string>
+
+#include "xkon.hpp"
+#include "xkon_elf.hpp"
+
+namespace {
+
+using namespace xkon;
+
+// Exports add1(x) = x + 1 and, with ext, get_ext() = ext_func(&ext_value).
+struct Module : xkon::Registers {
+  template <class G>
+  static void emit(G &g, bool ext) {
+    g.function("add1");
+    g.addi(a0, a0, 1);
+    g.ret();
+    if (!ext) {
+      return;
+    }
+
+    g.function("get_ext");
+    typename G::Frame frame = g.prologue();
+    g.la(a0, "ext_value");
+    g.callSymbol("ext_func");
+    g.epilogue(frame);
+    g.ret();
+  }
+};
+
+template <Isa isa>
+bool emit(const std::string &dir, const char *isa_name, RelocMode mode, elf::FileType type, const char *suffix, elf::FloatAbi abi = elf::FloatAbiSoft) {
+  CodeGenerator<isa> g(4096);
+  g.setRelocMode(mode);
+  Module::emit(g, (isa & RV64) == 0);
+  g.template generate<void *>();
+  const std::string name = std::string(isa_name) + suffix;
+  const std::string path = dir + "/" + name;
+  const bool ok = elf::save(path.c_str(), g, type, (type == elf::SharedObject) ? name.c_str() : nullptr, abi);
+  printf("%s %s\n", ok ? "wrote" : "FAILED", path.c_str());
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const std::string dir = (1 < argc) ? argv[1] : ".";
+  bool ok = true;
+  ok &= emit<RV32GC>(dir, "rv32gc", RelocPcrel, elf::ObjectFile, "_pcrel.o");
+  ok &= emit<RV32GC>(dir, "rv32gc", RelocAbsolute, elf::ObjectFile, "_abs.o");
+  ok &= emit<RV32GC>(dir, "rv32gc", RelocPcrel, elf::ObjectFile, "_double.o", elf::FloatAbiDouble);
+  ok &= emit<RV32GC>(dir, "rv32gc", RelocGot, elf::SharedObject, ".so");
+  ok &= emit<RV64GC>(dir, "rv64gc", RelocPcrel, elf::ObjectFile, "_pcrel.o");
+  ok &= emit<RV64GC>(dir, "rv64gc", RelocGot, elf::SharedObject, ".so");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+#!/bin/bash
+# Usage: ./xkon_elf_smoke.sh [dir]
+# Writes ELF objects and shared objects with xkon_elf.hpp (on the host) and checks them with readelf.
+set -e
+dir=${1:-elf_smoke}
+mkdir -p "$dir"
+${CXX:-g++} -O2 xkon_elf_smoke.cpp -fno-operator-names -std=c++14 -Wall -o xkon_elf_smoke.out
+./xkon_elf_smoke.out "$dir"
+status=0
+for f in "$dir"/*.o "$dir"/*.so; do
+  out=$(${READELF:-readelf} -W -h -l -S -s -r -d "$f" 2>&1) || status=1
+  if echo "$out" | grep -qiE "warning|error"; then
+    echo "$out" | grep -iE "warning|error"
+    status=1
+  fi
+  machine=$(echo "$out" | grep "^ *Machine:" | tr -s ' ')
+  flags=$(echo "$out" | grep "^ *Flags:" | tr -s ' ')
+  echo "$f:$machine,$flags"
+  abi="soft-float"
+  case "$f" in *_double.o) abi="double-float" ;; esac
+  echo "$machine" | grep -q "RISC-V" || status=1
+  echo "$flags" | grep -q "$abi ABI" || status=1
+done
+[ $status -eq 0 ] && echo "OK" || echo "FAILED"
+exit $status
@@ -0,0 +1,1166 @@
+#pragma once
+
+/**
+ * xkon で生成したコードをホスト上で実行するための RISC-V ユーザーモードエミュレータ
+ *
+ * * RV32GC/RV64GC の非特権命令を実行する。CSR は fflags/frm/fcsr と cycle/time/instret の読み出しのみ。
+ * * 浮動小数点演算の丸めモードはホストの丸めモード(通常は RNE)で代用し、fflags は更新しない。
+ *   整数への変換(FCVT.W 等)のみ命令の丸めモードに従う。
+ * * ゲストのアドレス空間はホストのメモリ領域を map() で登録して構成する。
+ *   map(host, size) はホストのアドレスが XLEN ビットに収まればそのままゲストのアドレスとし、
+ *   収まらない場合(64 ビットのホストで XLEN=32)はゲストのアドレス空間の未使用の範囲を割り当てる。
+ *   ホストのアドレスを埋め込むコードは guest() で変換したアドレスを使うこと(シンボルの値や li の即値など)。
+ * * bind() で登録したアドレスに分岐すると、ホストの関数を呼び出して ra に戻る(ホスト呼出しの橋渡し)。
+ *   C の関数の bind() も、関数のアドレスが収まらない場合は未使用のアドレスを割り当てる。
+ *   ECALL/EBREAK・未登録のアドレスへのアクセス・不正命令は EmulatorException を発生させる。
+ * * 命令は基本ブロック単位でデコードしてキャッシュし、デコード済みの命令の処理関数を順に呼び出す。
+ *   ブロックの終端では直前に遷移したブロックへのポインタを辿り、ブロックの検索を省略する。
+ *   コードを書き換えた場合は invalidate() を呼ぶこと(map()/unmap() でも破棄する)。
+ *
+ * 例:
+ *   CodeGenerator<RV32GC> g;
+ *   ... 命令生成 ...
+ *   auto f = g.generate<int (*)(int)>();
+ *   emu::Emulator<32> e;
+ *   e.map((const void*)f, g.getCodeSize());  // g が参照するホストのアドレスは e.guest(p) で生成する
+ *   int r = static_cast<int>(e.call((const void*)f, {42}));
+ */
+
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "xkon.hpp"
+
+namespace xkon {
+namespace emu {
+
+/// 「実行時エラー」例外クラス
+/// ゲストのコードが不正なアクセス・不正命令・ECALL などを実行した際に発生する例外
+class EmulatorException : public std::exception {
+  std::string m_what;
+
+ public:
+  EmulatorException(const std::string& what, addr_t pc) noexcept : exception(), m_what(what) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), " (pc=0x%llx)", pc);
+    m_what += buf;
+  }
+  virtual ~EmulatorException() {}
+  virtual const char* what() const noexcept { return m_what.c_str(); }
+};
+
+/**
+ * エミュレータ
+ *
+ * XLEN は 32 または 64。
+ */
+template <int XLEN>
+class Emulator {
+  static_assert(XLEN == 32 || XLEN == 64, "XLEN must be 32 or 64");
+
+  Emulator(const Emulator&) = delete;
+  void operator=(const Emulator&) = delete;
+
+ public:
+  typedef typename std::conditional<XLEN == 32, uint32_t, uint64_t>::type reg_t;
+  typedef typename std::conditional<XLEN == 32, int32_t, int64_t>::type sreg_t;
+  typedef std::function<void(Emulator&)> HostFunc;
+
+ private:
+  /// デコード済みの命令
+  struct Op;
+  typedef void (*Handler)(Emulator&, const Op&);
+  struct Op {
+    Handler fn;
+    uint8_t rd, rs1, rs2, rs3;  ///< rd が x0 の場合は SINK
+    uint8_t rm;                 ///< 丸めモード
+    reg_t imm;                  ///< 即値。分岐先・AUIPC の結果などはアドレスを計算済み
+    reg_t next;                 ///< 次の命令のアドレス(JAL/JALR の戻り先、条件分岐の非分岐先)
+    reg_t pc;                   ///< 命令のアドレス(エラー報告用)
+  };
+
+  /// デコード済みの基本ブロック
+  struct Block {
+    std::vector<Op> ops;
+    uint64_t insns;  ///< ゲストの命令数
+    HostFunc host;   ///< ホスト呼出しのブロックならホストの関数
+    bool exit;       ///< call() から戻るアドレス
+    struct Link {
+      reg_t addr;
+      Block* block;
+    } links[2];  ///< 直前に遷移したブロック
+  };
+
+  /// ゲストのアドレス空間に登録したホストのメモリ領域
+  struct Region {
+    reg_t guest;
+    char* host;
+    size_t size;
+  };
+
+  static const int SINK = 32;         ///< x0 への書込み先
+  static const size_t MAX_OPS = 256;  ///< 1ブロックの最大命令数
+  static const reg_t PAGE = 4096;     ///< 割り当てるゲストのアドレスの境界
+
+  reg_t x[33];     ///< 整数レジスタ(x[SINK] は x0 への書込みを捨てる)
+  uint64_t f[32];  ///< 浮動小数点レジスタ(単精度は上位32ビットを1で埋める)
+  uint32_t fflags;
+  uint32_t frm;
+  reg_t nextPc;          ///< 実行中のブロックの次に実行するアドレス
+  reg_t reservation;     ///< LR で予約したアドレス
+  bool reserved;         ///< LR の予約が有効
+  bool flushPending;     ///< FENCE.I によるキャッシュ破棄の要求
+  uint64_t instret;      ///< 実行した命令数
+  int depth;             ///< call() の入れ子の深さ
+  std::vector<char> stack;
+  reg_t exitAddr;  ///< call() で ra に設定する戻り先
+  std::vector<Region> regions;
+  size_t lastRegion;  ///< 直前にアクセスした領域
+  std::unordered_map<reg_t, HostFunc> hosts;
+  std::unordered_map<const void*, reg_t> funcs;  ///< bind() した C の関数のゲストのアドレス
+  std::unordered_map<reg_t, std::unique_ptr<Block>> blocks;
+
+  //////////////////////////////////////////////////////////////////////////////
+  // メモリ
+
+  /// ゲストのアドレス addr から n バイトのホストのアドレス。登録されていなければ nullptr
+  char* find(reg_t addr, size_t n) {
+    if (lastRegion < regions.size()) {
+      const Region& r = regions[lastRegion];
+      const reg_t d = addr - r.guest;
+      if (d < r.size && n <= r.size - d) {
+        return r.host + d;
+      }
+    }
+    for (size_t i = 0; i < regions.size(); ++i) {
+      const Region& r = regions[i];
+      const reg_t d = addr - r.guest;
+      if (d < r.size && n <= r.size - d) {
+        lastRegion = i;
+        return r.host + d;
+      }
+    }
+    return nullptr;
+  }
+
+  char* translate(reg_t addr, size_t n, reg_t pc) {
+    char* p = find(addr, n);
+    if (p == nullptr) {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "access to unmapped address 0x%llx", static_cast<unsigned long long>(addr));
+      throw EmulatorException(buf, pc);
+    }
+    return p;
+  }
+
+  template <class T>
+  T load(reg_t addr, reg_t pc) {
+    T v;
+    memcpy(&v, translate(addr, sizeof(T), pc), sizeof(T));
+    return v;
+  }
+
+  template <class T>
+  void store(reg_t addr, T v, reg_t pc) {
+    memcpy(translate(addr, sizeof(T), pc), &v, sizeof(T));
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // 浮動小数点レジスタ
+
+  template <class F>
+  F getF(int i) const;
+  template <class F>
+  void setF(int i, F v);
+
+  static float canonical(float v) { return std::isnan(v) ? std::numeric_limits<float>::quiet_NaN() : v; }
+  static double canonical(double v) { return std::isnan(v) ? std::numeric_limits<double>::quiet_NaN() : v; }
+
+  /// 丸めモード rm で整数型 I に変換する(範囲外は飽和、NaN は最大値)
+  template <class I, class F>
+  static I toInt(F v, uint32_t rm) {
+    if (std::isnan(v)) {
+      return std::numeric_limits<I>::max();
+    }
+    switch (rm) {
+      case 0:  // RNE
+        v = std::nearbyint(v);
+        break;
+      case 1:  // RTZ
+        v = std::trunc(v);
+        break;
+      case 2:  // RDN
+        v = std::floor(v);
+        break;
+      case 3:  // RUP
+        v = std::ceil(v);
+        break;
+      default:  // RMM
+        v = std::round(v);
+        break;
+    }
+    if (v <= static_cast<F>(std::numeric_limits<I>::min())) {
+      return std::numeric_limits<I>::min();
+    }
+    if (static_cast<F>(std::numeric_limits<I>::max()) <= v) {
+      return std::numeric_limits<I>::max();
+    }
+    return static_cast<I>(v);
+  }
+
+  template <class F>
+  static reg_t fclass(F v) {
+    const bool neg = std::signbit(v);
+    switch (std::fpclassify(v)) {
+      case FP_INFINITE:
+        return neg ? 1u << 0 : 1u << 7;
+      case FP_NORMAL:
+        return neg ? 1u << 1 : 1u << 6;
+      case FP_SUBNORMAL:
+        return neg ? 1u << 2 : 1u << 5;
+      case FP_ZERO:
+        return neg ? 1u << 3 : 1u << 4;
+      default: {
+        // シグナリング NaN は仮数部の最上位ビットが0
+        typedef typename std::conditional<sizeof(F) == 4, uint32_t, uint64_t>::type bits_t;
+        bits_t b;
+        memcpy(&b, &v, sizeof(b));
+        const bits_t quiet = static_cast<bits_t>(1) << (std::numeric_limits<F>::digits - 2);
+        return (b & quiet) ? 1u << 9 : 1u << 8;
+      }
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // 命令の処理関数
+
+  static reg_t sx(int64_t v) { return static_cast<reg_t>(v); }
+  static reg_t sx32(uint64_t v) { return static_cast<reg_t>(static_cast<int64_t>(static_cast<int32_t>(v))); }
+  static sreg_t sgn(reg_t v) { return static_cast<sreg_t>(v); }
+  static const int SHMASK = XLEN - 1;
+
+  uint32_t roundingMode(const Op& o) const { return (o.rm == 7) ? frm : o.rm; }
+
+  /// 上位 XLEN ビットの積
+  static reg_t mulhu(reg_t a, reg_t b) {
+    if (XLEN == 32) {
+      return static_cast<reg_t>((static_cast<uint64_t>(a) * b) >> 32);
+    }
+    const uint64_t al = static_cast<uint32_t>(a), ah = static_cast<uint64_t>(a) >> 32;
+    const uint64_t bl = static_cast<uint32_t>(b), bh = static_cast<uint64_t>(b) >> 32;
+    const uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+    const uint64_t mid = (ll >> 32) + static_cast<uint32_t>(lh) + static_cast<uint32_t>(hl);
+    return static_cast<reg_t>(hh + (lh >> 32) + (hl >> 32) + (mid >> 32));
+  }
+  static reg_t mulh(reg_t a, reg_t b) {
+    reg_t r = mulhu(a, b);
+    if (sgn(a) < 0) r -= b;
+    if (sgn(b) < 0) r -= a;
+    return r;
+  }
+  static reg_t mulhsu(reg_t a, reg_t b) {
+    reg_t r = mulhu(a, b);
+    if (sgn(a) < 0) r -= b;
+    return r;
+  }
+
+  template <class S, class U>
+  static S div(S a, S b) {
+    if (b == 0) return -1;
+    if (a == std::numeric_limits<S>::min() && b == -1) return a;
+    return a / b;
+  }
+  template <class S, class U>
+  static S rem(S a, S b) {
+    if (b == 0) return a;
+    if (a == std::numeric_limits<S>::min() && b == -1) return 0;
+    return a % b;
+  }
+  template <class U>
+  static U divu(U a, U b) { return (b == 0) ? static_cast<U>(-1) : a / b; }
+  template <class U>
+  static U remu(U a, U b) { return (b == 0) ? a : a % b; }
+
+  // 制御
+  static void opNext(Emulator& e, const Op& o) { e.nextPc = o.imm; }
+  static void opIllegal(Emulator&, const Op& o) { throw EmulatorException("illegal instruction", o.pc); }
+  static void opEcall(Emulator&, const Op& o) { throw EmulatorException("ecall", o.pc); }
+  static void opEbreak(Emulator&, const Op& o) { throw EmulatorException("ebreak", o.pc); }
+  static void opFenceI(Emulator& e, const Op& o) {
+    e.flushPending = true;
+    e.nextPc = o.next;
+  }
+  static void opJal(Emulator& e, const Op& o) {
+    e.x[o.rd] = o.next;
+    e.nextPc = o.imm;
+  }
+  static void opJalr(Emulator& e, const Op& o) {
+    const reg_t t = (e.x[o.rs1] + o.imm) & ~static_cast<reg_t>(1);
+    e.x[o.rd] = o.next;
+    e.nextPc = t;
+  }
+  template <int F3>
+  static void opBranch(Emulator& e, const Op& o) {
+    const reg_t a = e.x[o.rs1], b = e.x[o.rs2];
+    bool c;
+    switch (F3) {
+      case 0: c = a == b; break;
+      case 1: c = a != b; break;
+      case 4: c = sgn(a) < sgn(b); break;
+      case 5: c = sgn(a) >= sgn(b); break;
+      case 6: c = a < b; break;
+      default: c = a >= b; break;
+    }
+    e.nextPc = c ? o.imm : o.next;
+  }
+
+  // ロード・ストア
+  template <class T>
+  static void opLoad(Emulator& e, const Op& o) {
+    const T v = e.load<T>(e.x[o.rs1] + o.imm, o.pc);
+    e.x[o.rd] = std::is_signed<T>::value ? sx(static_cast<int64_t>(v)) : static_cast<reg_t>(v);
+  }
+  template <class T>
+  static void opStore(Emulator& e, const Op& o) {
+    e.store<T>(e.x[o.rs1] + o.imm, static_cast<T>(e.x[o.rs2]), o.pc);
+  }
+  template <class F>
+  static void opLoadFp(Emulator& e, const Op& o) {
+    e.setF<F>(o.rd, e.load<F>(e.x[o.rs1] + o.imm, o.pc));
+  }
+  template <class F>
+  static void opStoreFp(Emulator& e, const Op& o) {
+    typedef typename std::conditional<sizeof(F) == 4, uint32_t, uint64_t>::type bits_t;
+    e.store<bits_t>(e.x[o.rs1] + o.imm, static_cast<bits_t>(e.f[o.rs2]), o.pc);
+  }
+
+  // アトミック(シングルスレッドなので通常のロード・ストアで実現する)
+  template <class T>
+  static void opLr(Emulator& e, const Op& o) {
+    const reg_t addr = e.x[o.rs1];
+    e.x[o.rd] = sx(static_cast<int64_t>(e.load<T>(addr, o.pc)));
+    e.reservation = addr;
+    e.reserved = true;
+  }
+  template <class T>
+  static void opSc(Emulator& e, const Op& o) {
+    const reg_t addr = e.x[o.rs1];
+    if (e.reserved && e.reservation == addr) {
+      e.store<T>(addr, static_cast<T>(e.x[o.rs2]), o.pc);
+      e.x[o.rd] = 0;
+    } else {
+      e.x[o.rd] = 1;
+    }
+    e.reserved = false;
+  }
+  template <class T, int F5>
+  static void opAmo(Emulator& e, const Op& o) {
+    typedef typename std::make_unsigned<T>::type U;
+    const reg_t addr = e.x[o.rs1];
+    const T a = e.load<T>(addr, o.pc);
+    const T b = static_cast<T>(e.x[o.rs2]);
+    T r;
+    switch (F5) {
+      case 0x00: r = static_cast<T>(static_cast<U>(a) + static_cast<U>(b)); break;
+      case 0x01: r = b; break;
+      case 0x04: r = a ^ b; break;
+      case 0x08: r = a | b; break;
+      case 0x0c: r = a & b; break;
+      case 0x10: r = std::min(a, b); break;
+      case 0x14: r = std::max(a, b); break;
+      case 0x18: r = static_cast<T>(std::min(static_cast<U>(a), static_cast<U>(b))); break;
+      default: r = static_cast<T>(std::max(static_cast<U>(a), static_cast<U>(b))); break;
+    }
+    e.store<T>(addr, r, o.pc);
+    e.x[o.rd] = sx(static_cast<int64_t>(a));
+  }
+
+  // CSR
+  reg_t readCsr(uint32_t csr, reg_t pc) const {
+    switch (csr) {
+      case 0x001: return fflags;
+      case 0x002: return frm;
+      case 0x003: return (frm << 5) | fflags;
+      case 0xc00:  // cycle
+      case 0xc01:  // time
+      case 0xc02:  // instret
+        return static_cast<reg_t>(instret);
+      case 0xc80:  // cycleh
+      case 0xc81:  // timeh
+      case 0xc82:  // instreth
+        if (XLEN == 32) {
+          return static_cast<reg_t>(instret >> 32);
+        }
+        break;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "unsupported csr 0x%03x", csr);
+    throw EmulatorException(buf, pc);
+  }
+  void writeCsr(uint32_t csr, reg_t v, reg_t pc) {
+    switch (csr) {
+      case 0x001: fflags = v & 0x1f; return;
+      case 0x002: frm = v & 7; return;
+      case 0x003:
+        fflags = v & 0x1f;
+        frm = (v >> 5) & 7;
+        return;
+    }
+    char buf[40];
+    snprintf(buf, sizeof(buf), "write to read-only csr 0x%03x", csr);
+    throw EmulatorException(buf, pc);
+  }
+  /// F3: 1 CSRRW 2 CSRRS 3 CSRRC (4 を足すと rs1 の代わりに即値)
+  template <int F3>
+  static void opCsr(Emulator& e, const Op& o) {
+    const uint32_t csr = static_cast<uint32_t>(o.imm);
+    const reg_t src = (F3 & 4) ? o.rs1 : e.x[o.rs1];
+    const bool write = (F3 & 3) == 1 || o.rs1 != 0;
+    const reg_t old = ((F3 & 3) == 1 && o.rd == SINK) ? 0 : e.readCsr(csr, o.pc);
+    if (write) {
+      e.writeCsr(csr, ((F3 & 3) == 1) ? src : ((F3 & 3) == 2) ? (old | src) : (old & ~src), o.pc);
+    }
+    e.x[o.rd] = old;
+  }
+
+  // 浮動小数点演算
+  template <class F>
+  static void opFadd(Emulator& e, const Op& o) { e.setF<F>(o.rd, canonical(e.getF<F>(o.rs1) + e.getF<F>(o.rs2))); }
+  template <class F>
+  static void opFsub(Emulator& e, const Op& o) { e.setF<F>(o.rd, canonical(e.getF<F>(o.rs1) - e.getF<F>(o.rs2))); }
+  template <class F>
+  static void opFmul(Emulator& e, const Op& o) { e.setF<F>(o.rd, canonical(e.getF<F>(o.rs1) * e.getF<F>(o.rs2))); }
+  template <class F>
+  static void opFdiv(Emulator& e, const Op& o) { e.setF<F>(o.rd, canonical(e.getF<F>(o.rs1) / e.getF<F>(o.rs2))); }
+  template <class F>
+  static void opFsqrt(Emulator& e, const Op& o) { e.setF<F>(o.rd, canonical(std::sqrt(e.getF<F>(o.rs1)))); }
+  /// N: 0 FMADD 1 FMSUB 2 FNMSUB 3 FNMADD
+  template <class F, int N>
+  static void opFma(Emulator& e, const Op& o) {
+    F a = e.getF<F>(o.rs1);
+    F c = e.getF<F>(o.rs3);
+    if (N == 2 || N == 3) a = -a;
+    if (N == 1 || N == 3) c = -c;
+    e.setF<F>(o.rd, canonical(std::fma(a, e.getF<F>(o.rs2), c)));
+  }
+  /// F3: 0 FSGNJ 1 FSGNJN 2 FSGNJX
+  template <class F, int F3>
+  static void opFsgnj(Emulator& e, const Op& o) {
+    const F a = e.getF<F>(o.rs1), b = e.getF<F>(o.rs2);
+    bool neg;
+    switch (F3) {
+      case 0: neg = std::signbit(b); break;
+      case 1: neg = !std::signbit(b); break;
+      default: neg = std::signbit(a) != std::signbit(b); break;
+    }
+    e.setF<F>(o.rd, std::copysign(a, neg ? F(-1) : F(1)));
+  }
+  template <class F, bool MAX>
+  static void opFminmax(Emulator& e, const Op& o) {
+    const F a = e.getF<F>(o.rs1), b = e.getF<F>(o.rs2);
+    F r;
+    if (std::isnan(a) || std::isnan(b)) {
+      r = canonical(std::isnan(a) ? b : a);
+    } else if (a == b) {
+      // -0.0 < +0.0
+      r = (std::signbit(a) == MAX) ? b : a;
+    } else {
+      r = ((a < b) != MAX) ? a : b;
+    }
+    e.setF<F>(o.rd, r);
+  }
+  /// F3: 0 FLE 1 FLT 2 FEQ
+  template <class F, int F3>
+  static void opFcmp(Emulator& e, const Op& o) {
+    const F a = e.getF<F>(o.rs1), b = e.getF<F>(o.rs2);
+    e.x[o.rd] = (F3 == 0) ? (a <= b) : (F3 == 1) ? (a < b) : (a == b);
+  }
+  template <class F>
+  static void opFclass(Emulator& e, const Op& o) { e.x[o.rd] = fclass(e.getF<F>(o.rs1)); }
+  template <class F, class I>
+  static void opFcvtToInt(Emulator& e, const Op& o) {
+    e.x[o.rd] = sx(static_cast<int64_t>(toInt<I>(e.getF<F>(o.rs1), e.roundingMode(o))));
+  }
+  template <class F, class I>
+  static void opFcvtFromInt(Emulator& e, const Op& o) { e.setF<F>(o.rd, static_cast<F>(static_cast<I>(e.x[o.rs1]))); }
+  template <class F, class G>
+  static void opFcvtFp(Emulator& e, const Op& o) { e.setF<F>(o.rd, canonical(static_cast<F>(e.getF<G>(o.rs1)))); }
+  static void opFmvXW(Emulator& e, const Op& o) { e.x[o.rd] = sx32(e.f[o.rs1]); }
+  static void opFmvWX(Emulator& e, const Op& o) { e.f[o.rd] = 0xffffffff00000000ull | static_cast<uint32_t>(e.x[o.rs1]); }
+  static void opFmvXD(Emulator& e, const Op& o) { e.x[o.rd] = static_cast<reg_t>(e.f[o.rs1]); }
+  static void opFmvDX(Emulator& e, const Op& o) { e.f[o.rd] = e.x[o.rs1]; }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // デコード
+
+  /**
+   * 32ビット命令 insn をデコードして o に設定する
+   * len は元の命令の長さ(圧縮命令なら2)。ブロックを終える命令なら true を返す
+   */
+  static bool decode(uint32_t insn, reg_t pc, int len, Op& o) {
+    const uint32_t opcode = insn & 0x7f;
+    const uint32_t rd = (insn >> 7) & 0x1f;
+    const uint32_t funct3 = (insn >> 12) & 7;
+    const uint32_t funct7 = insn >> 25;
+    const int32_t immI = static_cast<int32_t>(insn) >> 20;
+    const int32_t immS = ((static_cast<int32_t>(insn) >> 25) << 5) | static_cast<int32_t>((insn >> 7) & 0x1f);
+
+    o.fn = opIllegal;
+    o.rd = static_cast<uint8_t>((rd == 0) ? SINK : rd);
+    o.rs1 = static_cast<uint8_t>((insn >> 15) & 0x1f);
+    o.rs2 = static_cast<uint8_t>((insn >> 20) & 0x1f);
+    o.rs3 = static_cast<uint8_t>(insn >> 27);
+    o.rm = static_cast<uint8_t>(funct3);
+    o.imm = sx(immI);
+    o.next = pc + len;
+    o.pc = pc;
+
+    // 浮動小数点の命令は rd をそのまま使う
+    const auto fpRd = [&o, rd]() { o.rd = static_cast<uint8_t>(rd); };
+    // 整数型の処理関数を XLEN で選ぶ
+    const auto pick = [](Handler h32, Handler h64) { return (XLEN == 32) ? h32 : h64; };
+
+    switch (opcode) {
+      case 0x37:  // LUI
+      case 0x17:  // AUIPC
+        o.imm = sx(static_cast<int32_t>(insn & 0xfffff000)) + ((opcode == 0x17) ? pc : 0);
+        o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = o.imm; };
+        return false;
+      case 0x6f: {  // JAL
+        addrdiff_t off;
+        insnFlow(insn, off);
+        o.imm = pc + static_cast<reg_t>(off);
+        o.fn = opJal;
+        return true;
+      }
+      case 0x67:  // JALR
+        o.fn = opJalr;
+        return true;
+      case 0x63: {  // BRANCH
+        addrdiff_t off;
+        insnFlow(insn, off);
+        o.imm = pc + static_cast<reg_t>(off);
+        static const Handler branches[] = {opBranch<0>, opBranch<1>, nullptr, nullptr, opBranch<4>, opBranch<5>, opBranch<6>, opBranch<7>};
+        o.fn = (branches[funct3] != nullptr) ? branches[funct3] : opIllegal;
+        return true;
+      }
+      case 0x03: {  // LOAD
+        static const Handler loads[] = {opLoad<int8_t>, opLoad<int16_t>, opLoad<int32_t>, (XLEN == 64) ? opLoad<int64_t> : nullptr,
+                                        opLoad<uint8_t>, opLoad<uint16_t>, (XLEN == 64) ? opLoad<uint32_t> : nullptr, nullptr};
+        if (loads[funct3] != nullptr) {
+          o.fn = loads[funct3];
+        }
+        break;
+      }
+      case 0x23: {  // STORE
+        o.imm = sx(immS);
+        static const Handler stores[] = {opStore<uint8_t>, opStore<uint16_t>, opStore<uint32_t>, opStore<uint64_t>};
+        if (funct3 < 3 || (funct3 == 3 && XLEN == 64)) {
+          o.fn = stores[funct3];
+        }
+        break;
+      }
+      case 0x13:  // OP-IMM
+        switch (funct3) {
+          case 0: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] + o.imm; }; break;
+          case 2: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sgn(e.x[o.rs1]) < sgn(o.imm); }; break;
+          case 3: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] < o.imm; }; break;
+          case 4: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] ^ o.imm; }; break;
+          case 6: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] | o.imm; }; break;
+          case 7: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] & o.imm; }; break;
+          case 1:
+            o.imm &= SHMASK;
+            o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] << o.imm; };
+            break;
+          case 5:
+            o.imm &= SHMASK;
+            if (insn & 0x40000000) {
+              o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = static_cast<reg_t>(sgn(e.x[o.rs1]) >> o.imm); };
+            } else {
+              o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] >> o.imm; };
+            }
+            break;
+        }
+        break;
+      case 0x1b:  // OP-IMM-32
+        if (XLEN == 32) {
+          break;
+        }
+        switch (funct3) {
+          case 0: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sx32(e.x[o.rs1] + o.imm); }; break;
+          case 1:
+            o.imm &= 31;
+            o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sx32(static_cast<uint32_t>(e.x[o.rs1]) << o.imm); };
+            break;
+          case 5:
+            o.imm &= 31;
+            if (insn & 0x40000000) {
+              o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sx32(static_cast<uint32_t>(static_cast<int32_t>(e.x[o.rs1]) >> o.imm)); };
+            } else {
+              o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sx32(static_cast<uint32_t>(e.x[o.rs1]) >> o.imm); };
+            }
+            break;
+        }
+        break;
+      case 0x33:  // OP
+        if (funct7 == 0x01) {  // M
+          switch (funct3) {
+            case 0: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] * e.x[o.rs2]; }; break;
+            case 1: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = mulh(e.x[o.rs1], e.x[o.rs2]); }; break;
+            case 2: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = mulhsu(e.x[o.rs1], e.x[o.rs2]); }; break;
+            case 3: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = mulhu(e.x[o.rs1], e.x[o.rs2]); }; break;
+            case 4: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = static_cast<reg_t>(div<sreg_t, reg_t>(sgn(e.x[o.rs1]), sgn(e.x[o.rs2]))); }; break;
+            case 5: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = divu<reg_t>(e.x[o.rs1], e.x[o.rs2]); }; break;
+            case 6: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = static_cast<reg_t>(rem<sreg_t, reg_t>(sgn(e.x[o.rs1]), sgn(e.x[o.rs2]))); }; break;
+            case 7: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = remu<reg_t>(e.x[o.rs1], e.x[o.rs2]); }; break;
+          }
+        } else if (funct7 == 0x00) {
+          switch (funct3) {
+            case 0: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] + e.x[o.rs2]; }; break;
+            case 1: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] << (e.x[o.rs2] & SHMASK); }; break;
+            case 2: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sgn(e.x[o.rs1]) < sgn(e.x[o.rs2]); }; break;
+            case 3: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] < e.x[o.rs2]; }; break;
+            case 4: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] ^ e.x[o.rs2]; }; break;
+            case 5: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] >> (e.x[o.rs2] & SHMASK); }; break;
+            case 6: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] | e.x[o.rs2]; }; break;
+            case 7: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] & e.x[o.rs2]; }; break;
+          }
+        } else if (funct7 == 0x20) {
+          if (funct3 == 0) {
+            o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = e.x[o.rs1] - e.x[o.rs2]; };
+          } else if (funct3 == 5) {
+            o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = static_cast<reg_t>(sgn(e.x[o.rs1]) >> (e.x[o.rs2] & SHMASK)); };
+          }
+        }
+        break;
+      case 0x3b:  // OP-32
+        if (XLEN == 32) {
+          break;
+        }
+        if (funct7 == 0x01) {
+          switch (funct3) {
+            case 0: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sx32(e.x[o.rs1] * e.x[o.rs2]); }; break;
+            case 4: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sx32(static_cast<uint32_t>(div<int32_t, uint32_t>(static_cast<int32_t>(e.x[o.rs1]), static_cast<int32_t>(e.x[o.rs2])))); }; break;
+            case 5: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sx32(divu<uint32_t>(static_cast<uint32_t>(e.x[o.rs1]), static_cast<uint32_t>(e.x[o.rs2]))); }; break;
+            case 6: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sx32(static_cast<uint32_t>(rem<int32_t, uint32_t>(static_cast<int32_t>(e.x[o.rs1]), static_cast<int32_t>(e.x[o.rs2])))); }; break;
+            case 7: o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sx32(remu<uint32_t>(static_cast<uint32_t>(e.x[o.rs1]), static_cast<uint32_t>(e.x[o.rs2]))); }; break;
+          }
+        } else if (funct7 == 0x00 || funct7 == 0x20) {
+          const bool alt = funct7 == 0x20;
+          if (funct3 == 0) {
+            o.fn = alt ? static_cast<Handler>([](Emulator& e, const Op& o) { e.x[o.rd] = sx32(e.x[o.rs1] - e.x[o.rs2]); })
+                       : static_cast<Handler>([](Emulator& e, const Op& o) { e.x[o.rd] = sx32(e.x[o.rs1] + e.x[o.rs2]); });
+          } else if (funct3 == 1 && !alt) {
+            o.fn = [](Emulator& e, const Op& o) { e.x[o.rd] = sx32(static_cast<uint32_t>(e.x[o.rs1]) << (e.x[o.rs2] & 31)); };
+          } else if (funct3 == 5) {
+            o.fn = alt ? static_cast<Handler>([](Emulator& e, const Op& o) { e.x[o.rd] = sx32(static_cast<uint32_t>(static_cast<int32_t>(e.x[o.rs1]) >> (e.x[o.rs2] & 31))); })
+                       : static_cast<Handler>([](Emulator& e, const Op& o) { e.x[o.rd] = sx32(static_cast<uint32_t>(e.x[o.rs1]) >> (e.x[o.rs2] & 31)); });
+          }
+        }
+        break;
+      case 0x0f:  // MISC-MEM
+        if (funct3 == 1) {  // FENCE.I
+          o.fn = opFenceI;
+          return true;
+        }
+        o.fn = [](Emulator&, const Op&) {};  // FENCE
+        return false;
+      case 0x73:  // SYSTEM
+        if (funct3 == 0) {
+          if (insn == 0x00000073) {
+            o.fn = opEcall;
+          } else if (insn == 0x00100073) {
+            o.fn = opEbreak;
+          }
+          return true;
+        }
+        o.imm = insn >> 20;
+        {
+          static const Handler csrs[] = {nullptr, opCsr<1>, opCsr<2>, opCsr<3>, nullptr, opCsr<5>, opCsr<6>, opCsr<7>};
+          if (csrs[funct3] != nullptr) {
+            o.fn = csrs[funct3];
+          }
+        }
+        break;
+      case 0x2f: {  // AMO
+        if (funct3 != 2 && !(funct3 == 3 && XLEN == 64)) {
+          break;
+        }
+        const bool w = funct3 == 2;
+        const uint32_t funct5 = insn >> 27;
+        switch (funct5) {
+          case 0x02: o.fn = w ? opLr<int32_t> : pick(opIllegal, opLr<int64_t>); break;
+          case 0x03: o.fn = w ? opSc<int32_t> : pick(opIllegal, opSc<int64_t>); break;
+#define XKON_EMU_AMO(f5) \
+  case f5:               \
+    o.fn = w ? opAmo<int32_t, f5> : pick(opIllegal, opAmo<int64_t, f5>); \
+    break;
+          XKON_EMU_AMO(0x00)
+          XKON_EMU_AMO(0x01)
+          XKON_EMU_AMO(0x04)
+          XKON_EMU_AMO(0x08)
+          XKON_EMU_AMO(0x0c)
+          XKON_EMU_AMO(0x10)
+          XKON_EMU_AMO(0x14)
+          XKON_EMU_AMO(0x18)
+          XKON_EMU_AMO(0x1c)
+#undef XKON_EMU_AMO
+        }
+        break;
+      }
+      case 0x07:  // LOAD-FP
+        fpRd();
+        if (funct3 == 2) {
+          o.fn = opLoadFp<float>;
+        } else if (funct3 == 3) {
+          o.fn = opLoadFp<double>;
+        }
+        break;
+      case 0x27:  // STORE-FP
+        o.imm = sx(immS);
+        if (funct3 == 2) {
+          o.fn = opStoreFp<float>;
+        } else if (funct3 == 3) {
+          o.fn = opStoreFp<double>;
+        }
+        break;
+      case 0x43:  // FMADD
+      case 0x47:  // FMSUB
+      case 0x4b:  // FNMSUB
+      case 0x4f: {  // FNMADD
+        fpRd();
+        static const Handler fmas[2][4] = {{opFma<float, 0>, opFma<float, 1>, opFma<float, 2>, opFma<float, 3>},
+                                           {opFma<double, 0>, opFma<double, 1>, opFma<double, 2>, opFma<double, 3>}};
+        const uint32_t fmt = (insn >> 25) & 3;
+        if (fmt < 2) {
+          o.fn = fmas[fmt][(opcode >> 2) & 3];
+        }
+        break;
+      }
+      case 0x53:  // OP-FP
+        decodeFp(insn, o);
+        break;
+    }
+    return o.fn == opIllegal;
+  }
+
+  template <class F>
+  static void decodeFpFmt(uint32_t insn, Op& o) {
+    typedef typename std::conditional<sizeof(F) == 4, double, float>::type G;  // もう一方の形式
+    const uint32_t rd = (insn >> 7) & 0x1f;
+    const uint32_t funct3 = (insn >> 12) & 7;
+    const uint32_t rs2 = (insn >> 20) & 0x1f;
+    const bool d = sizeof(F) == 8;
+
+    // 結果を浮動小数点レジスタに書き込む命令
+    const auto fpRd = [&o, rd](Handler h) {
+      o.rd = static_cast<uint8_t>(rd);
+      o.fn = h;
+    };
+    switch (insn >> 27) {
+      case 0x00: fpRd(opFadd<F>); break;
+      case 0x01: fpRd(opFsub<F>); break;
+      case 0x02: fpRd(opFmul<F>); break;
+      case 0x03: fpRd(opFdiv<F>); break;
+      case 0x0b:
+        if (rs2 == 0) fpRd(opFsqrt<F>);
+        break;
+      case 0x04: {
+        static const Handler h[] = {opFsgnj<F, 0>, opFsgnj<F, 1>, opFsgnj<F, 2>};
+        if (funct3 < 3) fpRd(h[funct3]);
+        break;
+      }
+      case 0x05:
+        if (funct3 < 2) fpRd(funct3 ? opFminmax<F, true> : opFminmax<F, false>);
+        break;
+      case 0x08:  // FCVT.S.D / FCVT.D.S
+        if (rs2 == (d ? 0u : 1u)) fpRd(opFcvtFp<F, G>);
+        break;
+      case 0x14: {
+        static const Handler h[] = {opFcmp<F, 0>, opFcmp<F, 1>, opFcmp<F, 2>};
+        if (funct3 < 3) o.fn = h[funct3];
+        break;
+      }
+      case 0x18: {  // FCVT.W/WU/L/LU
+        static const Handler h[] = {opFcvtToInt<F, int32_t>, opFcvtToInt<F, uint32_t>, opFcvtToInt<F, int64_t>, opFcvtToInt<F, uint64_t>};
+        if (rs2 < 2 || (rs2 < 4 && XLEN == 64)) o.fn = h[rs2];
+        break;
+      }
+      case 0x1a: {  // FCVT.[SD].W/WU/L/LU
+        static const Handler h[] = {opFcvtFromInt<F, int32_t>, opFcvtFromInt<F, uint32_t>, opFcvtFromInt<F, int64_t>, opFcvtFromInt<F, uint64_t>};
+        if (rs2 < 2 || (rs2 < 4 && XLEN == 64)) fpRd(h[rs2]);
+        break;
+      }
+      case 0x1c:
+        if (funct3 == 1) {
+          o.fn = opFclass<F>;
+        } else if (funct3 == 0 && rs2 == 0) {
+          if (!d) {
+            o.fn = opFmvXW;
+          } else if (XLEN == 64) {
+            o.fn = opFmvXD;
+          }
+        }
+        break;
+      case 0x1e:
+        if (funct3 == 0 && rs2 == 0) {
+          if (!d) {
+            fpRd(opFmvWX);
+          } else if (XLEN == 64) {
+            fpRd(opFmvDX);
+          }
+        }
+        break;
+    }
+  }
+
+  static void decodeFp(uint32_t insn, Op& o) {
+    switch ((insn >> 25) & 3) {
+      case 0:
+        decodeFpFmt<float>(insn, o);
+        break;
+      case 1:
+        decodeFpFmt<double>(insn, o);
+        break;
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // ブロックキャッシュ
+
+  /// アドレス pc から始まるブロックをデコードする
+  Block* build(reg_t pc) {
+    std::unique_ptr<Block> b(new Block());
+    b->insns = 0;
+    b->exit = false;
+    b->links[0] = b->links[1] = typename Block::Link{0, nullptr};
+
+    const auto host = hosts.find(pc);
+    if (pc == exitAddr) {
+      b->exit = true;
+    } else if (host != hosts.end()) {
+      b->host = host->second;
+    } else {
+      reg_t addr = pc;
+      bool end = false;
+      translate(pc, 2, pc);
+      while (!end && b->ops.size() < MAX_OPS) {
+        const char* p = find(addr, 2);
+        if (p == nullptr) {
+          break;
+        }
+        uint16_t lo;
+        memcpy(&lo, p, 2);
+        Op o;
+        if ((lo & 3) == 3) {
+          p = find(addr, 4);
+          if (p == nullptr) {
+            break;
+          }
+          uint32_t insn;
+          memcpy(&insn, p, 4);
+          end = decode(insn, addr, 4, o);
+          addr += 4;
+        } else {
+          const uint32_t insn = insnExpand(lo, XLEN);
+          end = decode(insn, addr, 2, o);
+          if (insn == 0) {
+            o.fn = opIllegal;
+            end = true;
+          }
+          addr += 2;
+        }
+        b->ops.push_back(o);
+        b->insns++;
+      }
+      if (!end) {
+        Op o = Op();
+        o.fn = opNext;
+        o.imm = addr;
+        o.pc = addr;
+        b->ops.push_back(o);
+      }
+    }
+    Block* res = b.get();
+    blocks[pc] = std::move(b);
+    return res;
+  }
+
+  Block* lookup(reg_t pc) {
+    const auto itr = blocks.find(pc);
+    return (itr != blocks.end()) ? itr->second.get() : build(pc);
+  }
+
+  /// ブロック b の次に実行するブロック
+  Block* chain(Block* b, reg_t pc) {
+    for (auto& l : b->links) {
+      if (l.block != nullptr && l.addr == pc) {
+        return l.block;
+      }
+    }
+    Block* n = lookup(pc);
+    typename Block::Link& l = (b->links[0].block == nullptr) ? b->links[0] : b->links[1];
+    l.addr = pc;
+    l.block = n;
+    return n;
+  }
+
+  void run(reg_t pc) {
+    Block* b = lookup(pc);
+    while (!b->exit) {
+      if (b->host) {
+        // ホストの関数を呼び出して ra に戻る
+        const reg_t ra = x[1];
+        b->host(*this);
+        nextPc = ra;
+      } else {
+        for (const Op& o : b->ops) {
+          o.fn(*this, o);
+        }
+        instret += b->insns;
+      }
+      if (flushPending) {
+        flushPending = false;
+        blocks.clear();
+        b = lookup(nextPc);
+      } else {
+        b = chain(b, nextPc);
+      }
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // ホスト呼出しの引数と戻り値の変換
+
+  template <class T>
+  struct Arg {
+    static T get(Emulator&, reg_t v) { return static_cast<T>(v); }
+    static reg_t put(Emulator&, T v) { return static_cast<reg_t>(v); }
+  };
+  template <class T>
+  struct Arg<T*> {
+    static T* get(Emulator& e, reg_t v) { return (v == 0) ? nullptr : reinterpret_cast<T*>(e.translate(v, 1, e.x[1])); }
+    static reg_t put(Emulator& e, T* v) { return e.guest(v); }
+  };
+
+  template <class R, class Enable = void>
+  struct Invoker {
+    template <class... A, std::size_t... I>
+    static void invoke(Emulator& e, R (*f)(A...), std::index_sequence<I...>) {
+      e.x[10] = Arg<R>::put(e, f(Arg<A>::get(e, e.x[10 + I])...));
+    }
+  };
+  template <class Enable>
+  struct Invoker<void, Enable> {
+    template <class... A, std::size_t... I>
+    static void invoke(Emulator& e, void (*f)(A...), std::index_sequence<I...>) {
+      f(Arg<A>::get(e, e.x[10 + I])...);
+    }
+  };
+
+ public:
+  /// stackSize: call() で使用するスタックのサイズ
+  explicit Emulator(size_t stackSize = 1 << 20)
+      : x(), f(), fflags(0), frm(0), nextPc(0), reservation(0), reserved(false), flushPending(false), instret(0), depth(0),
+        stack(stackSize), exitAddr(0), regions(), lastRegion(0), hosts(), funcs(), blocks() {
+    map(stack.data(), stack.size());
+    exitAddr = guest(stack.data()) + static_cast<reg_t>(stack.size());
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // アドレス空間
+
+  /// ホストのアドレスに対応するゲストのアドレス(登録されていなければ下位 XLEN ビット)
+  reg_t guest(const void* p) const {
+    const char* c = static_cast<const char*>(p);
+    for (const Region& r : regions) {
+      if (r.host <= c && c < r.host + r.size) {
+        return r.guest + static_cast<reg_t>(c - r.host);
+      }
+    }
+    const auto itr = funcs.find(p);
+    if (itr != funcs.end()) {
+      return itr->second;
+    }
+    return static_cast<reg_t>(reinterpret_cast<uintptr_t>(p));
+  }
+
+ private:
+  /// ホストのアドレス host から size バイトを置くゲストのアドレス
+  /// ホストのアドレスが XLEN ビットに収まればそのまま、収まらなければ登録済みの領域・ホスト呼出しのアドレスと
+  /// 重ならない最初の範囲(PAGE 境界から始まり、後ろに1ページ空ける)
+  reg_t place(const void* host, size_t size) const {
+    if (sizeof(void*) * 8 <= XLEN) {
+      return static_cast<reg_t>(reinterpret_cast<uintptr_t>(host));
+    }
+    const uint64_t limit = uint64_t(1) << 32;
+    const auto alignUp = [](uint64_t n) { return (n + PAGE - 1) & ~uint64_t(PAGE - 1); };
+    uint64_t start = PAGE;  // 0 番地付近は空けておく
+    for (bool moved = true; moved;) {
+      moved = false;
+      const uint64_t end = start + alignUp(size) + PAGE;
+      XKON_ASSERT(end <= limit);
+      for (const Region& r : regions) {
+        if (r.guest < end && start < r.guest + r.size) {
+          start = alignUp(r.guest + r.size) + PAGE;
+          moved = true;
+        }
+      }
+      for (const auto& e : hosts) {
+        if (e.first < end && start <= e.first) {
+          start = alignUp(e.first + 1) + PAGE;
+          moved = true;
+        }
+      }
+    }
+    return static_cast<reg_t>(start);
+  }
+
+ public:
+
+  /// ホストの領域 host から size バイトをゲストのアドレス guest に登録する
+  void map(reg_t guest, void* host, size_t size) {
+    for (const Region& r : regions) {
+      XKON_ASSERT(guest + size <= r.guest || r.guest + r.size <= guest);
+    }
+    regions.push_back(Region{guest, static_cast<char*>(host), size});
+    invalidate();
+  }
+  /// ホストの領域を登録して、割り当てたゲストのアドレスを返す(ファイル先頭の説明を参照)
+  reg_t map(const void* host, size_t size) {
+    const reg_t addr = place(host, size);
+    map(addr, const_cast<void*>(host), size);
+    return addr;
+  }
+
+  /// host から始まる領域の登録を解除する
+  void unmap(const void* host) {
+    for (auto itr = regions.begin(); itr != regions.end(); ++itr) {
+      if (itr->host == host) {
+        regions.erase(itr);
+        break;
+      }
+    }
+    lastRegion = 0;
+    invalidate();
+  }
+
+  /// ゲストのアドレス addr に対応するホストのアドレス
+  template <class T>
+  T* ptr(reg_t addr) { return reinterpret_cast<T*>(translate(addr, sizeof(T), addr)); }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // ホスト呼出し
+
+  /// ゲストのアドレス addr への呼出しでホストの関数 func を呼び出す
+  /// func は arg()/setResult() で引数と戻り値を受け渡す
+  void bind(reg_t addr, HostFunc func) {
+    hosts[addr] = func;
+    invalidate();
+  }
+
+  /// C の関数 func を、割り当てたゲストのアドレスへの呼出しで呼び出す。アドレスは guest(func) でも得られる
+  /// 引数と戻り値は整数かポインタのみ(ポインタはゲストとホストのアドレスを変換する)
+  template <class R, class... A>
+  reg_t bind(R (*func)(A...)) {
+    const void* host = reinterpret_cast<const void*>(func);
+    const reg_t addr = place(host, 1);
+    funcs[host] = addr;
+    bind(addr, [func](Emulator& e) { Invoker<R>::invoke(e, func, std::index_sequence_for<A...>()); });
+    return addr;
+  }
+
+  reg_t arg(int i) const { return x[10 + i]; }
+  void setResult(reg_t v) { x[10] = v; }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // 実行
+
+  /**
+   * ホストのアドレス entry の関数を引数 args で呼び出し、a0 を返す
+   * ホスト呼出しの中から呼ばれた場合は、呼出し元の sp の下にスタックを積む
+   */
+  reg_t call(const void* entry, std::initializer_list<reg_t> args = {}) {
+    XKON_ASSERT(args.size() <= 8);
+    const reg_t sp = x[2], ra = x[1];
+    if (depth == 0) {
+      x[2] = exitAddr & ~static_cast<reg_t>(15);
+    }
+    int i = 10;
+    for (reg_t a : args) {
+      x[i++] = a;
+    }
+    x[1] = exitAddr;
+    depth++;
+    try {
+      run(guest(entry));
+    } catch (...) {
+      depth--;
+      throw;
+    }
+    depth--;
+    x[2] = sp;
+    x[1] = ra;
+    return x[10];
+  }
+
+  /// デコード済みのブロックを破棄する(コードを書き換えた場合に呼ぶ)
+  void invalidate() { blocks.clear(); }
+
+  reg_t getReg(int i) const { return x[i]; }
+  void setReg(int i, reg_t v) {
+    if (i != 0) {
+      x[i] = v;
+    }
+  }
+  uint64_t getFReg(int i) const { return f[i]; }
+  void setFReg(int i, uint64_t v) { f[i] = v; }
+
+  /// 実行した命令数
+  uint64_t getInstret() const { return instret; }
+  /// デコード済みのブロック数
+  size_t getBlockCount() const { return blocks.size(); }
+};
+
+template <int XLEN>
+template <class F>
+F Emulator<XLEN>::getF(int i) const {
+  if (sizeof(F) == 4) {
+    // NaN-boxing されていなければ正規化された NaN
+    if ((f[i] >> 32) != 0xffffffffu) {
+      return std::numeric_limits<F>::quiet_NaN();
+    }
+    uint32_t b = static_cast<uint32_t>(f[i]);
+    F v;
+    memcpy(&v, &b, sizeof(v));
+    return v;
+  }
+  F v;
+  memcpy(&v, &f[i], sizeof(v));
+  return v;
+}
+
+template <int XLEN>
+template <class F>
+void Emulator<XLEN>::setF(int i, F v) {
+  if (sizeof(F) == 4) {
+    uint32_t b;
+    memcpy(&b, &v, sizeof(b));
+    f[i] = 0xffffffff00000000ull | b;
+  } else {
+    memcpy(&f[i], &v, sizeof(v));
+  }
+}
+
+}  // namespace emu
+}  // namespace xkon
@@ -0,0 +1,77 @@
+xkon_factor
+Prints the prime factors of each number from 2 to 255
+one number per line as in N: P1 P2 (trial division)
+Written for the xkon BF benchmark
+[-]++>>>[-]--[->>>>>>>>>>>>>>>>>>>>>>>>>>>[-]<[-]<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<[->>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>+>>>>+<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<<<<<<<<]>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>[-<<
+<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<+>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+>>>>>]<<<[-]++++++++++<[->->+<[>-]>[<++++++++++<<+>>>->]<<<]<<++
+++++++++>>>[-<<<->>>]<<<<<<<<<[-]>>>[-]>>>>[->+>>>>+<<<<<]>>>>>[
+-<<<<<+>>>>>]<<<[-]++++++++++<[->->+<[>-]>[<++++++++++<<<<<<<<<+
+>>>>>>>>>>->]<<<]<<<<<++++++++++>>>>>>[-<<<<<<->>>>>>]<<[-]<<<<<
+<+<[++++++++++++++++++++++++++++++++++++++++++++++++.-----------
+------------------------------------->-]>[->]<<[->>>>>>>>+>>>+<<
+<<<<<<<<<]>>>>>>>>>>>[-<<<<<<<<<<<+>>>>>>>>>>>]<<<<<<<<[->>>>>+>
+>>+<<<<<<<<]>>>>>>>>[-<<<<<<<<+>>>>>>>>]<<+<[<<<<<++++++++++++++
+++++++++++++++++++++++++++++++++++.-----------------------------
+------------------->>>>>>-]>[->]<<<<++++++++++++++++++++++++++++
+++++++++++++++++++++.-------------------------------------------
+----->>[-]<<<<<<<<[-]>>>[-]>>>[-]<<<<<<+++++++++++++++++++++++++
++++++++++++++++++++++++++++++++++.[-]<<<<<<<<<<<<<<<<<<<[-]<<<<[
+->>>>+>>>>>>>>>>>>>>>>>>>+<<<<<<<<<<<<<<<<<<<<<<<]>>>>>>>>>>>>>>
+>>>>>>>>>[-<<<<<<<<<<<<<<<<<<<<<<<+>>>>>>>>>>>>>>>>>>>>>>>]<<<<<
+<<<<<<<<<<<[-]++>>>>>>>>>>>>>[-]+[<<<<[-]<<<<<<<<<[->>>>>>>>>>>>
+>>>>+>+<<<<<<<<<<<<<<<<<]>>>>>>>>>>>>>>>>>[-<<<<<<<<<<<<<<<<<+>>
+>>>>>>>>>>>>>>>]<[-<<<<<<<<<<<<<<<<[->>>>>>>>>+>>>>>>>>+<<<<<<<<
+<<<<<<<<<]>>>>>>>>>>>>>>>>>[-<<<<<<<<<<<<<<<<<+>>>>>>>>>>>>>>>>>
+]<]<<<<<<<<<<<<<<<<<<<[->>>>>>>>>>>>>>>>>>>>+>>>>+<<<<<<<<<<<<<<
+<<<<<<<<<<]>>>>>>>>>>>>>>>>>>>>>>>>[-<<<<<<<<<<<<<<<<<<<<<<<<+>>
+>>>>>>>>>>>>>>>>>>>>>>]<<<<<<<<<<<<[->>>>>>>>>>>+>+<<<<<<<<<<<<]
+>>>>>>>>>>>>[-<<<<<<<<<<<<+>>>>>>>>>>>>]<<<<<[-]+>>>>[<<+<[->-]>
+[<<[-]>>->]>-]<<<[-]<<<<<<<[-]+>>>>>>[<<<<<<->>>>>>-]<<<<<+<[>>>
+>>>++++++++++++++++++++++++++++++++.[-]>>>>>>>[-]<[-]<<<<<<<<<<<
+<<<<<<<<<<<<<<[->>>>>>>>>>>>>>>>>>>>>>>>>>>+>>>>+<<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<]>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>[-<<<<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<+>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>]<<<[-]++++++++
+++<[->->+<[>-]>[<++++++++++<<+>>>->]<<<]<<++++++++++>>>[-<<<->>>
+]<<<<<<<<<[-]>>>[-]>>>>[->+>>>>+<<<<<]>>>>>[-<<<<<+>>>>>]<<<[-]+
++++++++++<[->->+<[>-]>[<++++++++++<<<<<<<<<+>>>>>>>>>>->]<<<]<<<
+<<++++++++++>>>>>>[-<<<<<<->>>>>>]<<[-]<<<<<<+<[++++++++++++++++
+++++++++++++++++++++++++++++++++.-------------------------------
+----------------->-]>[->]<<[->>>>>>>>+>>>+<<<<<<<<<<<]>>>>>>>>>>
+>[-<<<<<<<<<<<+>>>>>>>>>>>]<<<<<<<<[->>>>>+>>>+<<<<<<<<]>>>>>>>>
+[-<<<<<<<<+>>>>>>>>]<<+<[<<<<<++++++++++++++++++++++++++++++++++
+++++++++++++++.------------------------------------------------>
+>>>>>-]>[->]<<<<++++++++++++++++++++++++++++++++++++++++++++++++
+.------------------------------------------------>>[-]<<<<<<<<[-
+]>>>[-]>>>[-]<<<<<<<<<<<<<<<<<<<<<<<<<[-]+>>>>>>>>>>>>>>-]>[<<<<
+<<<<[-]>>>[-]<<<<<<<<<[->>>>>>>>>>>>>>>>>>>+>>>>+<<<<<<<<<<<<<<<
+<<<<<<<<]>>>>>>>>>>>>>>>>>>>>>>>[-<<<<<<<<<<<<<<<<<<<<<<<+>>>>>>
+>>>>>>>>>>>>>>>>>]<<<<<<<<<<<<<<<<<<<<[->>>>>>>>>>>>>>>>>+>>>+<<
+<<<<<<<<<<<<<<<<<<]>>>>>>>>>>>>>>>>>>>>[-<<<<<<<<<<<<<<<<<<<<+>>
+>>>>>>>>>>>>>>>>>>]<<<<[->->+<[>-]>[<<<<<<<<<<<<<<<<<<[->>>>>>>>
+>>>>>>>>>+>>>+<<<<<<<<<<<<<<<<<<<<]>>>>>>>>>>>>>>>>>>>>[-<<<<<<<
+<<<<<<<<<<<<<+>>>>>>>>>>>>>>>>>>>>]<<<<<<<<<<<<<<<<<+>>>>>>>>>>>
+>>>>->]<<<]<<<<<<<<<<<<<<<<[->>>>>>+>>>>>>>>>>>>>>+<<<<<<<<<<<<<
+<<<<<<<]>>>>>>>>>>>>>>>>>>>>[-<<<<<<<<<<<<<<<<<<<<+>>>>>>>>>>>>>
+>>>>>>>]<<<[-<<<<<<<<<<<->>>>>>>>>>>]<<<<<<<<<<+<[<<<<<<+>>>>>>>
+-]>[>>>>>>>>>++++++++++++++++++++++++++++++++.[-]>>>>>>>[-]<[-]<
+<<<<<<<<<<<<<<<<<<<<<[->>>>>>>>>>>>>>>>>>>>>>>>+>>>>+<<<<<<<<<<<
+<<<<<<<<<<<<<<<<<]>>>>>>>>>>>>>>>>>>>>>>>>>>>>[-<<<<<<<<<<<<<<<<
+<<<<<<<<<<<<+>>>>>>>>>>>>>>>>>>>>>>>>>>>>]<<<[-]++++++++++<[->->
++<[>-]>[<++++++++++<<+>>>->]<<<]<<++++++++++>>>[-<<<->>>]<<<<<<<
+<<[-]>>>[-]>>>>[->+>>>>+<<<<<]>>>>>[-<<<<<+>>>>>]<<<[-]+++++++++
++<[->->+<[>-]>[<++++++++++<<<<<<<<<+>>>>>>>>>>->]<<<]<<<<<++++++
+++++>>>>>>[-<<<<<<->>>>>>]<<[-]<<<<<<+<[++++++++++++++++++++++++
+++++++++++++++++++++++++.---------------------------------------
+--------->-]>[->]<<[->>>>>>>>+>>>+<<<<<<<<<<<]>>>>>>>>>>>[-<<<<<
+<<<<<<+>>>>>>>>>>>]<<<<<<<<[->>>>>+>>>+<<<<<<<<]>>>>>>>>[-<<<<<<
+<<+>>>>>>>>]<<+<[<<<<<++++++++++++++++++++++++++++++++++++++++++
+++++++.------------------------------------------------>>>>>>-]>
+[->]<<<<++++++++++++++++++++++++++++++++++++++++++++++++.-------
+----------------------------------------->>[-]<<<<<<<<[-]>>>[-]>
+>>[-]<<<<<<<<<<<<<<<<<<<<<<<<<[-]>>>>>>[-<<<<<<+>>>>>>]>>>>->]<<
+<<<[-]>>>[-]>>>>>->]<<[-]<[-]<<<<<<<<<<<<->+<[>-]>[>>>>>>>>>>>>>
+>>[-]<<<<<<<<<<<<<<<->]<<+>>>>>>>>>>>>>>>>]>>>++++++++++.[-]<<<<
+<<<<<<<<<<<<<<<<<<<+>>>]
@@ -0,0 +1,288 @@
+#pragma once
+
+/**
+ * 複数のスレッドで共有するコード領域
+ *
+ * CodeGenerator はそれぞれ専用のメモリ領域に命令を生成するので、多数のスレッドで並行して
+ * 命令生成すると生成器ごとの領域に細切れのコードが散らばる。
+ * CodeHeap は1つの大きな実行可能領域を持ち、generate() 済みの命令列をその中にコピーして配置する。
+ *
+ * * 領域はスレッドごとのチャンク(既定 64KiB)単位で切り出し、チャンク内の確保はロックも
+ *   アトミック操作も無しで先頭から詰めて行う。チャンクを使い切ったら共有の先頭位置を
+ *   アトミックに進めて(compare_exchange)次のチャンクを確保する。
+ *   チャンクの 1/4 より大きい確保は共有の領域から直接行う。
+ * * 確保した領域は解放しない(CodeHeap の破棄時に全体を解放する)。領域が足りない場合は nullptr を返す。
+ * * 既定では書込みと実行を同じページで許可しない(W^X)。Linux では同じメモリを読み書き可能な領域と
+ *   読み出し実行可能な領域の2か所に割り当て、install() は前者に書き込んで後者のアドレスを返す。
+ *   実行中の命令列と同じページにも書き込めるので、命令列はチャンクに詰めて配置でき、ページの保護も変更しない。
+ *   2か所に割り当てられない環境では読み書き可能な領域を確保し、install() は命令列をページ単位で配置して、
+ *   書き込み後にそのページを読み出し実行可能に変更する(命令列ごとに 1 ページ以上を使う)。
+ * * XKON_HEAP_RWX=1 の場合は読み書き実行可能な領域を1か所に確保する。
+ *
+ * 例:
+ *   heap::CodeHeap heap(64 << 20);
+ *   // 各スレッドで
+ *   Gen g(...);
+ *   g.generate<void*>();
+ *   auto f = heap.install<int (*)(int)>(g, "f");
+ */
+
+#include <atomic>
+#include <cstring>
+#include <string>
+
+#include "xkon.hpp"
+
+#ifndef XKON_HEAP_MMAP
+#if defined(__unix__) || defined(__APPLE__)
+#define XKON_HEAP_MMAP 1
+#else
+#define XKON_HEAP_MMAP 0
+#endif
+#endif
+
+#ifndef XKON_HEAP_RWX
+#define XKON_HEAP_RWX 0
+#endif
+
+#if XKON_HEAP_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// 同じメモリを書込み用と実行用に2か所に割り当てる(memfd_create)
+#if XKON_HEAP_MMAP && !XKON_HEAP_RWX && defined(__linux__) && defined(MFD_CLOEXEC)
+#define XKON_HEAP_DUAL 1
+#else
+#define XKON_HEAP_DUAL 0
+#endif
+
+namespace xkon {
+namespace heap {
+
+class CodeHeap {
+  CodeHeap(const CodeHeap&);
+  void operator=(const CodeHeap&);
+
+ public:
+  /// 確保する領域の配置境界の最大値(キャッシュライン)
+  static const std::size_t ALIGN = 64;
+  /// 既定のチャンクのバイト数
+  static const std::size_t DEFAULT_CHUNK = 64 * 1024;
+
+ private:
+  /// スレッドごとに保持するチャンク数(複数の CodeHeap を交互に使う場合用)
+  static const int LOCAL_CHUNKS = 4;
+
+  // スレッドが確保中のチャンク
+  struct Chunk {
+    uint64_t heap;  ///< CodeHeap::id (0 は未使用)
+    char* cur;
+    char* end;
+  };
+
+  const uint64_t id;  ///< 破棄した CodeHeap のチャンクを使わないための一意な識別子
+  char* base;  ///< 書込み用の領域
+  char* exec;  ///< base と同じメモリを実行用に割り当てた領域(1か所の場合は base)
+  std::size_t capacity;
+  std::size_t chunkSize;
+  bool mapped;  ///< base が mmap した領域
+  bool protect;  ///< 領域が実行不可で、install() でページごとに実行可能にする
+  std::atomic<std::size_t> top;
+
+  static uint64_t nextId() {
+    static std::atomic<uint64_t> seq(0);
+    return ++seq;
+  }
+
+  static std::size_t alignUp(std::size_t n, std::size_t align) { return (n + align - 1) & ~(align - 1); }
+
+#if XKON_HEAP_DUAL
+  // capacity バイトのメモリを base(読み書き)と exec(読み出し実行)に割り当てる。失敗したら何もしない
+  void mapDual() {
+    const int fd = memfd_create("xkon_heap", MFD_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+    void* w = MAP_FAILED;
+    void* x = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(capacity)) == 0) {
+      w = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      x = mmap(nullptr, capacity, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (w == MAP_FAILED || x == MAP_FAILED) {
+      if (w != MAP_FAILED) munmap(w, capacity);
+      if (x != MAP_FAILED) munmap(x, capacity);
+      return;
+    }
+    base = static_cast<char*>(w);
+    exec = static_cast<char*>(x);
+    mapped = true;
+  }
+#endif
+
+  // 呼び出したスレッドの、この CodeHeap のチャンク。無ければ最も古いものを入れ替える
+  Chunk& localChunk() {
+    static thread_local Chunk chunks[LOCAL_CHUNKS] = {};
+    static thread_local unsigned int victim = 0;
+    for (auto& c : chunks) {
+      if (c.heap == id) {
+        return c;
+      }
+    }
+    Chunk& c = chunks[victim++ % LOCAL_CHUNKS];
+    c = Chunk{id, nullptr, nullptr};
+    return c;
+  }
+
+  // 共有の領域から size バイト(align の倍数)を align に揃えて切り出す
+  char* bump(std::size_t size, std::size_t align = ALIGN) {
+    std::size_t old = top.load(std::memory_order_relaxed);
+    std::size_t start;
+    do {
+      start = alignUp(old, align);
+      if (capacity < start || capacity - start < size) {
+        return nullptr;
+      }
+    } while (!top.compare_exchange_weak(old, start + size, std::memory_order_relaxed));
+    return base + start;
+  }
+
+ public:
+  /// capacity バイトの領域を確保する。チャンクのバイト数 chunkSize は ALIGN の倍数に切り上げる
+  explicit CodeHeap(std::size_t capacity, std::size_t chunkSize = DEFAULT_CHUNK)
+      : id(nextId()), base(nullptr), exec(nullptr), capacity(alignUp(capacity, ALIGN)), chunkSize(alignUp(chunkSize, ALIGN)), mapped(false), protect(false), top(0) {
+#if XKON_HEAP_DUAL
+    mapDual();
+#endif
+#if XKON_HEAP_MMAP
+    if (base == nullptr) {
+      void* p = mmap(nullptr, this->capacity, PROT_READ | PROT_WRITE | (XKON_HEAP_RWX ? PROT_EXEC : 0), MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p != MAP_FAILED) {
+        base = exec = static_cast<char*>(p);
+        mapped = true;
+        protect = !XKON_HEAP_RWX;
+      }
+    }
+#endif
+    if (base == nullptr) {
+      // 先頭を ALIGN に揃えるため余分に確保して、解放用に確保したアドレスを領域の直前に保存する
+      char* raw = new char[this->capacity + ALIGN + sizeof(char*)];
+      base = exec = reinterpret_cast<char*>(alignUp(reinterpret_cast<uintptr_t>(raw + sizeof(char*)), ALIGN));
+      memcpy(base - sizeof(char*), &raw, sizeof(char*));
+    }
+  }
+
+  ~CodeHeap() {
+#if XKON_HEAP_MMAP
+    if (mapped) {
+      if (exec != base) {
+        munmap(exec, capacity);
+      }
+      munmap(base, capacity);
+      return;
+    }
+#endif
+    char* raw;
+    memcpy(&raw, base - sizeof(char*), sizeof(char*));
+    delete[] raw;
+  }
+
+  /// 命令列を実行する領域の先頭アドレス
+  const char* getMemory() const { return exec; }
+  /// 領域のバイト数
+  std::size_t getCapacity() const { return capacity; }
+  /// 切り出し済みのバイト数(スレッドが確保中のチャンクの未使用分を含む)
+  std::size_t getUsed() const { return top.load(std::memory_order_relaxed); }
+  /// install() が命令列をページ単位で配置して実行可能に変更する(実行用の領域を別に割り当てられなかった)
+  bool isProtected() const { return protect; }
+  /// 書込み用と実行用の2か所に割り当てた領域(W^X のままチャンクに詰めて配置する)
+  bool isDualMapped() const { return exec != base; }
+  /// allocate() で確保したアドレスを、実行用の領域のアドレスに変換する
+  const char* toExecutable(const char* p) const { return exec + (p - base); }
+
+  /**
+   * size バイトを align (2の累乗で ALIGN 以下)に揃えて確保する。領域が足りなければ nullptr
+   * 返すのは書込み用のアドレスで、isProtected() の場合は実行可能ではない。実行するアドレスは toExecutable() で求める
+   * 複数のスレッドから同時に呼び出してよい
+   */
+  char* allocate(std::size_t size, std::size_t align = 4) {
+    XKON_ASSERT(align != 0 && (align & (align - 1)) == 0 && align <= ALIGN);
+    if (chunkSize / 4 < size) {
+      return bump(alignUp(size, ALIGN));
+    }
+    Chunk& c = localChunk();
+    char* p = (c.cur != nullptr) ? reinterpret_cast<char*>(alignUp(reinterpret_cast<uintptr_t>(c.cur), align)) : nullptr;
+    if (p == nullptr || static_cast<std::size_t>(c.end - p) < size) {
+      // チャンクの残りは捨てて次のチャンクに移る
+      char* chunk = bump(chunkSize);
+      if (chunk == nullptr) {
+        return bump(alignUp(size, ALIGN));
+      }
+      c.cur = chunk;
+      c.end = chunk + chunkSize;
+      p = chunk;
+    }
+    c.cur = p + size;
+    return p;
+  }
+
+  /**
+   * generate() 済みの g の命令列を領域にコピーして、コピー先のアドレスでリロケーションを適用する
+   * name を指定した場合はエクスポートした関数 name の、省略した場合は命令列の先頭のアドレスを返す
+   * 領域が足りない・未定義の外部シンボルがある・name が無い・実行可能にできない場合は nullptr を返す
+   * 複数のスレッドから同時に呼び出してよい(同じ g を同時に使わないこと)
+   */
+  template <typename T, Isa isa>
+  T install(const CodeGenerator<isa>& g, const char* name = nullptr) {
+    const int xlen = ((isa & RV64) != 0) ? 64 : 32;
+    addr_t entry = 0;
+    if (name != nullptr) {
+      const auto itr = g.getLabels().find(name);
+      const std::map<std::string, const void*> exports = g.getSymbols();
+      if (itr == g.getLabels().end() || exports.find(name) == exports.end()) {
+        return nullptr;
+      }
+      entry = itr->second;
+    }
+    if (!isResolvable(g.getRelocations(), g.getExternalSymbols())) {
+      return nullptr;
+    }
+    const std::size_t size = g.getCodeSize();
+#if XKON_HEAP_MMAP
+    // ページの保護を変更する場合は、他の命令列とページを共有しないように配置する
+    const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    char* code = protect ? bump(alignUp(size, page), page) : allocate(size, 4);
+#else
+    char* code = allocate(size, 4);
+#endif
+    if (code == nullptr) {
+      return nullptr;
+    }
+    // 書込み用の領域 code に書き込み、実行用の領域 target のアドレスでリロケーションを適用する
+    char* const target = exec + (code - base);
+    memcpy(code, g.getCode(), size);
+    relocate(code, reinterpret_cast<addr_t>(target), g.getRelocations(), g.getExternalSymbols(), xlen);
+#if XKON_HEAP_MMAP
+    if (protect && mprotect(code, alignUp(size, page), PROT_READ | PROT_EXEC) != 0) {
+      return nullptr;
+    }
+#endif
+    __builtin___clear_cache(target, target + size);
+#if XKON_PERF
+    // generate() で通知した命令列の移動として通知する
+    if (perf::Log::instance().enabled()) {
+      std::vector<std::string> names;
+      for (const auto& e : g.getSymbols()) {
+        names.push_back(e.first);
+      }
+      perf::Log::instance().codeMove(g.getCode(), target, perf::functions(target, size, names, g.getLabels()));
+    }
+#endif
+    return (T)(target + entry);
+  }
+};
+
+}  // namespace heap
+}  // namespace xkon
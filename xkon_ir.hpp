@@ -0,0 +1,1089 @@
+#pragma once
+
+/**
+ * xkon 用の軽量 SSA 中間表現
+ *
+ * フロントエンドは CodeGenerator を直接呼ぶ代わりに ir::Function に命令を組み立て、
+ * optimize() で定数畳み込み・共通部分式除去・不要命令除去を行ってから
+ * lower() で CodeGenerator<Isa> の命令生成関数に変換する。
+ *
+ * * 値は32ビット整数のみ。メモリアクセスはバイト単位(Load8/Store8)のみ。
+ * * ブロック間で使われる値(phi を含む)は s0-s11 に、ブロック内だけで使われる値は
+ *   一時レジスタに割り当てる。s0-s11 の退避は CodeGenerator::prologue() に任せる。
+ * * 一時レジスタが足りない場合や、一時レジスタの値が関数呼出しをまたぐ場合は
+ *   UnsupportedException を発生させる。
+ */
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "xkon.hpp"
+
+namespace xkon {
+namespace ir {
+
+/// 命令の種類
+enum Op {
+  OpConst,   ///< 定数(imm)
+  OpArg,     ///< 関数の imm 番目の引数
+  OpAdd,     ///< args[0] + args[1]
+  OpSub,     ///< args[0] - args[1]
+  OpMul,     ///< args[0] * args[1]
+  OpAnd,     ///< args[0] & args[1]
+  OpOr,      ///< args[0] | args[1]
+  OpXor,     ///< args[0] ^ args[1]
+  OpShl,     ///< args[0] << args[1]
+  OpShr,     ///< args[0] >> args[1] (論理シフト)
+  OpZext8,   ///< args[0] の下位8ビットのゼロ拡張
+  OpLoad8,   ///< args[0] + imm の1バイトをゼロ拡張して読み出す
+  OpStore8,  ///< args[0] の下位8ビットを args[1] + imm に書き込む
+  OpCall,    ///< callee の呼出し。args を a0 から順に渡し、a0 を結果とする
+  OpPhi,     ///< from[i] から来た場合に args[i] となる値
+  OpBr,      ///< target[0] への無条件分岐
+  OpBnez,    ///< args[0] が非0なら target[0]、0なら target[1] へ分岐
+  OpRet,     ///< 関数から戻る。args があれば args[0] を戻り値とする
+};
+
+struct Block;
+
+/// SSA の値(命令)
+struct Value {
+  const int id;
+  Op op;
+  int32 imm;                 ///< 定数値、引数番号、メモリアクセスのオフセット
+  addr_t callee;             ///< OpCall の呼出し先
+  std::vector<Value*> args;  ///< オペランド
+  std::vector<Block*> from;  ///< OpPhi の args に対応する先行ブロック
+  Block* target[2];          ///< 分岐命令の分岐先
+  Block* block;              ///< 所属するブロック
+  Value* repl;               ///< 置き換え先の値(nullptr なら有効な値)
+  bool dead;                 ///< 不要になった副作用のある命令(上書きされる Store8 など)
+
+  Value(int id, Op op, Block* block) : id(id), op(op), imm(0), callee(0), args(), from(), target{nullptr, nullptr}, block(block), repl(nullptr), dead(false) {}
+
+  bool isConst() const { return op == OpConst; }
+  bool isTerminator() const { return op == OpBr || op == OpBnez || op == OpRet; }
+  bool hasSideEffect() const { return op == OpStore8 || op == OpCall || isTerminator(); }
+};
+
+/// 基本ブロック
+struct Block {
+  const int id;
+  std::vector<Value*> phis;   ///< ブロック先頭の phi
+  std::vector<Value*> insns;  ///< 命令列(最後は終端命令)
+  std::vector<Block*> preds;  ///< 先行ブロック(dce() で再計算)
+
+  explicit Block(int id) : id(id), phis(), insns(), preds() {}
+
+  Value* terminator() const { return (!insns.empty() && insns.back()->isTerminator()) ? insns.back() : nullptr; }
+
+  std::vector<Block*> succs() const {
+    std::vector<Block*> res;
+    const Value* t = terminator();
+    if (t != nullptr) {
+      for (Block* b : t->target) {
+        if (b != nullptr) {
+          res.push_back(b);
+        }
+      }
+    }
+    return res;
+  }
+};
+
+/// 値の置き換えを辿って有効な値を返す
+inline Value* resolve(Value* v) {
+  while (v->repl != nullptr) {
+    v = v->repl;
+  }
+  return v;
+}
+
+/**
+ * 関数
+ *
+ * 生成直後は入口ブロックが挿入先になっている。
+ */
+class Function {
+  Function(const Function&) = delete;
+  void operator=(const Function&) = delete;
+
+  std::vector<std::unique_ptr<Value>> values;
+  std::vector<std::unique_ptr<Block>> blocks;
+  std::vector<Block*> order;  ///< 有効なブロックの配置順(先頭が入口)
+  Block* cur;                 ///< 命令の挿入先
+
+  Value* make(Op op, Block* b) {
+    values.emplace_back(new Value(static_cast<int>(values.size()), op, b));
+    return values.back().get();
+  }
+
+  Value* append(Op op, std::vector<Value*> args, int32 imm = 0) {
+    XKON_ASSERT(cur != nullptr && cur->terminator() == nullptr);
+    Value* v = make(op, cur);
+    v->args = args;
+    v->imm = imm;
+    cur->insns.push_back(v);
+    return v;
+  }
+
+ public:
+  Function() : values(), blocks(), order(), cur(nullptr) { cur = newBlock(); }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // ブロック
+
+  Block* entry() const { return order.front(); }
+  const std::vector<Block*>& getBlocks() const { return order; }
+
+  Block* newBlock() {
+    blocks.emplace_back(new Block(static_cast<int>(blocks.size())));
+    order.push_back(blocks.back().get());
+    return blocks.back().get();
+  }
+
+  // ブロックを配置順の最後に移す
+  void place(Block* b) {
+    order.erase(std::find(order.begin(), order.end(), b));
+    order.push_back(b);
+  }
+
+  void setBlock(Block* b) { cur = b; }
+  Block* block() const { return cur; }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // 命令の組み立て
+
+  Value* iconst(int32 imm) { return append(OpConst, {}, imm); }
+  Value* arg(int n) { return append(OpArg, {}, n); }
+  Value* add(Value* a, Value* b) { return append(OpAdd, {a, b}); }
+  Value* sub(Value* a, Value* b) { return append(OpSub, {a, b}); }
+  Value* mul(Value* a, Value* b) { return append(OpMul, {a, b}); }
+  Value* and_(Value* a, Value* b) { return append(OpAnd, {a, b}); }
+  Value* or_(Value* a, Value* b) { return append(OpOr, {a, b}); }
+  Value* xor_(Value* a, Value* b) { return append(OpXor, {a, b}); }
+  Value* shl(Value* a, Value* b) { return append(OpShl, {a, b}); }
+  Value* shr(Value* a, Value* b) { return append(OpShr, {a, b}); }
+  Value* zext8(Value* a) { return append(OpZext8, {a}); }
+  Value* load8(Value* base, int32 offset = 0) { return append(OpLoad8, {base}, offset); }
+  void store8(Value* val, Value* base, int32 offset = 0) { append(OpStore8, {val, base}, offset); }
+
+  Value* call(addr_t callee, std::vector<Value*> args = {}) {
+    XKON_ASSERT(args.size() <= 8);
+    Value* v = append(OpCall, args);
+    v->callee = callee;
+    return v;
+  }
+
+  /// 現在のブロックの先頭に phi を追加する。incoming() で先行ブロックからの値を追加すること
+  Value* phi() {
+    Value* v = make(OpPhi, cur);
+    cur->phis.push_back(v);
+    return v;
+  }
+  void incoming(Value* phi, Value* val, Block* from) {
+    XKON_ASSERT(phi->op == OpPhi);
+    phi->args.push_back(val);
+    phi->from.push_back(from);
+  }
+
+  void br(Block* dst) { append(OpBr, {})->target[0] = dst; }
+  void bnez(Value* cond, Block* t, Block* f) {
+    Value* v = append(OpBnez, {cond});
+    v->target[0] = t;
+    v->target[1] = f;
+  }
+  void ret() { append(OpRet, {}); }
+  void ret(Value* val) { append(OpRet, {val}); }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // 最適化
+
+  /// 定数畳み込み・共通部分式除去・不要命令除去を変化が無くなるまで繰り返す
+  void optimize() {
+    const int MAX_PASS = 8;
+    for (int i = 0; i < MAX_PASS; ++i) {
+      bool changed = fold();
+      changed |= cse();
+      changed |= fold();
+      changed |= dce();
+      if (!changed) {
+        break;
+      }
+    }
+  }
+
+  /// 定数畳み込みと代数的な簡約
+  bool fold() {
+    bool changed = false;
+    for (Block* b : order) {
+      // 全ての入力が同じ値(または自分自身)の phi はその値に置き換える
+      std::vector<Value*> phis;
+      for (Value* v : b->phis) {
+        resolveArgs(v);
+        Value* same = nullptr;
+        bool trivial = true;
+        for (Value* a : v->args) {
+          if (a == v || a == same) {
+            continue;
+          }
+          if (same != nullptr) {
+            trivial = false;
+            break;
+          }
+          same = a;
+        }
+        if (trivial && same != nullptr) {
+          v->repl = same;
+          changed = true;
+        } else {
+          phis.push_back(v);
+        }
+      }
+      b->phis = phis;
+
+      std::vector<Value*> out;
+      for (Value* v : b->insns) {
+        resolveArgs(v);
+        Value* r = simplify(v, out, changed);
+        if (r != v) {
+          v->repl = r;
+          changed = true;
+        } else {
+          out.push_back(v);
+        }
+      }
+      b->insns = out;
+    }
+    return changed;
+  }
+
+  /**
+   * ブロック内の共通部分式除去
+   * メモリについては、同じ基底アドレスの異なるオフセットは別の場所とみなし、
+   * 書込み値の読み出しへの転送と、読まれずに上書きされる書込みの除去も行う。
+   */
+  bool cse() {
+    bool changed = false;
+    typedef std::tuple<int, int, int, int32> key_t;
+    for (Block* b : order) {
+      std::map<key_t, Value*> table;                           // 純粋な演算の値番号表
+      std::map<std::pair<Value*, int32>, Value*> known;        // メモリの内容が判っている場所
+      std::map<std::pair<Value*, int32>, Value*> unreadStore;  // まだ読まれていない書込み
+      std::vector<Value*> out;
+
+      for (Value* v : b->insns) {
+        resolveArgs(v);
+        switch (v->op) {
+          case OpConst:
+          case OpAdd:
+          case OpSub:
+          case OpMul:
+          case OpAnd:
+          case OpOr:
+          case OpXor:
+          case OpShl:
+          case OpShr:
+          case OpZext8: {
+            int a0 = v->args.size() > 0 ? v->args[0]->id : -1;
+            int a1 = v->args.size() > 1 ? v->args[1]->id : -1;
+            if ((v->op == OpAdd || v->op == OpMul || v->op == OpAnd || v->op == OpOr || v->op == OpXor) && a1 < a0) {
+              std::swap(a0, a1);
+            }
+            const key_t key(v->op, a0, a1, v->imm);
+            auto itr = table.find(key);
+            if (itr != table.end()) {
+              v->repl = itr->second;
+              changed = true;
+              continue;
+            }
+            table[key] = v;
+            break;
+          }
+          case OpLoad8: {
+            const auto loc = std::make_pair(v->args[0], v->imm);
+            auto itr = known.find(loc);
+            if (itr != known.end()) {
+              Value* k = itr->second;
+              if (k->op == OpLoad8) {
+                v->repl = k;
+              } else {
+                // 書き込んだ値の下位8ビットが読み出される
+                Value* z = make(OpZext8, b);
+                z->args = {k};
+                out.push_back(z);
+                v->repl = z;
+              }
+              changed = true;
+              continue;
+            }
+            // 別の基底アドレスからの読出しは、どの書込みを読むか判らない
+            for (auto e = unreadStore.begin(); e != unreadStore.end();) {
+              e = (e->first.first != v->args[0] || e->first.second == v->imm) ? unreadStore.erase(e) : std::next(e);
+            }
+            known[loc] = v;
+            break;
+          }
+          case OpStore8: {
+            const auto loc = std::make_pair(v->args[1], v->imm);
+            auto itr = unreadStore.find(loc);
+            if (itr != unreadStore.end()) {
+              itr->second->dead = true;
+              changed = true;
+            }
+            // 別の基底アドレスの場所は同じ場所かもしれないので忘れる
+            for (auto e = known.begin(); e != known.end();) {
+              e = (e->first.first != v->args[1]) ? known.erase(e) : std::next(e);
+            }
+            known[loc] = v->args[0];
+            unreadStore[loc] = v;
+            break;
+          }
+          case OpCall:
+            known.clear();
+            unreadStore.clear();
+            break;
+          default:
+            break;
+        }
+        out.push_back(v);
+      }
+      b->insns = out;
+    }
+    return changed;
+  }
+
+  /// 到達不能なブロックと不要な命令の除去
+  bool dce() {
+    bool changed = false;
+
+    // 到達可能なブロックを配置順を保って残す
+    std::set<Block*> reachable;
+    std::vector<Block*> work{entry()};
+    while (!work.empty()) {
+      Block* b = work.back();
+      work.pop_back();
+      if (!reachable.insert(b).second) {
+        continue;
+      }
+      for (Block* s : b->succs()) {
+        work.push_back(s);
+      }
+    }
+    std::vector<Block*> live;
+    for (Block* b : order) {
+      if (reachable.count(b)) {
+        live.push_back(b);
+        b->preds.clear();
+      } else {
+        changed = true;
+      }
+    }
+    order = live;
+    for (Block* b : order) {
+      for (Block* s : b->succs()) {
+        if (std::find(s->preds.begin(), s->preds.end(), b) == s->preds.end()) {
+          s->preds.push_back(b);
+        }
+      }
+    }
+
+    // 先行ブロックでなくなったブロックからの phi の入力を除く
+    for (Block* b : order) {
+      for (Value* v : b->phis) {
+        std::vector<Value*> args;
+        std::vector<Block*> from;
+        for (size_t i = 0; i < v->args.size(); ++i) {
+          if (std::find(b->preds.begin(), b->preds.end(), v->from[i]) != b->preds.end() && std::find(from.begin(), from.end(), v->from[i]) == from.end()) {
+            args.push_back(v->args[i]);
+            from.push_back(v->from[i]);
+          }
+        }
+        changed |= args.size() != v->args.size();
+        v->args = args;
+        v->from = from;
+      }
+    }
+
+    // 副作用のある命令から使われている値に印を付ける
+    std::set<Value*> used;
+    std::vector<Value*> mark;
+    for (Block* b : order) {
+      for (Value* v : b->insns) {
+        resolveArgs(v);
+        if (v->hasSideEffect() && !v->dead) {
+          mark.push_back(v);
+        }
+      }
+      for (Value* v : b->phis) {
+        resolveArgs(v);
+      }
+    }
+    while (!mark.empty()) {
+      Value* v = mark.back();
+      mark.pop_back();
+      if (!used.insert(v).second) {
+        continue;
+      }
+      for (Value* a : v->args) {
+        mark.push_back(a);
+      }
+    }
+
+    for (Block* b : order) {
+      const size_t n = b->phis.size() + b->insns.size();
+      b->phis.erase(std::remove_if(b->phis.begin(), b->phis.end(), [&](Value* v) { return used.count(v) == 0; }), b->phis.end());
+      b->insns.erase(std::remove_if(b->insns.begin(), b->insns.end(), [&](Value* v) { return used.count(v) == 0; }), b->insns.end());
+      changed |= n != b->phis.size() + b->insns.size();
+    }
+    return changed;
+  }
+
+  /// 有効な命令数(phi を含む)
+  std::size_t size() const {
+    std::size_t n = 0;
+    for (Block* b : order) {
+      n += b->phis.size() + b->insns.size();
+    }
+    return n;
+  }
+
+  /// デバッグ用のテキスト表現
+  std::string dump() const {
+    static const char* const names[] = {"const", "arg", "add", "sub", "mul", "and", "or", "xor", "shl", "shr", "zext8", "load8", "store8", "call", "phi", "br", "bnez", "ret"};
+    std::string s;
+    char buf[64];
+    for (Block* b : order) {
+      snprintf(buf, sizeof(buf), "B%d:\n", b->id);
+      s += buf;
+      std::vector<Value*> all = b->phis;
+      all.insert(all.end(), b->insns.begin(), b->insns.end());
+      for (Value* v : all) {
+        snprintf(buf, sizeof(buf), "  v%d = %s", v->id, names[v->op]);
+        s += buf;
+        for (size_t i = 0; i < v->args.size(); ++i) {
+          snprintf(buf, sizeof(buf), (v->op == OpPhi) ? " v%d:B%d" : " v%d", resolve(v->args[i])->id, (v->op == OpPhi) ? v->from[i]->id : 0);
+          s += buf;
+        }
+        if (v->op == OpConst || v->op == OpArg || v->op == OpLoad8 || v->op == OpStore8) {
+          snprintf(buf, sizeof(buf), " #%d", v->imm);
+          s += buf;
+        }
+        for (Block* t : v->target) {
+          if (t != nullptr) {
+            snprintf(buf, sizeof(buf), " B%d", t->id);
+            s += buf;
+          }
+        }
+        s += v->dead ? " (dead)\n" : "\n";
+      }
+    }
+    return s;
+  }
+
+ private:
+  static void resolveArgs(Value* v) {
+    for (auto& a : v->args) {
+      a = resolve(a);
+    }
+  }
+
+  static bool isSint12(int32 v) { return -2048 <= v && v < 2048; }
+
+  Value* newConst(int32 imm, Block* b, std::vector<Value*>& out) {
+    Value* c = make(OpConst, b);
+    c->imm = imm;
+    out.push_back(c);
+    return c;
+  }
+
+  /**
+   * 下位8ビットだけが使われる値 v から、下位8ビットが同じでゼロ拡張を含まない値を返す
+   * 加減乗算と論理演算の結果の下位8ビットは、オペランドの下位8ビットだけで決まることを利用する
+   */
+  Value* narrow(Value* v, Block* blk, std::vector<Value*>& out, int depth = 0) {
+    if (8 < depth) {
+      return v;
+    }
+    if (v->op == OpZext8) {
+      return narrow(resolve(v->args[0]), blk, out, depth + 1);
+    }
+    if (v->op == OpAdd || v->op == OpSub || v->op == OpMul || v->op == OpAnd || v->op == OpOr || v->op == OpXor) {
+      Value* a = narrow(resolve(v->args[0]), blk, out, depth + 1);
+      Value* b = narrow(resolve(v->args[1]), blk, out, depth + 1);
+      if (a != resolve(v->args[0]) || b != resolve(v->args[1])) {
+        Value* n = make(v->op, blk);
+        n->args = {a, b};
+        out.push_back(n);
+        return n;
+      }
+    }
+    return v;
+  }
+
+  /// v を簡約した値を返す。v 自身を書き換えた場合と簡約できない場合は v を返す
+  Value* simplify(Value* v, std::vector<Value*>& out, bool& changed) {
+    Block* const b = v->block;
+    std::vector<Value*>& a = v->args;
+    const auto isC = [&](int i) { return a[i]->isConst(); };
+    const auto C = [&](int i) { return a[i]->imm; };
+
+    switch (v->op) {
+      case OpAdd:
+      case OpSub:
+      case OpMul:
+      case OpAnd:
+      case OpOr:
+      case OpXor:
+      case OpShl:
+      case OpShr:
+        if (isC(0) && isC(1)) {
+          const uint32 x = C(0), y = C(1);
+          uint32 r = 0;
+          switch (v->op) {
+            case OpAdd: r = x + y; break;
+            case OpSub: r = x - y; break;
+            case OpMul: r = x * y; break;
+            case OpAnd: r = x & y; break;
+            case OpOr: r = x | y; break;
+            case OpXor: r = x ^ y; break;
+            case OpShl: r = x << (y & 31); break;
+            case OpShr: r = x >> (y & 31); break;
+            default: break;
+          }
+          return newConst(static_cast<int32>(r), b, out);
+        }
+        // 定数は右側に寄せる
+        if ((v->op == OpAdd || v->op == OpMul || v->op == OpAnd || v->op == OpOr || v->op == OpXor) && isC(0)) {
+          std::swap(a[0], a[1]);
+          changed = true;
+        }
+        if (v->op == OpSub && isC(1)) {
+          v->op = OpAdd;
+          a[1] = newConst(-C(1), b, out);
+          changed = true;
+        }
+        if (v->op == OpSub && a[0] == a[1]) {
+          return newConst(0, b, out);
+        }
+        if (isC(1)) {
+          const int32 y = C(1);
+          if ((y == 0 && (v->op == OpAdd || v->op == OpOr || v->op == OpXor || v->op == OpShl || v->op == OpShr)) ||  //
+              (y == 1 && v->op == OpMul) || (y == -1 && v->op == OpAnd)) {
+            return a[0];
+          }
+          if (y == 0 && (v->op == OpMul || v->op == OpAnd)) {
+            return a[1];
+          }
+          // (x + c1) + c2 -> x + (c1 + c2)
+          if (v->op == OpAdd && a[0]->op == OpAdd && resolve(a[0]->args[1])->isConst()) {
+            const int32 c = resolve(a[0]->args[1])->imm;
+            a[0] = resolve(a[0]->args[0]);
+            a[1] = newConst(static_cast<int32>(static_cast<uint32>(c) + static_cast<uint32>(y)), b, out);
+            changed = true;
+          }
+          // 2のべき乗の乗算はシフトにする
+          if (v->op == OpMul && 0 < y && (y & (y - 1)) == 0) {
+            int k = 0;
+            while ((1 << k) != y) {
+              ++k;
+            }
+            v->op = OpShl;
+            a[1] = newConst(k, b, out);
+            changed = true;
+          }
+        }
+        break;
+
+      case OpZext8:
+        if (isC(0)) {
+          return newConst(C(0) & 0xff, b, out);
+        }
+        if (a[0]->op == OpZext8 || a[0]->op == OpLoad8 || (a[0]->op == OpAnd && resolve(a[0]->args[1])->isConst() && (resolve(a[0]->args[1])->imm & ~0xff) == 0)) {
+          return a[0];
+        }
+        {
+          Value* n = narrow(a[0], b, out);
+          if (n != a[0]) {
+            a[0] = n;
+            changed = true;
+          }
+        }
+        break;
+
+      case OpLoad8:
+      case OpStore8: {
+        Value*& base = (v->op == OpLoad8) ? a[0] : a[1];
+        // オフセット付きアドレッシングにする
+        if (base->op == OpAdd && resolve(base->args[1])->isConst() && isSint12(v->imm + resolve(base->args[1])->imm)) {
+          v->imm += resolve(base->args[1])->imm;
+          base = resolve(base->args[0]);
+          changed = true;
+        }
+        if (v->op == OpStore8) {
+          Value* n = narrow(a[0], b, out);
+          if (n != a[0]) {
+            a[0] = n;
+            changed = true;
+          }
+        }
+        break;
+      }
+
+      case OpBnez:
+        if (isC(0)) {
+          v->op = OpBr;
+          v->target[0] = (C(0) != 0) ? v->target[0] : v->target[1];
+          v->target[1] = nullptr;
+          a.clear();
+          changed = true;
+        }
+        break;
+
+      default:
+        break;
+    }
+    return v;
+  }
+};
+
+/**
+ * ir::Function を CodeGenerator の命令生成関数の呼出しに変換する
+ *
+ * 関数の引数は a0 から順に渡され、戻り値は a0 で返す。
+ * prefix は生成するラベル名の接頭辞で、同じ CodeGenerator に複数の関数を変換する場合は
+ * 関数ごとに異なる値を指定すること。
+ */
+template <Isa isa>
+class Lowering : public Registers {
+  typedef CodeGenerator<isa> gen_t;
+
+  gen_t& g;
+  Function& f;
+  const std::string prefix;
+
+  std::map<Value*, int> reg;  ///< 値に割り当てたレジスタ番号
+  std::vector<int> freeRegs;  ///< 空いている一時レジスタ
+  std::map<Value*, int> lastUse;
+
+  static constexpr int SCRATCH = 31;  ///< 定数の実体化と並列代入の循環の解消に使う t6
+
+  std::string label(const Block* b) const { return prefix + "B" + std::to_string(b->id); }
+
+ public:
+  Lowering(gen_t& g, Function& f, const std::string& prefix) : g(g), f(f), prefix(prefix), reg(), freeRegs(), lastUse() {}
+
+  void run() {
+    const std::vector<Block*>& blocks = f.getBlocks();
+    assignGlobals();
+
+    typename gen_t::Frame frame = g.prologue();
+
+    // 引数を割り当てたレジスタに移す
+    std::vector<std::pair<int, Value*>> moves;
+    for (Block* b : blocks) {
+      for (Value* v : b->insns) {
+        if (v->op == OpArg && reg.count(v)) {
+          moves.push_back(std::make_pair(10 + v->imm, v));
+        }
+      }
+    }
+    parallelMove(moves, true);
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      Block* b = blocks[i];
+      Block* next = (i + 1 < blocks.size()) ? blocks[i + 1] : nullptr;
+      g.L(label(b).c_str());
+      lowerBlock(b, next, frame);
+    }
+  }
+
+ private:
+  /// ブロック間で使われる値と phi に s0-s11 を割り当てる
+  /// 生存区間をブロックの並びの範囲で近似して、区間が重ならない値は同じレジスタを使う
+  void assignGlobals() {
+    const std::vector<Block*>& blocks = f.getBlocks();
+    std::map<const Block*, int> index;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      index[blocks[i]] = static_cast<int>(i);
+    }
+    // 値ごとの生存区間 [first, last](ブロックの番号)と、値が最初に現れた順
+    std::map<Value*, std::pair<int, int>> live;
+    std::vector<Value*> values;
+    const auto use = [&](Value* v, const Block* b) {
+      if (v->isConst()) {
+        return;
+      }
+      const int pos = index.at(b);
+      auto itr = live.find(v);
+      if (itr == live.end()) {
+        live[v] = std::make_pair(std::min(pos, index.at(v->block)), std::max(pos, index.at(v->block)));
+        values.push_back(v);
+      } else {
+        itr->second.first = std::min(itr->second.first, pos);
+        itr->second.second = std::max(itr->second.second, pos);
+      }
+    };
+    for (Block* b : blocks) {
+      for (Value* v : b->phis) {
+        // phi への代入は先行ブロックの最後で行う
+        for (size_t i = 0; i < v->args.size(); ++i) {
+          use(v, v->from[i]);
+          Value* a = resolve(v->args[i]);
+          if (a->block != v->from[i] || a->op == OpArg) {
+            use(a, v->from[i]);
+          }
+        }
+        use(v, b);
+      }
+      for (Value* v : b->insns) {
+        if (v->op == OpArg) {
+          use(v, b);
+        }
+        for (Value* a : v->args) {
+          if (resolve(a)->block != b) {
+            use(resolve(a), b);
+          }
+        }
+      }
+    }
+
+    // ループの先頭で生きている値(ループの外と区間が重なる値)はループ全体で生かす
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (size_t i = 0; i < blocks.size(); ++i) {
+        for (Block* s : blocks[i]->succs()) {
+          const int head = index.at(s);
+          const int tail = static_cast<int>(i);
+          if (tail < head) {
+            continue;
+          }
+          for (auto& e : live) {
+            std::pair<int, int>& r = e.second;
+            const bool overlap = r.first <= tail && head <= r.second;
+            const bool inside = head <= r.first && r.second <= tail;
+            if (overlap && !inside && (head < r.first || r.second < tail)) {
+              r.first = std::min(r.first, head);
+              r.second = std::max(r.second, tail);
+              changed = true;
+            }
+          }
+        }
+      }
+    }
+
+    // 区間の先頭の順にレジスタを割り当て、区間が終わった値のレジスタは再利用する
+    std::stable_sort(values.begin(), values.end(), [&](Value* a, Value* b) { return live[a].first < live[b].first; });
+    std::vector<Value*> owner(globals().size(), nullptr);
+    for (Value* v : values) {
+      size_t k = 0;
+      while (k < owner.size() && owner[k] != nullptr && live[v].first <= live[owner[k]].second) {
+        ++k;
+      }
+      if (k == owner.size()) {
+        throw UnsupportedException("ir: too many values live across blocks.");
+      }
+      owner[k] = v;
+      reg[v] = globals()[k];
+    }
+  }
+
+  /// ブロック間で使われる値に割り当てるレジスタ(s1-s11,s0)
+  static const std::vector<int>& globals() {
+    static const std::vector<int> pool{9, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 8};
+    return pool;
+  }
+
+  bool isGlobal(Value* v) const { return reg.count(v) && std::find(globals().begin(), globals().end(), reg.at(v)) != globals().end(); }
+
+  int regOf(Value* v) {
+    v = resolve(v);
+    if (v->isConst()) {
+      g.li(intReg(SCRATCH), static_cast<uint32>(v->imm));
+      return SCRATCH;
+    }
+    XKON_ASSERT(reg.count(v));
+    return reg[v];
+  }
+
+  void release(Value* v, size_t pos) {
+    v = resolve(v);
+    auto itr = lastUse.find(v);
+    if (itr != lastUse.end() && itr->second == static_cast<int>(pos) && !isGlobal(v) && reg.count(v)) {
+      freeRegs.push_back(reg[v]);
+      reg.erase(v);
+      lastUse.erase(itr);
+    }
+  }
+
+  int allocate(Value* v) {
+    if (reg.count(v)) {
+      return reg[v];
+    }
+    if (freeRegs.empty()) {
+      throw UnsupportedException("ir: out of temporary registers.");
+    }
+    const int r = freeRegs.back();
+    freeRegs.pop_back();
+    reg[v] = r;
+    return r;
+  }
+
+  /**
+   * 並列代入 dst <- src をレジスタの上書きに注意して逐次の命令にする
+   * fromReg が true の場合、first はレジスタ番号の代入元で second が代入先の値
+   */
+  void parallelMove(std::vector<std::pair<int, Value*>> moves, bool fromReg) {
+    // (代入先レジスタ, 代入元レジスタ or -1:定数, 定数値)
+    struct Move {
+      int dst, src;
+      int32 imm;
+    };
+    std::vector<Move> list;
+    for (auto& m : moves) {
+      if (fromReg) {
+        list.push_back(Move{reg[m.second], m.first, 0});
+      } else {
+        Value* v = resolve(m.second);
+        if (v->isConst()) {
+          list.push_back(Move{m.first, -1, v->imm});
+        } else {
+          list.push_back(Move{m.first, reg.at(v), 0});
+        }
+      }
+    }
+    list.erase(std::remove_if(list.begin(), list.end(), [](const Move& m) { return m.dst == m.src; }), list.end());
+
+    while (!list.empty()) {
+      bool progress = false;
+      for (size_t i = 0; i < list.size(); ++i) {
+        const Move m = list[i];
+        const bool blocked = std::any_of(list.begin(), list.end(), [&](const Move& o) { return o.src == m.dst; });
+        if (blocked) {
+          continue;
+        }
+        if (m.src < 0) {
+          g.li(intReg(m.dst), static_cast<uint32>(m.imm));
+        } else {
+          g.mv(intReg(m.dst), intReg(m.src));
+        }
+        list.erase(list.begin() + i);
+        progress = true;
+        break;
+      }
+      if (!progress) {
+        // 循環しているので1つを退避用レジスタに逃がす
+        Move& m = list.front();
+        g.mv(intReg(SCRATCH), intReg(m.src));
+        for (auto& o : list) {
+          if (o.src == m.src) {
+            o.src = SCRATCH;
+          }
+        }
+      }
+    }
+  }
+
+  /// ブロック b から succ への遷移時の phi の代入
+  void phiMoves(Block* b, Block* succ) {
+    std::vector<std::pair<int, Value*>> moves;
+    for (Value* p : succ->phis) {
+      for (size_t i = 0; i < p->from.size(); ++i) {
+        if (p->from[i] == b) {
+          moves.push_back(std::make_pair(reg.at(p), p->args[i]));
+        }
+      }
+    }
+    parallelMove(moves, false);
+  }
+
+  void jumpTo(Block* b, Block* dst, Block* next) {
+    phiMoves(b, dst);
+    if (dst != next) {
+      g.j(label(dst).c_str());
+    }
+  }
+
+  void lowerBlock(Block* b, Block* next, typename gen_t::Frame& frame) {
+    XKON_ASSERT(b->terminator() != nullptr);
+    // 一時レジスタ(t0-t5,a1-a7)とブロック内での最終使用位置
+    freeRegs = {17, 16, 15, 14, 13, 12, 11, 30, 29, 28, 7, 6, 5};
+    lastUse.clear();
+    for (size_t i = 0; i < b->insns.size(); ++i) {
+      for (Value* a : b->insns[i]->args) {
+        lastUse[resolve(a)] = static_cast<int>(i);
+      }
+    }
+    // phi の入力はブロックの最後まで生きている
+    for (Block* s : b->succs()) {
+      for (Value* p : s->phis) {
+        for (size_t i = 0; i < p->from.size(); ++i) {
+          if (p->from[i] == b) {
+            lastUse[resolve(p->args[i])] = static_cast<int>(b->insns.size());
+          }
+        }
+      }
+    }
+
+    for (size_t i = 0; i < b->insns.size(); ++i) {
+      Value* v = b->insns[i];
+      std::vector<Value*>& a = v->args;
+      const auto imm12 = [&](int k) { return resolve(a[k])->isConst() && -2048 <= resolve(a[k])->imm && resolve(a[k])->imm < 2048; };
+
+      switch (v->op) {
+        case OpConst:
+          break;
+        case OpArg:
+          break;
+        case OpAdd:
+        case OpSub:
+        case OpMul:
+        case OpAnd:
+        case OpOr:
+        case OpXor:
+        case OpShl:
+        case OpShr:
+          if (v->op != OpSub && v->op != OpMul && imm12(1)) {
+            // 即値命令
+            const int s1 = regOf(a[0]);
+            const int32 c = resolve(a[1])->imm;
+            release(a[0], i);
+            const IntReg rd = intReg(allocate(v));
+            switch (v->op) {
+              case OpAdd: g.addi(rd, intReg(s1), c); break;
+              case OpAnd: g.andi(rd, intReg(s1), c); break;
+              case OpOr: g.ori(rd, intReg(s1), c); break;
+              case OpXor: g.xori(rd, intReg(s1), c); break;
+              case OpShl: g.slli(rd, intReg(s1), c & 31); break;
+              case OpShr: g.srli(rd, intReg(s1), c & 31); break;
+              default: break;
+            }
+          } else {
+            const int s1 = regOf(a[0]);
+            const int s2 = regOf(a[1]);
+            XKON_ASSERT(!(s1 == SCRATCH && s2 == SCRATCH));
+            release(a[0], i);
+            release(a[1], i);
+            const IntReg rd = intReg(allocate(v));
+            switch (v->op) {
+              case OpAdd: g.add(rd, intReg(s1), intReg(s2)); break;
+              case OpSub: g.sub(rd, intReg(s1), intReg(s2)); break;
+              case OpMul: g.mul(rd, intReg(s1), intReg(s2)); break;
+              case OpAnd: g.and_(rd, intReg(s1), intReg(s2)); break;
+              case OpOr: g.or_(rd, intReg(s1), intReg(s2)); break;
+              case OpXor: g.xor_(rd, intReg(s1), intReg(s2)); break;
+              case OpShl: g.sll(rd, intReg(s1), intReg(s2)); break;
+              case OpShr: g.srl(rd, intReg(s1), intReg(s2)); break;
+              default: break;
+            }
+          }
+          break;
+        case OpZext8: {
+          const int s1 = regOf(a[0]);
+          release(a[0], i);
+          g.andi(intReg(allocate(v)), intReg(s1), 0xff);
+          break;
+        }
+        case OpLoad8: {
+          const int base = regOf(a[0]);
+          release(a[0], i);
+          g.lbu(intReg(allocate(v)), intReg(base)(v->imm));
+          break;
+        }
+        case OpStore8: {
+          const int val = regOf(a[0]);
+          int base;
+          if (val == SCRATCH && resolve(a[1])->isConst()) {
+            // 値とアドレスがどちらも定数の場合、アドレスは空いている一時レジスタに置く
+            if (freeRegs.empty()) {
+              throw UnsupportedException("ir: out of temporary registers.");
+            }
+            base = freeRegs.back();
+            g.li(intReg(base), static_cast<uint32>(resolve(a[1])->imm));
+          } else {
+            base = regOf(a[1]);
+          }
+          g.sb(intReg(val), intReg(base)(v->imm));
+          release(a[0], i);
+          release(a[1], i);
+          break;
+        }
+        case OpCall: {
+          std::vector<std::pair<int, Value*>> moves;
+          for (size_t k = 0; k < a.size(); ++k) {
+            moves.push_back(std::make_pair(10 + static_cast<int>(k), a[k]));
+          }
+          parallelMove(moves, false);
+          for (Value* x : a) {
+            release(x, i);
+          }
+          // 呼出し後も使われる一時レジスタの値は壊れてしまう
+          for (auto& e : lastUse) {
+            if (static_cast<int>(i) < e.second && reg.count(e.first) && !isGlobal(e.first)) {
+              throw UnsupportedException("ir: temporary value live across call.");
+            }
+          }
+          g.li(intReg(SCRATCH), static_cast<uint32>(v->callee));
+          g.jalr(ra, intReg(SCRATCH)(0));
+          if (lastUse.count(v) || reg.count(v)) {
+            g.mv(intReg(allocate(v)), a0);
+          }
+          break;
+        }
+        case OpBr:
+          jumpTo(b, v->target[0], next);
+          break;
+        case OpBnez: {
+          const int c = regOf(a[0]);
+          Block* t = v->target[0];
+          Block* e = v->target[1];
+          const bool tPhi = !t->phis.empty();
+          const bool ePhi = !e->phis.empty();
+          if (!tPhi && !ePhi) {
+            // 分岐先のブロックまでの距離は分からないので、届かない場合は j を使う
+            if (e == next) {
+              g.bnezRelaxed(intReg(c), label(t).c_str());
+            } else if (t == next) {
+              g.beqzRelaxed(intReg(c), label(e).c_str());
+            } else {
+              g.bnezRelaxed(intReg(c), label(t).c_str());
+              g.j(label(e).c_str());
+            }
+          } else {
+            // phi の代入が必要な辺は分岐の後ろに代入命令を置く
+            const std::string els = prefix + "B" + std::to_string(b->id) + "F";
+            g.beqz(intReg(c), els.c_str());
+            jumpTo(b, t, nullptr);
+            g.L(els.c_str());
+            jumpTo(b, e, next);
+          }
+          break;
+        }
+        case OpRet:
+          if (!a.empty()) {
+            const int r = regOf(a[0]);
+            g.mv(a0, intReg(r));
+          }
+          g.epilogue(frame);
+          g.ret();
+          break;
+        case OpPhi:
+          break;
+      }
+    }
+  }
+};
+
+/// f を最適化済みとして g に変換する
+template <Isa isa>
+void lower(Function& f, CodeGenerator<isa>& g, const std::string& prefix = ".ir") {
+  Lowering<isa>(g, f, prefix).run();
+}
+
+}  // namespace ir
+}  // namespace xkon